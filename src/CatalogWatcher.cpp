@@ -0,0 +1,101 @@
+#include "CatalogWatcher.h"
+
+#include <iostream>
+#include <errno.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#define CATALOG_EVENT_BUF_SIZE 4096
+
+CatalogWatcher::CatalogWatcher(
+  const std::vector<std::string>& folders,
+  const std::string& manifest_file_name
+) :
+  fileDescriptor_(-1),
+  manifestFileName_(manifest_file_name),
+  manifestWatch_(-1)
+{
+#ifdef __linux__
+  fileDescriptor_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fileDescriptor_ == -1) {
+    std::cout << "\t- Failed to watch image folders for new images. Errno: " << errno << std::endl;
+    return;
+  }
+
+  // Writes are picked up once the file is closed, so that we never index
+  // a half-copied image
+  uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM;
+  for (const std::string& folder : folders) {
+    int watch = inotify_add_watch(fileDescriptor_, folder.c_str(), mask);
+    if (watch == -1) {
+      std::cout << "\t- Failed to watch " << folder << " for new images. Errno: " << errno << std::endl;
+      ::close(fileDescriptor_);
+      fileDescriptor_ = -1;
+      return;
+    }
+
+    if (manifestWatch_ == -1) {
+      manifestWatch_ = watch;
+    }
+  }
+#else
+  std::cout << "\t- Can't watch image folders for new images on this platform. "
+      << "New images will show up after the next range reload." << std::endl;
+#endif
+}
+
+CatalogWatcher::~CatalogWatcher() {
+  if (fileDescriptor_ != -1) {
+    ::close(fileDescriptor_);
+  }
+}
+
+int CatalogWatcher::getFd() const {
+  return fileDescriptor_;
+}
+
+std::vector<CatalogWatcher::change_t> CatalogWatcher::readChanges() const {
+  std::vector<change_t> changes;
+
+#ifdef __linux__
+  char buf[CATALOG_EVENT_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  while (fileDescriptor_ != -1) {
+    ssize_t len = ::read(fileDescriptor_, buf, sizeof(buf));
+    if (len <= 0) {
+      break;
+    }
+
+    for (char* ptr = buf; ptr < buf + len; ) {
+      const struct inotify_event* event = (const struct inotify_event *) ptr;
+      ptr += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        changes.push_back(change_t{CHANGES_LOST, ""});
+        continue;
+      }
+
+      // Changes to the folder itself (e.g. it was deleted) have no name
+      if (!event->len) {
+        continue;
+      }
+
+      std::string name(event->name);
+      bool is_written = event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO);
+
+      if (name == manifestFileName_ && event->wd == manifestWatch_) {
+        // A deleted manifest lists nothing new, so only writes matter
+        if (is_written) {
+          changes.push_back(change_t{MANIFEST_CHANGED, name});
+        }
+      } else {
+        changes.push_back(change_t{is_written ? IMAGE_ADDED : IMAGE_REMOVED, name});
+      }
+    }
+  }
+#endif
+
+  return changes;
+}
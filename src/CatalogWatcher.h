@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+class CatalogWatcher {
+
+  public:
+    /**
+     * Kinds of changes to the image folder.
+     */
+    enum ChangeType {
+      IMAGE_ADDED,       // image file was written or moved into the folder
+      IMAGE_REMOVED,     // image file was deleted or moved out of the folder
+      MANIFEST_CHANGED,  // manifest was written or replaced
+      CHANGES_LOST       // too many changes to track; rescan everything
+    };
+
+    /**
+     * Represents one change to the image folder.
+     */
+    struct change_t {
+      ChangeType type;
+      std::string name;
+    };
+
+  private:
+    /**
+     * inotify file-descriptor. -1 if we aren't watching.
+     */
+    int fileDescriptor_;
+
+    /**
+     * Name of the manifest file, and the watch on the folder that holds it.
+     */
+    std::string manifestFileName_;
+    int manifestWatch_;
+
+  public:
+    /**
+     * CatalogWatcher()
+     * - Ctor for CatalogWatcher. Starts watching the folders. Reports and
+     *   carries on w/o watching if that fails, or isn't supported on this
+     *   platform (only Linux has inotify).
+     * @param folders : image folders
+     * @param manifest_file_name : name of the manifest file in the first
+     *                             folder
+     */
+    CatalogWatcher(const std::vector<std::string>& folders, const std::string& manifest_file_name);
+
+    /**
+     * ~CatalogWatcher()
+     * - Dtor for CatalogWatcher. Stops watching.
+     */
+    ~CatalogWatcher();
+
+    CatalogWatcher(const CatalogWatcher&) = delete;
+    CatalogWatcher& operator=(const CatalogWatcher&) = delete;
+
+    /**
+     * getFd()
+     * - Return the fd that becomes readable when a folder changes, or -1
+     *   if we aren't watching.
+     */
+    int getFd() const;
+
+    /**
+     * readChanges()
+     * - Return the changes since the last call, oldest first. Doesn't
+     *   block.
+     */
+    std::vector<change_t> readChanges() const;
+};
@@ -1,7 +1,11 @@
 #include "Connection.h"
 
 #include <iostream>
+#include <algorithm>
 #include <errno.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 Connection::Connection(
     int file_descriptor
@@ -52,6 +56,31 @@ Connection::Connection(
   remoteDomainName_ = std::string(hostname);
 }
 
+Connection::Connection(
+    int file_descriptor,
+    uint16_t local_port,
+    uint32_t local_ipv4,
+    uint16_t remote_port,
+    uint32_t remote_ipv4
+) :
+    fileDescriptor_(file_descriptor),
+    localPort_(local_port),
+    remotePort_(remote_port),
+    localIpv4_(local_ipv4),
+    remoteIpv4_(remote_ipv4)
+{
+  char hostname[BUFFER_SIZE+1];
+
+  // Both ends are on this host
+  memset(hostname, 0, BUFFER_SIZE+1);
+  if (::gethostname(hostname, BUFFER_SIZE) == -1) {
+    throw SocketException("Failed to determine domain name of localhost");
+  }
+
+  localDomainName_ = std::string(hostname);
+  remoteDomainName_ = localDomainName_;
+}
+
 int Connection::getFd() const {
   return fileDescriptor_;
 }
@@ -104,6 +133,27 @@ void Connection::writeAll(std::string data) const {
   }
 }
 
+void Connection::sendFile(int file_fd, size_t size) const {
+  off_t offset = 0;
+  while ((size_t) offset < size) {
+#ifdef __linux__
+    ssize_t bytes_sent = ::sendfile(fileDescriptor_, file_fd, &offset, size - offset);
+    if (bytes_sent <= 0) {
+      throw SocketException(std::string("Failed to send file to socket. Error: ") + strerror(errno));
+    }
+#else
+    char buff[BUFFER_SIZE];
+    ssize_t bytes_read = ::pread(file_fd, buff, std::min(sizeof(buff), size - offset), offset);
+    if (bytes_read <= 0) {
+      throw SocketException(std::string("Failed to read file to send. Error: ") + strerror(errno));
+    }
+
+    writeAll(std::string(buff, bytes_read));
+    offset += bytes_read;
+#endif
+  }
+}
+
 uint16_t Connection::getLocalPort() const {
   return localPort_;
 }
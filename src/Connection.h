@@ -45,6 +45,23 @@ class Connection {
      */
     explicit Connection(int file_descriptor); 
 
+    /**
+     * Connection()
+     * - Ctor for Connection over a socket w/o an inet address, e.g. one
+     *   end of a socketpair(). Reports the provided addresses instead.
+     * @param file_descriptror : socket fd
+     * @param local_port : port to report as ours in host-byte-order
+     * @param local_ipv4 : ipv4 to report as ours in host-byte-order
+     * @param remote_port : port to report as the remote's in host-byte-order
+     * @param remote_ipv4 : ipv4 to report as the remote's in host-byte-order
+     */
+    Connection(
+        int file_descriptor,
+        uint16_t local_port,
+        uint32_t local_ipv4,
+        uint16_t remote_port,
+        uint32_t remote_ipv4);
+
     /**
      * getFd()
      * - Return fild descriptor for socket.
@@ -89,6 +106,15 @@ class Connection {
      */
     void writeAll(std::string data) const;
 
+    /**
+     * sendFile()
+     * - Write the first 'size' bytes of a file to socket. The kernel
+     *   copies them straight from the page cache where it can.
+     * @param file_fd : fd of file, open for reading
+     * @param size : number of bytes to send
+     */
+    void sendFile(int file_fd, size_t size) const;
+
     /**
      * getLocalPort()
      * - Return port of local connection in host-byte-order.
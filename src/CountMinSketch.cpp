@@ -0,0 +1,110 @@
+#include "CountMinSketch.h"
+
+#include <algorithm>
+#include <functional>
+#include <assert.h>
+
+CountMinSketch::CountMinSketch(size_t width, size_t depth, size_t num_heavy_hitters) :
+  width_(width),
+  depth_(depth),
+  counters_(width * depth, 0),
+  maxHeavyHitters_(num_heavy_hitters)
+{
+  // Fail b/c the sketch needs at least one counter
+  assert(width_ && depth_);
+}
+
+size_t CountMinSketch::computeIndex(uint64_t hash, size_t row) const {
+  // Derive the row's hash from two halves of one hash (Kirsch-Mitzenmacher)
+  uint64_t h1 = hash & 0xffffffff;
+  uint64_t h2 = (hash >> 32) | 1;
+
+  return row * width_ + (h1 + row * h2) % width_;
+}
+
+uint32_t CountMinSketch::increment(const std::string& key) {
+  return add(key, 1);
+}
+
+uint32_t CountMinSketch::add(const std::string& key, uint32_t count) {
+  uint64_t hash = std::hash<std::string>()(key);
+
+  uint32_t estimate = UINT32_MAX;
+  for (size_t row = 0; row < depth_; ++row) {
+    uint32_t& counter = counters_[computeIndex(hash, row)];
+
+    // Saturate rather than wrap
+    counter = (counter > UINT32_MAX - count) ? UINT32_MAX : counter + count;
+    estimate = std::min(estimate, counter);
+  }
+
+  updateHeavyHitters(key, estimate);
+  return estimate;
+}
+
+uint32_t CountMinSketch::estimate(const std::string& key) const {
+  uint64_t hash = std::hash<std::string>()(key);
+
+  uint32_t count = UINT32_MAX;
+  for (size_t row = 0; row < depth_; ++row) {
+    count = std::min(count, counters_[computeIndex(hash, row)]);
+  }
+
+  return count;
+}
+
+void CountMinSketch::decay() {
+  for (uint32_t& counter : counters_) {
+    counter /= 2;
+  }
+
+  for (heavy_hitter_t& heavy_hitter : heavyHitters_) {
+    heavy_hitter.count /= 2;
+  }
+
+  // Forget keys that have cooled off entirely
+  heavyHitters_.erase(
+      std::remove_if(
+          heavyHitters_.begin(),
+          heavyHitters_.end(),
+          [] (const heavy_hitter_t& heavy_hitter) { return heavy_hitter.count == 0; }
+      ),
+      heavyHitters_.end()
+  );
+}
+
+void CountMinSketch::updateHeavyHitters(const std::string& key, uint32_t count) {
+  if (!maxHeavyHitters_) {
+    return;
+  }
+
+  auto least = heavyHitters_.begin();
+  for (auto it = heavyHitters_.begin(); it != heavyHitters_.end(); ++it) {
+    if (it->key == key) {
+      it->count = count;
+      return;
+    }
+
+    if (it->count < least->count) {
+      least = it;
+    }
+  }
+
+  if (heavyHitters_.size() < maxHeavyHitters_) {
+    heavyHitters_.push_back(heavy_hitter_t{key, count});
+  } else if (least->count < count) {
+    *least = heavy_hitter_t{key, count};
+  }
+}
+
+std::vector<CountMinSketch::heavy_hitter_t> CountMinSketch::getHeavyHitters() const {
+  std::vector<heavy_hitter_t> heavy_hitters(heavyHitters_);
+
+  std::sort(
+      heavy_hitters.begin(),
+      heavy_hitters.end(),
+      [] (const heavy_hitter_t& lhs, const heavy_hitter_t& rhs) { return lhs.count > rhs.count; }
+  );
+
+  return heavy_hitters;
+}
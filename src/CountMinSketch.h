@@ -0,0 +1,97 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+class CountMinSketch {
+
+  public:
+    /**
+     * Key tracked as one of the most frequent, with its estimated count.
+     */
+    struct heavy_hitter_t {
+      std::string key;
+      uint32_t count;
+    };
+
+  private:
+    /**
+     * Number of counters per row, and number of rows.
+     */
+    size_t width_, depth_;
+
+    /**
+     * Counters, row after row.
+     */
+    std::vector<uint32_t> counters_;
+
+    /**
+     * Most frequent keys seen so far, at most 'maxHeavyHitters_' of them.
+     */
+    std::vector<heavy_hitter_t> heavyHitters_;
+    size_t maxHeavyHitters_;
+
+    /**
+     * computeIndex()
+     * - Return the index of the key's counter in the provided row.
+     * @param hash : hash of key
+     * @param row : row of sketch
+     */
+    size_t computeIndex(uint64_t hash, size_t row) const;
+
+    /**
+     * updateHeavyHitters()
+     * - Track key as a heavy hitter if it's now among the most frequent.
+     * @param key : key that was just counted
+     * @param count : key's new estimated count
+     */
+    void updateHeavyHitters(const std::string& key, uint32_t count);
+
+  public:
+    /**
+     * CountMinSketch()
+     * - Ctor for CountMinSketch.
+     * @param width : number of counters per row
+     * @param depth : number of rows (independent hashes)
+     * @param num_heavy_hitters : number of most frequent keys to track
+     */
+    CountMinSketch(size_t width, size_t depth, size_t num_heavy_hitters);
+
+    /**
+     * increment()
+     * - Count one occurrence of the key.
+     * @param key : key to count
+     * @return estimated count of the key, including this occurrence
+     */
+    uint32_t increment(const std::string& key);
+
+    /**
+     * add()
+     * - Count several occurrences of the key at once, e.g. ones another
+     *   node counted.
+     * @param key : key to count
+     * @param count : number of occurrences
+     * @return estimated count of the key, including these occurrences
+     */
+    uint32_t add(const std::string& key, uint32_t count);
+
+    /**
+     * estimate()
+     * - Return the estimated count of the key. Never underestimates.
+     * @param key : key to look up
+     */
+    uint32_t estimate(const std::string& key) const;
+
+    /**
+     * decay()
+     * - Halve every count, so that old occurrences fade out.
+     */
+    void decay();
+
+    /**
+     * getHeavyHitters()
+     * - Return the most frequent keys, most frequent first.
+     */
+    std::vector<heavy_hitter_t> getHeavyHitters() const;
+};
@@ -0,0 +1,44 @@
+#include "CountingBloomFilter.h"
+
+#include <string.h>
+#include <assert.h>
+
+CountingBloomFilter::CountingBloomFilter() {
+  clear();
+}
+
+void CountingBloomFilter::add(const ImageKey& key) {
+  for (size_t i = 0; i < NUM_BLOOM_INDICES; ++i) {
+    uint8_t& counter = counters_[key.getBloomIndex(i)];
+    if (counter != UINT8_MAX) {
+      ++counter;
+    }
+  }
+}
+
+void CountingBloomFilter::remove(const ImageKey& key) {
+  for (size_t i = 0; i < NUM_BLOOM_INDICES; ++i) {
+    uint8_t& counter = counters_[key.getBloomIndex(i)];
+
+    // Fail b/c the key was never added
+    assert(counter);
+
+    if (counter != UINT8_MAX) {
+      --counter;
+    }
+  }
+}
+
+bool CountingBloomFilter::mayContain(const ImageKey& key) const {
+  for (size_t i = 0; i < NUM_BLOOM_INDICES; ++i) {
+    if (!counters_[key.getBloomIndex(i)]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void CountingBloomFilter::clear() {
+  memset(counters_, 0, sizeof(counters_));
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "ImageKey.h"
+
+#define BLOOM_FILTER_SLOTS 64  // bfIDX() yields 6-bit indices
+
+class CountingBloomFilter {
+
+  private:
+    /**
+     * Number of stored keys that hash to each slot. A counter that
+     * saturates stays put, so that removals can't cause false negatives.
+     */
+    uint8_t counters_[BLOOM_FILTER_SLOTS];
+
+  public:
+    /**
+     * CountingBloomFilter()
+     * - Ctor for CountingBloomFilter. Starts out empty.
+     */
+    CountingBloomFilter();
+
+    /**
+     * add()
+     * - Add key to the filter.
+     * @param key : key of image
+     */
+    void add(const ImageKey& key);
+
+    /**
+     * remove()
+     * - Remove key from the filter.
+     * - CAUTION: the key must have been added before
+     * @param key : key of image
+     */
+    void remove(const ImageKey& key);
+
+    /**
+     * mayContain()
+     * - Return false iff the key is definitely not in the filter.
+     * @param key : key of image
+     */
+    bool mayContain(const ImageKey& key) const;
+
+    /**
+     * clear()
+     * - Remove every key.
+     */
+    void clear();
+};
@@ -3,15 +3,17 @@
 #include "dht_packets.h"
 
 #include <stdio.h>
-#ifdef __APPLE__
-#include <GLUT/glut.h>
-#else
-#include <GL/glut.h>
-#endif
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
 
 const std::string DhtNode::stringifySrchPkt(const dhtsrch_t& pkt) const {
   // Fail b/c this isn't a search packet
-  assert(pkt.msg.header.type == SRCH || pkt.msg.header.type == SRCH_ATLOC);
+  assert(pkt.msg.header.type == SRCH 
+      || pkt.msg.header.type == SRCH_ATLOC
+      || pkt.msg.header.type == ISRCH
+      || pkt.msg.header.type == ISRCH_ATLOC);
 
   std::string pkt_str = "<node-id: ";
   pkt_str += std::to_string((int) pkt.msg.node.id);
@@ -55,6 +57,8 @@ void DhtNode::initFingers() {
   predecessor.remote
       .setRemotePort(dhtReceiver_->getPort())
       .setRemoteIpv4Address(dhtReceiver_->getIpv4());
+
+  rebuildRoutingTable();
 }
 
 void DhtNode::fixUp(size_t j) {
@@ -101,7 +105,59 @@ void DhtNode::fixDown(size_t j) {
 void DhtNode::sendJoinRequest() {
   // Fail b/c target was not specified
   assert(hasTarget_);
-  
+
+  // Don't let earlier requests race with this one
+  awaitJoinRequests();
+
+  std::string seeds_str;
+  for (const seed_t& seed : seeds_) {
+    seeds_str += (seeds_str.empty() ? "" : ", ") + seed.fqdn + ":" + std::to_string(seed.port);
+  }
+
+  const std::string message = assembleJoinRequest(seeds_str);
+
+  // Contact every seed at once, so a slow seed doesn't hold us up
+  numFailedJoins_ = 0;
+  for (const seed_t& seed : seeds_) {
+    joinThreads_.emplace_back(&DhtNode::sendJoinRequestToSeed, this, message, seed);
+  }
+}
+
+void DhtNode::sendJoinRequestToSeed(const std::string& message, const seed_t& seed) {
+  try {
+    // Connect to DHT network through seed
+    ServerBuilder builder; 
+    const Connection remote = builder
+      .setRemoteDomainName(seed.fqdn)
+      .setRemotePort(seed.port)
+      .build();
+
+    // Send join message to seed and close connection
+    remote.writeAll(message);
+    remote.close();
+
+  } catch (const SocketException& e) {
+    std::cout << "\t- Failed while writing JOIN packet to " << seed.fqdn << ":"
+        << seed.port << std::endl;
+
+    // The event loop gives up once every seed has failed
+    ++numFailedJoins_;
+  }
+}
+
+bool DhtNode::haveJoinsFailed() const {
+  return hasTarget_ && !hasJoined_ && numFailedJoins_ == seeds_.size();
+}
+
+void DhtNode::awaitJoinRequests() {
+  for (std::thread& join_thread : joinThreads_) {
+    join_thread.join();
+  }
+
+  joinThreads_.clear();
+}
+
+std::string DhtNode::assembleJoinRequest(const std::string& remote_str) const {
   // Assemble header packet 
   dhtheader_t header = {DHTM_VERS, DHTM_JOIN};
   
@@ -113,23 +169,25 @@ void DhtNode::sendJoinRequest() {
 
   // Assemble join packet
   dhtmsg_t join_pkt = {header, htons(DHTM_TTL), self};
-  const std::string message((const char *) &join_pkt, sizeof(join_pkt));
 
-  std::cout << "Sending JOIN packet to " << targetFqdn_ << ":" << (int) targetPort_ <<
+  std::cout << "Sending JOIN packet to " << remote_str <<
       " <ttl: " << (int) ntohs(join_pkt.ttl) << 
       ", id: " << (int) join_pkt.node.id << 
       ", port: " << (int) ntohs(join_pkt.node.port) << 
       ", ipv4: " << stringifyIpv4(join_pkt.node.ipv4) << ">" << std::endl;
 
-  // Connect to DHT network through specified target
-  ServerBuilder builder; 
-  const Connection remote = builder
-    .setRemoteDomainName(targetFqdn_)
-    .setRemotePort(targetPort_)
-    .build();
+  return std::string((const char *) &join_pkt, sizeof(join_pkt));
+}
+
+void DhtNode::sendJoinRequest(
+  const ServerBuilder& remote_builder,
+  const std::string& remote_str
+) {
+  const std::string message = assembleJoinRequest(remote_str);
 
   // Send join message to first network node and close connection
   try {
+    const Connection remote = buildConnection(remote_builder);
     remote.writeAll(message);
     remote.close();
   } catch (const SocketException& e) {
@@ -138,11 +196,247 @@ void DhtNode::sendJoinRequest() {
   }
 }
 
+std::string DhtNode::getRingCachePath() const {
+  return std::string(RING_CACHE_PATH) + "." + std::to_string(id_);
+}
+
+bool DhtNode::hasRingCache() const {
+  // Virtual nodes join through their host, which is closer still
+  return !host_ && (hasFixedId_ || isRestored_);
+}
+
+bool DhtNode::findCachedEntryPoint(seed_t& seed) const {
+  std::ifstream ring_cache(getRingCachePath());
+
+  bool is_found = false;
+  bool is_timed = false;
+  double best_rtt = 0;
+  size_t best_distance = NUM_IDS;
+
+  std::string line;
+  while (std::getline(ring_cache, line)) {
+    int node_id;
+    std::string fqdn;
+    uint16_t port;
+    double rtt_usec = 0;
+
+    std::istringstream entry(line);
+    if (!(entry >> node_id >> fqdn >> port)) {
+      continue;
+    }
+
+    entry >> rtt_usec;
+
+    // Clockwise distance from our id to the node
+    size_t distance = static_cast<uint8_t>(node_id - id_);
+
+    // A measured rtt beats any guess from the ids
+    bool is_better;
+    if (rtt_usec > 0) {
+      is_better = !is_timed || rtt_usec < best_rtt;
+    } else {
+      is_better = !is_timed && distance < best_distance;
+    }
+
+    if (is_better) {
+      is_timed = rtt_usec > 0;
+      best_rtt = rtt_usec;
+      best_distance = distance;
+      seed = {fqdn, port};
+      is_found = true;
+    }
+  }
+
+  return is_found;
+}
+
+void DhtNode::writeRingCache() const {
+  std::vector<const finger_t*> nodes;
+  for (const finger_t& finger : fingerTable_) {
+    nodes.push_back(&finger);
+  }
+
+  for (const owner_t& owner : ownerCache_) {
+    nodes.push_back(&owner.node);
+  }
+
+  // Write to a temporary file first, so that the next run never reads a
+  // partial one
+  const std::string ring_cache_path = getRingCachePath();
+  const std::string tmp_path = ring_cache_path + ".tmp";
+  std::ofstream ring_cache(tmp_path);
+
+  std::vector<uint8_t> written_ids;
+  for (const finger_t* node : nodes) {
+    if (node->node_id == id_ 
+        || std::find(written_ids.begin(), written_ids.end(), node->node_id) != written_ids.end())
+    {
+      continue;
+    }
+
+    // 0 if we never timed the node
+    double rtt_usec = 0;
+    findRtt(*node, rtt_usec);
+
+    written_ids.push_back(node->node_id);
+    ring_cache << (int) node->node_id << " " 
+        << stringifyIpv4(htonl(node->remote.getRemoteIpv4Address())) << " "
+        << node->remote.getRemotePort() << " " << (uint64_t) rtt_usec << std::endl;
+  }
+
+  ring_cache.close();
+
+  // Nothing worth keeping if we never met anyone
+  if (written_ids.empty()) {
+    std::remove(tmp_path.c_str());
+    return;
+  }
+
+  std::rename(tmp_path.c_str(), ring_cache_path.c_str());
+}
+
 const DhtNode::finger_t& DhtNode::getPredecessor() const {
   return fingerTable_.back();
 }
 
+void DhtNode::rebuildRoutingTable() {
+  for (size_t object_id = 0; object_id < NUM_IDS; ++object_id) {
+    size_t finger_idx = computeFingerForForwarding(object_id);
+
+    // Detour through a nearer finger only if the selected one isn't
+    // expected to own the object anyway
+    if (getHost()->proximitySlackIds_
+        && !expectToFindObject(object_id, fingerTable_.at(finger_idx)))
+    {
+      finger_idx = preferNearbyFinger(object_id, finger_idx);
+    }
+
+    route_t& route = routingTable_[object_id];
+    route.finger_idx = static_cast<uint8_t>(finger_idx);
+    route.atloc = expectToFindObject(object_id, fingerTable_.at(finger_idx));
+  }
+}
+
+size_t DhtNode::preferNearbyFinger(uint8_t object_id, size_t finger_idx) const {
+  double chosen_rtt;
+  if (!findRtt(fingerTable_.at(finger_idx), chosen_rtt)) {
+    return finger_idx;
+  }
+
+  // Ids left to cover from the selected finger
+  uint8_t min_remaining = object_id - fingerTable_.at(finger_idx).node_id;
+
+  size_t chosen_idx = finger_idx;
+  for (size_t idx = finger_idx; idx-- > 0;) {
+    const finger_t& finger = fingerTable_.at(idx);
+    if (finger.node_id == id_ || finger.node_id == fingerTable_.at(chosen_idx).node_id) {
+      continue;
+    }
+
+    // Lower fingers only make less progress
+    uint8_t remaining = object_id - finger.node_id;
+    if ((size_t) (remaining - min_remaining) > getHost()->proximitySlackIds_) {
+      break;
+    }
+
+    double rtt;
+    if (findRtt(finger, rtt) && rtt < chosen_rtt * PROXIMITY_RTT_RATIO) {
+      chosen_idx = idx;
+      chosen_rtt = rtt;
+    }
+  }
+
+  return chosen_idx;
+}
+
+Connection DhtNode::connectToNode(const finger_t& node) {
+  auto start = std::chrono::steady_clock::now();
+
+  // Stand in for the distance to a far away node
+  const DhtNode* host = getHost();
+  auto delay_it = host->peerDelays_.find(node.node_id);
+  if (delay_it != host->peerDelays_.end()) {
+    std::this_thread::sleep_for(delay_it->second);
+  }
+
+  Connection connection = buildConnection(node.remote);
+  auto rtt = std::chrono::steady_clock::now() - start;
+
+  recordRtt(node, std::chrono::duration<double, std::micro>(rtt).count());
+  return connection;
+}
+
+Connection DhtNode::buildConnection(const ServerBuilder& remote_builder) const {
+  // Loopback TCP is only for other processes
+  LocalTransport* transport = getHost()->localTransport_;
+  if (transport && remote_builder.hasRemoteIpv4Address()
+      && transport->hasInbox(remote_builder.getRemotePort(), remote_builder.getRemoteIpv4Address()))
+  {
+    return transport->connect(remote_builder.getRemotePort(), remote_builder.getRemoteIpv4Address());
+  }
+
+  return remote_builder.build();
+}
+
+void DhtNode::recordRtt(const finger_t& node, double sample_usec) {
+  uint64_t key = (static_cast<uint64_t>(node.remote.getRemoteIpv4Address()) << 16)
+      | node.remote.getRemotePort();
+
+  auto it = rttEwmaUsec_.find(key);
+  if (it == rttEwmaUsec_.end()) {
+    rttEwmaUsec_[key] = sample_usec;
+    if (getHost()->proximitySlackIds_) {
+      rebuildRoutingTable();
+    }
+
+    return;
+  }
+
+  double old_rtt = it->second;
+  it->second = (1 - RTT_EWMA_WEIGHT) * old_rtt + RTT_EWMA_WEIGHT * sample_usec;
+
+  // Routing only cares about large shifts
+  if (getHost()->proximitySlackIds_
+      && std::abs(it->second - old_rtt) > RTT_REBUILD_THRESHOLD * old_rtt)
+  {
+    rebuildRoutingTable();
+  }
+}
+
+bool DhtNode::findRtt(const finger_t& node, double& rtt_usec) const {
+  uint64_t key = (static_cast<uint64_t>(node.remote.getRemoteIpv4Address()) << 16)
+      | node.remote.getRemotePort();
+
+  auto it = rttEwmaUsec_.find(key);
+  if (it == rttEwmaUsec_.end()) {
+    return false;
+  }
+
+  rtt_usec = it->second;
+  return true;
+}
+
+void DhtNode::reportLookupLatency() {
+  auto latency = std::chrono::steady_clock::now() - queryStart_;
+  uint64_t latency_usec = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+
+  lookupLatencyTotalUsec_ += latency_usec;
+  ++numLookups_;
+
+  std::cout << "\t- Lookup took " << latency_usec / 1000.0 << " ms (average: " 
+      << lookupLatencyTotalUsec_ / 1000.0 / numLookups_ << " ms over " << numLookups_
+      << " lookups, " << numHedgedLookups_ << " hedged)" << std::endl;
+}
+
 size_t DhtNode::findFingerForForwarding(uint8_t object_id) const {
+  return routingTable_[object_id].finger_idx;
+}
+
+bool DhtNode::expectToFindObjectAtRoute(uint8_t object_id) const {
+  return routingTable_[object_id].atloc;
+}
+
+size_t DhtNode::computeFingerForForwarding(uint8_t object_id) const {
   size_t limit = fingerTable_.size() - 1;
   size_t idx = 1;
 
@@ -166,6 +460,12 @@ size_t DhtNode::findFingerForForwarding(uint8_t object_id) const {
 }
 
 bool DhtNode::expectToFindObject(uint8_t object_id, const finger_t& finger) const {
+  // (fid, nid] would span the whole ring when the finger's node sits exactly
+  // on its finger-id, but then the node only covers fid itself
+  if (finger.finger_id == finger.node_id) {
+    return object_id == finger.finger_id;
+  }
+
   return ID_inrange(object_id, finger.finger_id, finger.node_id) 
       || object_id == finger.finger_id; 
 }
@@ -197,16 +497,77 @@ void DhtNode::initDhtReceiver() {
   // Initialize listening socket
   ServiceBuilder builder;
   dhtReceiver_ = builder.buildNew();
+  updateLocalInbox();
 
   // Report address of this DhtNode
   std::cout << "DhtNode address: " << dhtReceiver_->getDomainName()
       << ":" << dhtReceiver_->getPort() << std::endl;
 }
 
+void DhtNode::updateLocalInbox() {
+  LocalTransport* transport = getHost()->localTransport_;
+  if (!transport) {
+    return;
+  }
+
+  if (localInboxFd_ == -1) {
+    localInboxFd_ = transport->openInbox(dhtReceiver_->getPort(), dhtReceiver_->getIpv4());
+  } else {
+    transport->moveInbox(localInboxFd_, dhtReceiver_->getPort(), dhtReceiver_->getIpv4());
+  }
+}
+
+bool DhtNode::rebindDhtReceiver(uint16_t port) {
+  // Release our own port first. Nobody knows about it yet.
+  bool is_same_port = port == dhtReceiver_->getPort();
+  if (is_same_port) {
+    dhtReceiver_->close();
+    delete dhtReceiver_;
+    dhtReceiver_ = nullptr;
+  }
+
+  // The port can only be bound again after a restart, while connections
+  // to it linger in TIME_WAIT, if every socket bound to it allows reuse
+  const Service* receiver = nullptr;
+  try {
+    ServiceBuilder builder;
+    receiver = builder
+        .setPort(port)
+        .enableAddressReuse()
+        .buildNew();
+  } catch (const SocketException& e) {
+    // Fail b/c we gave up our only port
+    if (is_same_port) {
+      std::cout << "Failed to rebind dht receiver to port " << port << "!" << std::endl;
+      exit(1);
+    }
+
+    return false;
+  }
+
+  if (!is_same_port) {
+    dhtReceiver_->close();
+    delete dhtReceiver_;
+  }
+
+  dhtReceiver_ = receiver;
+  updateLocalInbox();
+
+  // Report new address of this DhtNode
+  std::cout << "DhtNode address: " << dhtReceiver_->getDomainName()
+      << ":" << dhtReceiver_->getPort() << std::endl;
+
+  return true;
+}
+
 void DhtNode::initImageReceiver() {
   // Initialize listening socket
   ServiceBuilder builder;
   imageReceiver_ = builder.buildNew();
+
+  // Images are read off the event loop, so that a slow disk doesn't hold
+  // up the network
+  imageReader_ = new ImageReader(imageStore_, NUM_IMAGE_READERS);
   
   // Report address of this image socket 
   std::cout << "Image receiver address: " << imageReceiver_->getDomainName()
@@ -244,8 +605,14 @@ uint8_t DhtNode::foldId(uint16_t unfolded_id) const {
 
 void DhtNode::handleDhtTraffic() {
   // Accept connection from requesting remote
-  const Connection connection = dhtReceiver_->accept();
+  handleDhtConnection(dhtReceiver_->accept());
+}
+
+void DhtNode::handleLocalDhtTraffic() {
+  handleDhtConnection(getHost()->localTransport_->accept(localInboxFd_));
+}
 
+void DhtNode::handleDhtConnection(const Connection& connection) {
   // Read dht message and close connection
   dhtmsg_t message;
   size_t message_size = sizeof(message);
@@ -276,12 +643,28 @@ void DhtNode::handleDhtTraffic() {
     case SRCH_ATLOC:
       handleSrchAndCloseCxn(message, connection);
       return;
+    case ISRCH:
+    case ISRCH_ATLOC:
+      handleIsrchAndCloseCxn(message, connection);
+      return;
     case RPLY:
       handleRplyAndCloseCxn(message, connection);
       return;
     case MISS:
       handleMissAndCloseCxn(message, connection);
       return;
+    case LEAVE:
+      handleLeaveAndCloseCxn(message, connection);
+      return;
+    case SUCC:
+      handleSuccAndCloseCxn(message, connection);
+      return;
+    case XFER:
+      handleXferAndCloseCxn(message, connection);
+      return;
+    case REID:
+      handleReidAndCloseCxn(message, connection);
+      return;
   }
  
   // Subsequent ops don't neet the connection, so close it.
@@ -289,9 +672,6 @@ void DhtNode::handleDhtTraffic() {
   
   // Handle ops that permit closed connections
   switch (message.header.type) {
-    case REID:
-      handleReid();
-      break;
     default:
       std::cout << "Invalid header type received: " << (int) message.header.type
           << std::endl;
@@ -317,6 +697,12 @@ bool DhtNode::handleCliInput() {
       case 'p':
         printFingers(); 
         break;
+      case 'l':
+        reportLoad();
+        break;
+      case 't':
+        reportPopularity();
+        break;
       default:
         reportCliInstructions();
         break;
@@ -329,23 +715,75 @@ bool DhtNode::handleCliInput() {
 
 void DhtNode::handleImageTraffic() {
 
-  // Accept connection from netimg client
-  const Connection * cxn = imageReceiver_->acceptNew();
+  // Take every netimg client that's already waiting, so that their
+  // queries are hashed and looked up as one batch
+  std::vector<const Connection*> clients;
+  std::vector<std::string> file_names;
+  std::vector<bool> accepts_rle;
+
+  do {
+    // Accept connection from netimg client
+    const Connection * cxn = imageReceiver_->acceptNew();
   
-  // Report that we're processing image traffic
-  std::cout << "\nReceived QRY from netimg client: <" << 
-      cxn->getRemoteDomainName() << ":" << cxn->getRemotePort() << ">" << std::endl;
+    // Report that we're processing image traffic
+    std::cout << "\nReceived QRY from netimg client: <" << 
+        cxn->getRemoteDomainName() << ":" << cxn->getRemotePort() << ">" << std::endl;
+
+    // Read message from netimg client
+    iqry_t message;
+    cxn->readAll( (void *) &message, sizeof(message));
+
+    // Fail due to incorrect netimg packet version
+    assert(message.header.vers == NETIMG_VERS);
+
+    clients.push_back(cxn);
+    file_names.push_back(std::string(message.name));
+    accepts_rle.push_back(message.header.type & NETIMG_RLE_OK);
 
-  // Read message from netimg client
-  iqry_t message;
-  cxn->readAll( (void *) &message, sizeof(message));
+  } while (clients.size() < MAX_INGRESS_BATCH && imageReceiver_->hasPendingConnection());
+
+  if (clients.size() > 1) {
+    std::cout << "\nAnswering " << clients.size() << " netimg queries as one batch..." << std::endl;
+  }
+
+  // Hash the names once, for the local lookups and the DHT search alike
+  std::vector<ImageKey> keys = ImageKey::hashNames(file_names);
+
+  // Count demand for the images, even if we're too busy to serve them
+  for (const ImageKey& key : keys) {
+    recordImageRequest(key);
+  }
+
+  // Query local db for every requested image
+  std::vector<QueryResult> results = imageDb_->queryBatch(keys);
+
+  for (size_t i = 0; i < clients.size(); ++i) {
+    handleImageQuery(clients.at(i), keys.at(i), results.at(i), accepts_rle.at(i));
+  }
+}
 
-  // Fail due to incorrect netimg packet version
-  assert(message.header.vers == NETIMG_VERS);
+void DhtNode::handleImageQuery(
+  const Connection* cxn,
+  const ImageKey& key,
+  QueryResult result,
+  bool accepts_rle
+) {
+  // Report which query we're answering
+  std::cout << "\t- Query for image: " << key.getName() << std::endl;
+
+  //// IMAGE IS LOCAL -> FORWARD TO CLIENT ////
+  // We don't have to wait on anyone, so serve it even if we're busy
+  if (result == QUERY_SUCCESS) {
+    // Report image found locally
+    std::cout << "\t- Image found locally!" << std::endl;
+    streamImage(cxn, key.getName(), accepts_rle);
+    return;
+  }
 
   // Reject the netimg query if we're busy
   if (servicingImageQuery_) {
     rejectNetimgQuery(cxn);
+    delete cxn;
     return;
   } 
 
@@ -358,19 +796,9 @@ void DhtNode::handleImageTraffic() {
   // Cache connection so that we can send back to the netimg client
   // when we find the image
   imageClient_ = cxn;
-
-  // Query local db for the requested image
-  const std::string file_name(message.name);
-  QueryResult result = imageDb_->query(file_name);
+  imageClientAcceptsRle_ = accepts_rle;
 
   switch (result) {
-    //// IMAGE IS LOCAL -> FORWARD TO CLIENT ////
-    case QUERY_SUCCESS:
-      // Report image found locally
-      std::cout << "\t- Image found locally!" << std::endl;
-      handleLocalQuerySuccess(file_name);
-      return;
-
     //// IMAGE IS NOT LOCAL -> QUERY DHT  -> FORWARD TO CLIENT ////
     case BLOOM_FILTER_MISS:
       // Report bloom filter miss
@@ -386,11 +814,14 @@ void DhtNode::handleImageTraffic() {
       exit(1);
   }
 
-  unsigned char md[SHA1_MDLEN];
+  // Check the other virtual nodes in this process before going to the DHT
+  if (queryLocalNodes(key)) {
+    std::cout << "\t- Image found at one of our virtual nodes!" << std::endl;
+    handleLocalQuerySuccess(key.getName());
+    return;
+  }
 
-  SHA1((unsigned char *) file_name.c_str(), file_name.size(), md);
-  uint8_t id = static_cast<uint8_t>(ID(md));
-  if (inOurPurview(id)) {
+  if (inLocalPurview(key.getId())) {
     // Report that we're squashing the request, b/c we should have it, but we don't
     std::cout << "\t- Query unseccessful! Image-ID is in our purview, but we don't have it..." << std::endl;
     
@@ -399,7 +830,7 @@ void DhtNode::handleImageTraffic() {
 
   } else {
     // Forward packet to dht
-    forwardInitialImageQuery(file_name);   
+    forwardInitialImageQuery(key);
   }
 }
 
@@ -423,10 +854,10 @@ void DhtNode::sendImageNotFound() {
   imageClient_ = nullptr;
 
   servicingImageQuery_ = false;
-   
+  isHedgePending_ = false;
 }
 
-void DhtNode::forwardInitialImageQuery(const std::string& file_name) {
+void DhtNode::forwardInitialImageQuery(const ImageKey& key) {
  
   // Fail b/c we should be in the 'servicing query' state
   assert(servicingImageQuery_);
@@ -437,6 +868,9 @@ void DhtNode::forwardInitialImageQuery(const std::string& file_name) {
   // Report that we're forwarding the image query over the dht
   std::cout << "\t- Forwarding image query to the DHT!" << std::endl;
 
+  // Time the lookup until the RPLY/MISS comes back
+  queryStart_ = std::chrono::steady_clock::now();
+
   // Assemble dhtsrch_t packet
   dhtsrch_t srch_pkt;
   srch_pkt.msg.header = {DHTM_VERS, DHTM_SRCH};
@@ -453,453 +887,652 @@ void DhtNode::forwardInitialImageQuery(const std::string& file_name) {
 
 
   // Add image query details to packet
-  unsigned char md[SHA1_MDLEN];
-  SHA1((unsigned char *) file_name.c_str(), file_name.size(), md);
+  key.serialize(srch_pkt.img);
+
+  // Drive the lookup ourselves, if configured to
+  if (lookupAlpha_) {
+    startIterativeLookup(srch_pkt);
+    return;
+  }
 
-  srch_pkt.img.id = static_cast<uint8_t>(ID(md)); 
-  memset(srch_pkt.img.name, 0, DHT_MAX_FILE_NAME);
-  memcpy(srch_pkt.img.name, file_name.c_str(), file_name.size());
+  // Go straight to the owner if we've seen it serve this part of the ring
+  finger_t owner;
+  if (findCachedOwner(srch_pkt.img.id, owner)) {
+    armHedge(srch_pkt, owner.node_id);
+    forwardImageQueryToOwner(srch_pkt, owner);
+    return;
+  }
 
   // Forward search packet to network
+  armHedge(srch_pkt, fingerTable_.at(findFingerForForwarding(srch_pkt.img.id)).node_id);
   forwardImageQueryWithoutTtl(srch_pkt);
 }
 
-void DhtNode::forwardImageQuery(dhtsrch_t srch_pkt) {
-  // Kill search request if ttl has expired
-  if (srch_pkt.msg.ttl == 1) {
-    // Report that we've dropped the search request
-    std::cout << "- Dropped search request b/c ttl is now 0!" << std::endl;
-  } else {
-    // Decrement ttl
-    --srch_pkt.msg.ttl;
+void DhtNode::startIterativeLookup(const dhtsrch_t& srch_pkt) {
+  // Fail b/c the previous lookup should have been cleaned up
+  assert(probes_.empty());
 
-    // Forward image query
-    forwardImageQueryWithoutTtl(srch_pkt);
-  }
-}
+  pendingSrch_ = srch_pkt;
+  pendingSrch_.msg.header.type = ISRCH;
+  lookupCandidates_.clear();
+  probedNodeIds_.clear();
 
-void DhtNode::forwardImageQueryWithoutTtl(dhtsrch_t srch_pkt) {
-  
-  // Select finger to forward the search to
-  size_t finger_idx = findFingerForForwarding(srch_pkt.img.id);
-  
-  // Fail b/c finger idx is out of bounds
-  assert(finger_idx < fingerTable_.size() - 1);
+  uint8_t object_id = srch_pkt.img.id;
 
-  const finger_t& target_finger = fingerTable_.at(finger_idx);   
+  // Start with the cached owner, then with our fingers that precede the image
+  finger_t owner;
+  if (findCachedOwner(object_id, owner)) {
+    addLookupCandidate(owner, true);
+  }
 
-  // Fail b/c we shouldn't be forwarding to ourselves
-  assert(target_finger.node_id != id_);
+  const finger_t& route_finger = fingerTable_.at(findFingerForForwarding(object_id));
+  addLookupCandidate(route_finger, expectToFindObjectAtRoute(object_id));
 
-  // Fail b/c a non-search packet made it into this function
-  assert(srch_pkt.msg.header.type == SRCH 
-      || srch_pkt.msg.header.type == SRCH_ATLOC); 
-  
-  // Set ATLOC bit, if we expect to find the object at the finger that 
-  // we're forwarding the image query to
-  srch_pkt.msg.header.type = (expectToFindObject(srch_pkt.img.id, target_finger))
-      ? SRCH_ATLOC
-      : SRCH;
+  for (size_t i = 0; i < fingerTable_.size() - 1; ++i) {
+    const finger_t& finger = fingerTable_.at(i);
+    if (ID_inrange(finger.node_id, id_, object_id)) {
+      addLookupCandidate(finger, finger.node_id == object_id);
+    }
+  }
 
-  // Serialize image query packet
-  std::string message((const char *) &srch_pkt, sizeof(srch_pkt));
+  // Report that we're resolving the query ourselves
+  std::cout << "\t- Starting iterative lookup with " << lookupCandidates_.size() 
+      << " candidates and up to " << lookupAlpha_ << " probes in flight" << std::endl;
 
-  // Report srch packet contents
-  std::cout << "\t- Creating SRCH packet: " << stringifySrchPkt(srch_pkt) << std::endl;
+  advanceIterativeLookup();
+}
 
-  // Report that we're forwarding the search request
-  std::cout << "\t- Forwarding SRCH to finger[" << finger_idx << "]: " 
-      << stringifyFinger(target_finger) << std::endl;
+void DhtNode::addLookupCandidate(const finger_t& node, bool atloc) {
+  if (node.node_id == id_
+      || std::find(probedNodeIds_.begin(), probedNodeIds_.end(), node.node_id) 
+          != probedNodeIds_.end())
+  {
+    return;
+  }
 
-  try {
-    // Forward packet to target finger
-    Connection remote = target_finger.remote.build();
-    remote.writeAll(message);
+  for (lookup_candidate_t& candidate : lookupCandidates_) {
+    if (candidate.node.node_id == node.node_id) {
+      candidate.atloc = candidate.atloc || atloc;
+      return;
+    }
+  }
 
-    if (srch_pkt.msg.header.type == SRCH_ATLOC) {
-      // Wait for REDRT packet or for a closed connection. Remote will send REDRT
-      // if it doesn't have the purview that we expected it to have. Conversely,
-      // the remote will close the connection if it does accept the join request.
-      dhtmsg_t redrt_pkt;  
-      size_t redrt_pkt_size = sizeof(redrt_pkt);
+  lookupCandidates_.push_back(lookup_candidate_t{node, atloc});
+}
 
-      // Report that we're waiting for REDRT packet
-      std::cout << "\t- Waiting for REDRT packet..." << std::endl;
+uint8_t DhtNode::computeLookupDistance(const lookup_candidate_t& candidate) const {
+  if (candidate.atloc) {
+    return 0;
+  }
 
-      try {
-        // Try to read REDRT packet
-        remote.readAll( (void *) &redrt_pkt, redrt_pkt_size);
-        remote.close();
+  return pendingSrch_.img.id - candidate.node.node_id;
+}
 
-        // Handle REDRT pkt
-        handleSrchRedrt(redrt_pkt, srch_pkt, finger_idx);
-        return;
+void DhtNode::advanceIterativeLookup() {
+  if (!servicingImageQuery_ || !lookupAlpha_) {
+    return;
+  }
 
-      } catch (const SocketException& e) {
-        // Report that no REDRT packet was received
-        std::cout << "\t- Remote closed connection. No REDRT packet received." << std::endl;
-      } 
-    } 
-   
-    // Finally, close the connection (should never 
-    // reach here if a redrt packet was received)
-    remote.close();
+  // Give up on probes that have been outstanding for too long
+  auto now = std::chrono::steady_clock::now();
+  for (auto it = probes_.begin(); it != probes_.end(); ) {
+    if (now - it->sent < std::chrono::milliseconds(PROBE_TIMEOUT_MSEC)) {
+      ++it;
+      continue;
+    }
 
-  } catch (const SocketException& e) {
-    std::cout << "Failed while trying to forward search packet!" << std::endl;
-    throw;
+    // Report that the hop timed out
+    std::cout << "\t- Probe to " << stringifyFinger(it->node) << " timed out after " 
+        << PROBE_TIMEOUT_MSEC << " ms. Trying other nodes..." << std::endl;
+
+    it->cxn.close();
+    it = probes_.erase(it);
+  }
+
+  // Keep 'lookupAlpha_' probes in flight, closest candidates first
+  while (probes_.size() < lookupAlpha_ && !lookupCandidates_.empty()) {
+    auto closest = std::min_element(
+        lookupCandidates_.begin(),
+        lookupCandidates_.end(),
+        [this] (const lookup_candidate_t& lhs, const lookup_candidate_t& rhs) {
+          return computeLookupDistance(lhs) < computeLookupDistance(rhs);
+        }
+    );
+
+    finger_t node = closest->node;
+    dhtsrch_t probe_pkt = pendingSrch_;
+    probe_pkt.msg.header.type = closest->atloc ? ISRCH_ATLOC : ISRCH;
+
+    lookupCandidates_.erase(closest);
+    probedNodeIds_.push_back(node.node_id);
+
+    std::string message((const char *) &probe_pkt, sizeof(probe_pkt));
+
+    // Report that we're probing the node
+    std::cout << "\t- Sending " << stringifyDhtType(static_cast<DhtType>(probe_pkt.msg.header.type))
+        << " to " << stringifyFinger(node) << std::endl;
+
+    try {
+      Connection cxn = connectToNode(node);
+      cxn.writeAll(message);
+      probes_.push_back(probe_t{cxn, node, std::chrono::steady_clock::now()});
+    } catch (const SocketException& e) {
+      std::cout << "\t- Couldn't reach " << stringifyFinger(node) << ". Trying other nodes..." 
+          << std::endl;
+    }
+  }
+
+  // We've asked everyone we know of
+  if (probes_.empty()) {
+    std::cout << "\t- Iterative lookup ran out of nodes to probe. Notifying netimg client..." 
+        << std::endl;
+    abortIterativeLookup();
+    reportLookupLatency();
+    sendImageNotFound();
   }
 }
 
-void DhtNode::handleLocalQuerySuccess(const std::string& file_name) {
+void DhtNode::handleProbeReply(int sd) {
+  auto probe_it = std::find_if(
+      probes_.begin(),
+      probes_.end(),
+      [sd] (const probe_t& probe) -> bool { return probe.cxn.getFd() == sd; }
+  );
 
-  // Fail b/c we don't have a valid connection to the netimg client
-  assert(imageClient_);
+  // The probe was already closed, e.g. b/c another probe found the image
+  if (probe_it == probes_.end()) {
+    return;
+  }
 
-  // Report that we're sending the image down to the client
-  std::cout << "\t- Streaming image down to client!" << std::endl;
+  probe_t probe = *probe_it;
+  probes_.erase(probe_it);
 
-  // Load image into memory
-  LTGA ltga(IMAGE_FOLDER + file_name);
+  auto latency = std::chrono::steady_clock::now() - probe.sent;
+  double latency_msec = std::chrono::duration_cast<std::chrono::microseconds>(latency).count() 
+      / 1000.0;
 
-  // Assemble imsg_t packet, then serialize
-  imsg_t message;
-  message.header = {NETIMG_VERS, NETIMG_RPY};
-  message.im_found = FOUND;
+  dhtsrch_t reply_pkt;
+  try {
+    probe.cxn.readAll((void *) &reply_pkt.msg, sizeof(dhtmsg_t));
+    if (reply_pkt.msg.header.type == RPLY || reply_pkt.msg.header.type == MISS) {
+      probe.cxn.readAll((void *) &reply_pkt.img, sizeof(dhtimg_t));
+    }
+  } catch (const SocketException& e) {
+    // Report that the hop failed
+    std::cout << "\t- Probe to " << stringifyFinger(probe.node) << " failed. Trying other nodes..." 
+        << std::endl;
+    probe.cxn.close();
+    return;
+  }
 
-  size_t image_size = (size_t) loadImsgPacket(ltga, message);
-  
-  std::string message_str( (char *) &message, sizeof(message));
- 
-  // Send image meta data to netimg client
-  imageClient_->writeAll(message_str);
+  probe.cxn.close();
 
-  // Assemble image pixel payload and send to client
-  std::string image_str( (char *) ltga.GetPixels(), image_size);
+  // A peer we can't understand is as good as one we can't reach
+  if (reply_pkt.msg.header.vers != DHTM_VERS) {
+    std::cout << "\t- Probe to " << stringifyFinger(probe.node) << " got a reply w/ version " 
+        << (int) reply_pkt.msg.header.vers << ". Trying other nodes..." << std::endl;
+    return;
+  }
 
-  imageClient_->writeAll(image_str);
-  imageClient_->close();
-  delete imageClient_;
-  imageClient_ = nullptr;
+  uint8_t type = reply_pkt.msg.header.type;
+  if (type != RPLY && type != MISS && type != NEXT && type != NEXT_ATLOC) {
+    std::cout << "\t- Probe to " << stringifyFinger(probe.node) << " got a reply of type " 
+        << (int) type << ". Trying other nodes..." << std::endl;
+    return;
+  }
 
-  // Make this node available to service other image queries
-  servicingImageQuery_ = false;
+  // Report hop latency
+  std::cout << "\t- " << stringifyFinger(probe.node) << " answered with " 
+      << stringifyDhtType(static_cast<DhtType>(type)) 
+      << " in " << latency_msec << " ms" << std::endl;
 
-  // Report that we can service other netimg queries again
-  std::cout << "\t- Finished servicing query -- we can now service additional queries!"
-      << std::endl;
+  switch (type) {
+    case RPLY:
+      abortIterativeLookup();
+      reportLookupLatency();
+      rememberOwner(reply_pkt.img.id, reply_pkt.msg.node);
+      imageDb_->cacheImage(ImageKey(reply_pkt.img));
+      handleLocalQuerySuccess(reply_pkt.img.name);
+      return;
+
+    case MISS:
+      abortIterativeLookup();
+      reportLookupLatency();
+      rememberOwner(reply_pkt.img.id, reply_pkt.msg.node);
+      sendImageNotFound();
+      return;
+
+    case NEXT:
+    case NEXT_ATLOC: {
+      finger_t next;
+      next.node_id = reply_pkt.msg.node.id;
+      next.finger_id = reply_pkt.msg.node.id;
+      next.remote
+          .setRemotePort(ntohs(reply_pkt.msg.node.port))
+          .setRemoteIpv4Address(ntohl(reply_pkt.msg.node.ipv4));
+
+      addLookupCandidate(next, reply_pkt.msg.header.type == NEXT_ATLOC);
+      return;
+    }
+
+    default:
+      // Fail b/c unknown types are turned away above
+      assert(false);
+  }
 }
 
-size_t DhtNode::loadImsgPacket(LTGA& curimg, imsg_t& imsg) const {
-  
-  int alpha, greyscale;
-  
-  imsg.im_depth = (unsigned char)(curimg.GetPixelDepth()/8);
-  imsg.im_width = htons(curimg.GetImageWidth());
-  imsg.im_height = htons(curimg.GetImageHeight());
-  alpha = curimg.GetAlphaDepth();
-  greyscale = curimg.GetImageType();
-  greyscale = (greyscale == 3 || greyscale == 11);
-  if (greyscale) {
-    imsg.im_format = alpha ? GL_LUMINANCE_ALPHA : GL_LUMINANCE;
-  } else {
-    imsg.im_format = alpha ? GL_RGBA : GL_RGB;
+void DhtNode::abortIterativeLookup() {
+  for (probe_t& probe : probes_) {
+    probe.cxn.close();
   }
 
-  imsg.im_format = htons(imsg.im_format);
+  probes_.clear();
+  lookupCandidates_.clear();
+  probedNodeIds_.clear();
+}
 
-  return (size_t) ((double) (curimg.GetImageWidth() *
-     curimg.GetImageHeight() *
-     (curimg.GetPixelDepth()/8)));
+void DhtNode::armHedge(const dhtsrch_t& srch_pkt, uint8_t first_hop) {
+  pendingSrch_ = srch_pkt;
+  hedgedNodeIds_.assign(1, first_hop);
+  hedgeDeadline_ = std::chrono::steady_clock::now() + hedgeDelay_;
+  isHedgePending_ = hedgeDelay_.count() > 0;
 }
 
-void DhtNode::rejectNetimgQuery(const Connection* cxn) const {
- 
-  // Report that we're rejecting the netimg query because we're
-  // already servicing another netimg request.
-  std::cout << "\t- Rejecting netimg query because we're already handling another query" << std::endl;
+void DhtNode::sendHedge() {
+  // Fail b/c we should still be waiting on the search
+  assert(servicingImageQuery_);
 
-  // Assemble imsg_t packet
-  imsg_t message;
-  message.header = {NETIMG_VERS, NETIMG_RPY};
-  message.im_found = BUSY;
-  
-  std::string message_str( (char *) &message, sizeof(message));
+  // Give up on hedging once we've sent enough copies
+  if (hedgedNodeIds_.size() > MAX_NUM_HEDGES) {
+    isHedgePending_ = false;
+    return;
+  }
+
+  // Of the nodes between us and the object (inclusive) that haven't seen
+  // the search, pick the one closest to the object
+  uint8_t object_id = pendingSrch_.img.id;
+  const finger_t* hedge_finger = nullptr;
+
+  for (size_t i = 0; i < fingerTable_.size() - 1; ++i) {
+    const finger_t& finger = fingerTable_.at(i);
+    if (finger.node_id == id_ || !ID_inrange(finger.node_id, id_, object_id)) {
+      continue;
+    }
+
+    if (std::find(hedgedNodeIds_.begin(), hedgedNodeIds_.end(), finger.node_id) 
+        != hedgedNodeIds_.end())
+    {
+      continue;
+    }
+
+    // A copy that goes right back through our first hop doesn't get around it
+    if (isRoutedThrough(finger.node_id, object_id, hedgedNodeIds_.front())) {
+      continue;
+    }
+
+    if (!hedge_finger 
+        || (uint8_t) (finger.node_id - id_) > (uint8_t) (hedge_finger->node_id - id_))
+    {
+      hedge_finger = &finger;
+    }
+  }
+
+  if (!hedge_finger) {
+    // Report that there's no other path to the object
+    std::cout << "\t- No other finger to hedge the image query through." << std::endl;
+    isHedgePending_ = false;
+    return;
+  }
+
+  if (hedgedNodeIds_.size() == 1) {
+    ++numHedgedLookups_;
+  }
+
+  hedgedNodeIds_.push_back(hedge_finger->node_id);
+  hedgeDeadline_ = std::chrono::steady_clock::now() + hedgeDelay_;
+
+  // We can't tell whether the hedge finger owns the object, and
+  // we don't want to block on a REDRT
+  dhtsrch_t srch_pkt = pendingSrch_;
+  srch_pkt.msg.header.type = SRCH;
+  std::string message((const char *) &srch_pkt, sizeof(srch_pkt));
+
+  // Report that we're hedging the query
+  std::cout << "\n- No reply after " << hedgeDelay_.count() << " ms. Hedging SRCH through: " 
+      << stringifyFinger(*hedge_finger) << std::endl;
 
-  // Send rejection to netimg client
   try {
-    cxn->writeAll(message_str);
-    cxn->close();
+    Connection remote = connectToNode(*hedge_finger);
+    remote.writeAll(message);
+    remote.close();
   } catch (const SocketException& e) {
-    std::cout << "Failed while sending rejection packet to netimg client." << std::endl;
-    exit(1);
+    std::cout << "\t- Couldn't reach hedge finger." << std::endl;
   }
 }
 
-void DhtNode::reportCliInstructions() const {
-  std::cout << "CLI instructions: \n\t- ['Q' | 'q' | EOF] -> quit\n"
-      << "\t- ['p'] -> print predecessor/successor ID's" << std::endl;
+bool DhtNode::isRoutedThrough(uint8_t node_id, uint8_t object_id, uint8_t hop_id) const {
+  // The node forwards to the successor of its largest finger-id that
+  // doesn't pass the object. Unless that finger-id is past the hop,
+  // the search makes it no further than the hop.
+  for (int i = FINGER_TABLE_SIZE - 1; i >= 0; --i) {
+    uint8_t finger_id = foldId((1 << i) + node_id);
+    if (ID_inrange(finger_id, node_id, object_id)) {
+      return !ID_inrange(finger_id, hop_id, object_id);
+    }
+  }
+
+  return true;
 }
 
-void DhtNode::reportAdjacentNodes() const {
-  const finger_t& predecessor_finger = getPredecessor();
-  std::cout << "--- Adjacent Node Info ---\n\t- predecessor ID: "
-      << (int) predecessor_finger.node_id;
-  
-  if (predecessor_finger.node_id == id_) {
-    std::cout << " (self)";
+bool DhtNode::isReplyForPendingQuery(const dhtsrch_t& srch_pkt) const {
+  return servicingImageQuery_ 
+      && imageClient_
+      && pendingSrch_.img.id == srch_pkt.img.id
+      && !strncmp(pendingSrch_.img.name, srch_pkt.img.name, DHT_MAX_FILE_NAME);
+}
+
+suseconds_t DhtNode::computeListenTimeout() const {
+  auto now = std::chrono::steady_clock::now();
+  auto deadline = now + std::chrono::microseconds(SELECT_TIMEOUT_USEC);
+
+  if (isHedgePending_) {
+    deadline = std::min(deadline, hedgeDeadline_);
   }
 
-  uint8_t successor_id = fingerTable_.front().node_id;
-  std::cout << "\n\t- successor ID: " << (int) successor_id;
-  
-  if (successor_id == id_) {
-    std::cout << " (self)";
+  for (const probe_t& probe : probes_) {
+    deadline = std::min(deadline, probe.sent + std::chrono::milliseconds(PROBE_TIMEOUT_MSEC));
   }
 
-  std::cout << "\n--------------------" << std::endl;
+  auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(deadline - now).count();
+  return std::max<suseconds_t>(0, remaining);
 }
 
-void DhtNode::handleJoinAndCloseCxn(
-  const dhtmsg_t& join_msg,
-  const Connection& cxn
-) {
-  // Fail b/c msg is not a join message
-  assert(join_msg.header.type == JOIN || join_msg.header.type == JOIN_ATLOC);
+void DhtNode::forwardImageQueryToOwner(dhtsrch_t srch_pkt, const finger_t& owner) {
+  // We expect the owner to hold the object
+  srch_pkt.msg.header.type = SRCH_ATLOC;
 
-  // Report join request
-  std::cout << "\t- Remote is attempting to join with id: " << (int) join_msg.node.id << std::endl;
-  
-  // Reject join request, if node's id collides
-  if (doesJoinCollide(join_msg)) {
-    // Close connection to sender, we're going to reconnect
-    // to join initiator
-    cxn.close();
+  // Don't wait on a REDRT from a virtual node that shares our thread
+  const DhtNode* local = findLocalNode(owner);
+  dhtmsg_t redrt_pkt;
+  if (local && resolveLocalRedrt(*local, srch_pkt.img.id, redrt_pkt)) {
+    forgetOwner(owner.node_id);
+    forwardImageQueryWithoutTtl(srch_pkt);
+    return;
+  } else if (local) {
+    srch_pkt.msg.header.type = SRCH;
+  }
 
-    // Report that incomming node collides 
-    std::cout << "\t- Join request declined! Requested id collides with us! Id(self) : " << (int) id_ <<
-        ", Id(predecessor) : " << (int) getPredecessor().node_id << std::endl;
+  // Serialize image query packet
+  std::string message((const char *) &srch_pkt, sizeof(srch_pkt));
 
-    // Notify requesting node of id collision
-    handleJoinCollision(join_msg);
+  // Report that we're skipping the finger table
+  std::cout << "\t- Forwarding SRCH to cached owner: " << stringifyFinger(owner) << std::endl;
 
-  } else if (inOurPurview(join_msg.node.id)) {
-    // Close connection to sender, we're going to reconnect
-    // to join initiator and send along a WLCM message
-    cxn.close();
-   
-    // Report that we've accepted the join 
-    std::cout << "\t- Join request accepted!" << std::endl;
+  try {
+    Connection remote = connectToNode(owner);
+    remote.writeAll(message);
 
-    // Accept join request, make requester new predecessor
-    handleJoinAcceptance(join_msg);
+    if (local) {
+      remote.close();
+      return;
+    }
 
-  } else {
-    // Report failed JOIN attempt
-    std::cout << "\t- Request failed! Couldn't find " << (int) join_msg.node.id
-        << " in identifier space (" << (int) getPredecessor().node_id << ", " << (int) id_
-        << "]" << std::endl;
+    // Wait for REDRT packet or for a closed connection
+    dhtmsg_t redrt_pkt;
+    size_t redrt_pkt_size = sizeof(redrt_pkt);
 
-    if (senderExpectedJoin(join_msg)) {
-      // Report that sender expected the join to succeed but it didn't
-      std::cout << "\t- But sender " << cxn.getRemoteDomainName() << ":"
-          << (int) cxn.getRemotePort() << " DID expect to join with us..."
-          << std::endl;
+    try {
+      remote.readAll( (void *) &redrt_pkt, redrt_pkt_size);
+      remote.close();
+    } catch (const SocketException& e) {
+      // Owner accepted the query
+      remote.close();
+      return;
+    }
 
-      // Inform sender that the join failed, even though the sender
-      // expected the join to succeed
-      sendRedrt(cxn);
-      cxn.close();
+    // Report that the owner's range has moved
+    std::cout << "\t- Cached owner redirected us. Invalidating owner cache entry..." << std::endl;
 
-    } else {
-      // Close connection to sender b/c we're going to forward the join
-      // along the finger table
-      cxn.close();
+  } catch (const SocketException& e) {
+    // Report that the owner is gone
+    std::cout << "\t- Couldn't reach cached owner. Invalidating owner cache entry..." << std::endl;
+  }
 
-      // Report that sender did not expect to join with us
-      std::cout << "\t- Sender DID NOT expect to join with us."
-        << std::endl;
+  forgetOwner(owner.node_id);
 
-      // Kill join request if ttl has run out
-      if (join_msg.ttl == 1) {
-        // Report that we've dropped the join request
-        std::cout << "- Dropped join request b/c ttl is now 0!" << std::endl;
-      } else {
-        // Forward join request to next best node
-        forwardJoin(join_msg);
-      }
+  // Fall back to the finger table
+  forwardImageQueryWithoutTtl(srch_pkt);
+}
+
+void DhtNode::rememberOwner(uint8_t object_id, const dhtnode_t& owner) {
+  // Port 0 indicates that the sender served the image without owning it
+  if (!owner.port || owner.id == id_) {
+    return;
+  }
+
+  uint16_t port = ntohs(owner.port);
+  uint32_t ipv4 = ntohl(owner.ipv4);
+
+  // The owner holds every id between this object and itself
+  owner_t entry;
+  entry.node.node_id = owner.id;
+  entry.node.finger_id = owner.id;
+  entry.node.remote
+      .setRemotePort(port)
+      .setRemoteIpv4Address(ipv4);
+  entry.range_start = object_id - 1;
+
+  for (auto it = ownerCache_.begin(); it != ownerCache_.end(); ++it) {
+    if (it->node.node_id != owner.id) {
+      continue;
+    }
+
+    // Widen the known range, if the owner's address hasn't changed
+    if (it->node.remote.getRemotePort() == port 
+        && it->node.remote.getRemoteIpv4Address() == ipv4
+        && ID_inrange(object_id - 1, it->range_start, owner.id))
+    {
+      entry.range_start = it->range_start;
     }
+
+    ownerCache_.erase(it);
+    break;
+  }
+
+  // Evict least recently used owner, if we're full
+  if (ownerCache_.size() == OWNER_CACHE_SIZE) {
+    ownerCache_.pop_back();
   }
+
+  ownerCache_.insert(ownerCache_.begin(), entry);
 }
 
-void DhtNode::handleJoinCollision(const dhtmsg_t& join_msg) {
-  // Assemble reid payload
-  dhtmsg_t reid_msg;
-  reid_msg.header = {DHTM_VERS, REID};
- 
-  // Assemble 'self'
-  dhtnode_t self;
-  self.id = id_;
-  self.port = htons(dhtReceiver_->getPort());
-  self.ipv4 = htonl(dhtReceiver_->getIpv4());
-  reid_msg.node = self;
- 
-  // Serialize packet
-  std::string reid_msg_str((char *) &reid_msg, sizeof(reid_msg));
+bool DhtNode::findCachedOwner(uint8_t object_id, finger_t& owner) {
+  for (auto it = ownerCache_.begin(); it != ownerCache_.end(); ++it) {
+    if (ID_inrange(object_id, it->range_start, it->node.node_id)) {
+      owner = it->node;
 
-  // Send reid messsage to node that initiated the join
-  ServerBuilder builder;
-  Connection connection = builder
-    .setRemotePort(ntohs(join_msg.node.port))
-    .setRemoteIpv4Address(ntohl(join_msg.node.ipv4))
-    .build();
+      // Move to front
+      owner_t entry = *it;
+      ownerCache_.erase(it);
+      ownerCache_.insert(ownerCache_.begin(), entry);
+      return true;
+    }
+  }
 
-  connection.writeAll(reid_msg_str);
-  connection.close();
-  
-  // Report sending REID
-  std::cout << "\t- Sending REID packet to " << connection.getRemoteDomainName() << ":"
-    << connection.getRemotePort() << std::endl;
+  return false;
 }
 
-void DhtNode::handleJoinAcceptance(const dhtmsg_t& join_msg) {
-  // Assemble 'wlcm' packet
-  dhtwlcm_t wlcm;
-  wlcm.msg.header = {DHTM_VERS, WLCM};
-  
-  // Make 'self' new successor of joining node
-  dhtnode_t self;
-  self.id = id_;
-  self.port = htons(dhtReceiver_->getPort());
-  self.ipv4 = htonl(dhtReceiver_->getIpv4());
-  wlcm.msg.node = self;
+void DhtNode::forgetOwner(uint8_t node_id) {
+  for (auto it = ownerCache_.begin(); it != ownerCache_.end(); ++it) {
+    if (it->node.node_id == node_id) {
+      ownerCache_.erase(it);
+      return;
+    }
+  }
+}
 
-  // Make our current predecessor the predecessor of the joining node
-  const finger_t& predecessor_finger = getPredecessor();
-  
-  dhtnode_t pred;
-  pred.id = predecessor_finger.node_id;
-  pred.port = htons(predecessor_finger.remote.getRemotePort());
-  pred.ipv4 = htonl(predecessor_finger.remote.getRemoteIpv4Address());
-  wlcm.predecessor = pred;
+void DhtNode::recordImageRequest(const ImageKey& key) {
+  // Age the counts, so that images that were hot a while ago cool off
+  auto now = std::chrono::steady_clock::now();
+  if (now - lastPopularityDecay_ >= std::chrono::seconds(POPULARITY_DECAY_SECS)) {
+    popularity_.decay();
+    lastPopularityDecay_ = now;
+  }
 
-  // Send wlcm messsage to node that initiated the join
-  std::string wlcm_str((char *) &wlcm, sizeof(wlcm));
+  popularity_.increment(key.getName());
+  imageDb_->recordAccess(key);
+}
 
-  ServerBuilder builder;
-  Connection connection = builder
-      .setRemotePort(ntohs(join_msg.node.port))
-      .setRemoteIpv4Address(ntohl(join_msg.node.ipv4))
-      .build();
+void DhtNode::prefetchIfHot(const dhtsrch_t& srch_pkt) {
+  const std::string file_name(srch_pkt.img.name);
+  if (popularity_.estimate(file_name) < HOT_IMAGE_THRESHOLD) {
+    return;
+  }
 
-  connection.writeAll(wlcm_str);
-  connection.close();
+  // Nothing to do if we're already pulling the image
+  if (std::find(pendingPrefetches_.begin(), pendingPrefetches_.end(), file_name) 
+      != pendingPrefetches_.end())
+  {
+    return;
+  }
 
-  // Report sending WLCM message
-  std::cout << "\t- Sending WLCM packet to " << connection.getRemoteDomainName() << 
-    ":" << connection.getRemotePort() << std::endl;
-  
-  // Report that we're updating our predecessor
-  std::cout << "\t- Replacing former predecessor with joining node..." << std::endl;
+  // Report that the image is hot
+  std::cout << "\t- " << file_name << " is hot. Pulling it into our cache..." << std::endl;
 
-  // Make joining node our new predecessor (update) 
-  updatePredecessorAndImageDb(
-      join_msg.node.id,
-      ntohs(join_msg.node.port),
-      ntohl(join_msg.node.ipv4)
-  );
+  prefetchImage(srch_pkt.img);
+}
 
-  // Make joining node our successor too, if we were previously the 
-  // only node in the network
-  if (id_ == fingerTable_.front().node_id) {
-    // Report that we're replacing our current successor with a new one
-    std::cout << "\t- Now replacing former successor with joining node..." << std::endl;
+void DhtNode::reportPopularity() const {
+  std::vector<CountMinSketch::heavy_hitter_t> heavy_hitters = popularity_.getHeavyHitters();
 
-    // Replace successor node 
-    updateSuccessor(
-        join_msg.node.id,
-        ntohs(join_msg.node.port),
-        ntohl(join_msg.node.ipv4)
-    );
-  } 
+  std::cout << "\t- Most requested images (decayed every " << POPULARITY_DECAY_SECS 
+      << " secs):" << std::endl;
+
+  if (heavy_hitters.empty()) {
+    std::cout << "\t\t- None" << std::endl;
+  }
+
+  for (const CountMinSketch::heavy_hitter_t& heavy_hitter : heavy_hitters) {
+    std::cout << "\t\t- " << heavy_hitter.key << ": ~" << heavy_hitter.count 
+        << " requests" << std::endl;
+  }
 }
 
-void DhtNode::sendRedrt(const Connection& cxn) {
-  
-  // Assemble REDRT packet
-  dhtmsg_t redrt_msg;
-  redrt_msg.header = {DHTM_VERS, REDRT};
+void DhtNode::prefetchImage(const dhtimg_t& img) {
+  // Forget the oldest prefetch if its answer got lost
+  if (pendingPrefetches_.size() == MAX_PENDING_PREFETCHES) {
+    pendingPrefetches_.erase(pendingPrefetches_.begin());
+  }
 
-  // Send back our current predecessor to the redirected node.
-  // The redirected node will make our predecessor its new successor
-  // and then try to forward the join across its finger table.
-  const finger_t& predecessor_finger = getPredecessor();
-  
-  dhtnode_t pred;
-  pred.id = predecessor_finger.node_id;
-  pred.port = htons(predecessor_finger.remote.getRemotePort());
-  pred.ipv4 = htonl(predecessor_finger.remote.getRemoteIpv4Address());
-  redrt_msg.node = pred;
-  
-  // Send packet to sender (not neccessarily node that initiated join request)
-  std::string redrt_str((char *) &redrt_msg, sizeof(redrt_msg));
+  pendingPrefetches_.push_back(std::string(img.name));
 
-  cxn.writeAll(redrt_str);
+  // Assemble dhtsrch_t packet, w/ourselves as the proxy
+  dhtsrch_t srch_pkt;
+  srch_pkt.msg.header = {DHTM_VERS, DHTM_SRCH};
+  srch_pkt.msg.ttl = DHTM_TTL;
 
-  // Report unexpected join failure
-  std::cout << "\t- Sending REDRT packet to " << cxn.getRemoteDomainName() << ":"
-      << (int) cxn.getRemotePort() << " with our predecessor: <id: " << 
-      (int) predecessor_finger.node_id << ", port: " << 
-      (int) predecessor_finger.remote.getRemotePort() << ", ipv4: " <<
-      stringifyIpv4(htonl(predecessor_finger.remote.getRemoteIpv4Address())) << ">" << std::endl;
+  dhtnode_t self;
+  memset(&self, 0, sizeof(self));
+  self.id = id_;
+  self.port = htons(dhtReceiver_->getPort());
+  self.ipv4 = htonl(dhtReceiver_->getIpv4());
+  srch_pkt.msg.node = self;
+  srch_pkt.img = img;
+
+  try {
+    forwardImageQueryWithoutTtl(srch_pkt);
+  } catch (const SocketException& e) {
+    // Report that we couldn't pull the image
+    std::cout << "\t- Couldn't search for hot image. Dropping prefetch..." << std::endl;
+    pendingPrefetches_.pop_back();
+  }
 }
 
-void DhtNode::forwardJoin(dhtmsg_t join_msg) {
+bool DhtNode::takePendingPrefetch(const std::string& file_name) {
+  auto it = std::find(pendingPrefetches_.begin(), pendingPrefetches_.end(), file_name);
+  if (it == pendingPrefetches_.end()) {
+    return false;
+  }
 
-  // Select finger to forward the join to
-  size_t finger_idx = findFingerForForwarding(join_msg.node.id);
+  pendingPrefetches_.erase(it);
+  return true;
+}
+
+void DhtNode::forwardImageQuery(dhtsrch_t srch_pkt) {
+  // Kill search request if ttl has expired
+  if (srch_pkt.msg.ttl == 1) {
+    // Report that we've dropped the search request
+    std::cout << "- Dropped search request b/c ttl is now 0!" << std::endl;
+  } else {
+    // Decrement ttl
+    --srch_pkt.msg.ttl;
+
+    // Forward image query
+    forwardImageQueryWithoutTtl(srch_pkt);
+  }
+}
+
+void DhtNode::forwardImageQueryWithoutTtl(dhtsrch_t srch_pkt) {
+  
+  // Select finger to forward the search to
+  size_t finger_idx = findFingerForForwarding(srch_pkt.img.id);
   
   // Fail b/c finger idx is out of bounds
   assert(finger_idx < fingerTable_.size() - 1);
 
   const finger_t& target_finger = fingerTable_.at(finger_idx);   
-  
-  // Fail b/c this is not a JOIN packet
-  assert(join_msg.header.type == JOIN || join_msg.header.type == JOIN_ATLOC);
-  
-  // Set ATLOC bit, if we expect to find the object at the finger 
-  join_msg.header.type = (expectToFindObject(join_msg.node.id, target_finger))
-      ? JOIN_ATLOC
-      : JOIN;
-
-  // Report that we're forwarding the join request and that we don't necessarily
-  // expect the target finger to accept the join
-  std::cout << "\t- Forwarding JOIN to finger[" << finger_idx << "]: " <<
-      "<id: " << (int) target_finger.node_id <<
-      ", port: " << (int) target_finger.remote.getRemotePort() <<
-      ", ipv4: " << stringifyIpv4(htonl(target_finger.remote.getRemoteIpv4Address())) << 
-      ", type: " << stringifyDhtType(static_cast<DhtType>(join_msg.header.type)) << 
-      ">" << std::endl;
 
   // Fail b/c we shouldn't be forwarding to ourselves
   assert(target_finger.node_id != id_);
+
+  // Fail b/c a non-search packet made it into this function
+  assert(srch_pkt.msg.header.type == SRCH 
+      || srch_pkt.msg.header.type == SRCH_ATLOC); 
   
-  // Open connection to target finger and send message
-  std::string message((const char *) &join_msg, sizeof(join_msg));
+  // Set ATLOC bit, if we expect to find the object at the finger that 
+  // we're forwarding the image query to
+  srch_pkt.msg.header.type = (expectToFindObjectAtRoute(srch_pkt.img.id))
+      ? SRCH_ATLOC
+      : SRCH;
+
+  // Don't wait on a REDRT from a virtual node that shares our thread
+  const DhtNode* local = findLocalNode(target_finger);
+  if (local && srch_pkt.msg.header.type == SRCH_ATLOC) {
+    dhtmsg_t redrt_pkt;
+    if (resolveLocalRedrt(*local, srch_pkt.img.id, redrt_pkt)) {
+      handleSrchRedrt(redrt_pkt, srch_pkt, finger_idx);
+      return;
+    }
+
+    srch_pkt.msg.header.type = SRCH;
+  }
+
+  // Serialize image query packet
+  std::string message((const char *) &srch_pkt, sizeof(srch_pkt));
 
-  Connection remote = target_finger.remote.build();
+  // Report srch packet contents
+  std::cout << "\t- Creating SRCH packet: " << stringifySrchPkt(srch_pkt) << std::endl;
+
+  // Report that we're forwarding the search request
+  std::cout << "\t- Forwarding SRCH to finger[" << finger_idx << "]: " 
+      << stringifyFinger(target_finger) << std::endl;
 
+  bool is_connected = false;
   try {
+    // Forward packet to target finger
+    Connection remote = connectToNode(target_finger);
+    is_connected = true;
     remote.writeAll(message);
 
-    if (join_msg.header.type == JOIN_ATLOC) {
+    if (srch_pkt.msg.header.type == SRCH_ATLOC) {
       // Wait for REDRT packet or for a closed connection. Remote will send REDRT
       // if it doesn't have the purview that we expected it to have. Conversely,
       // the remote will close the connection if it does accept the join request.
       dhtmsg_t redrt_pkt;  
       size_t redrt_pkt_size = sizeof(redrt_pkt);
-      
-      // Report that we're waiting for REDRT
+
+      // Report that we're waiting for REDRT packet
       std::cout << "\t- Waiting for REDRT packet..." << std::endl;
 
       try {
@@ -908,13 +1541,13 @@ void DhtNode::forwardJoin(dhtmsg_t join_msg) {
         remote.close();
 
         // Handle REDRT pkt
-        handleJoinRedrt(redrt_pkt, join_msg, finger_idx);
+        handleSrchRedrt(redrt_pkt, srch_pkt, finger_idx);
         return;
 
       } catch (const SocketException& e) {
         // Report that no REDRT packet was received
         std::cout << "\t- Remote closed connection. No REDRT packet received." << std::endl;
-      }
+      } 
     } 
    
     // Finally, close the connection (should never 
@@ -922,62 +1555,549 @@ void DhtNode::forwardJoin(dhtmsg_t join_msg) {
     remote.close();
 
   } catch (const SocketException& e) {
-    std::cout << "Failed while trying to forward join packet!" << std::endl;
-    exit(1);
+    // The finger may have left the ring since we last heard from it
+    if (!is_connected && forwardImageQueryAroundFinger(srch_pkt, finger_idx)) {
+      return;
+    }
+
+    std::cout << "Failed while trying to forward search packet!" << std::endl;
+    throw;
   }
 }
 
-void DhtNode::handleRedrt(const dhtmsg_t& redrt_pkt, size_t finger_idx) {
-  // Fail b/c 'finger_idx' is out of bounds
-  assert(finger_idx < fingerTable_.size() - 1);
+bool DhtNode::forwardImageQueryAroundFinger(dhtsrch_t srch_pkt, size_t dead_idx) {
+  const finger_t dead_finger = fingerTable_.at(dead_idx);
 
-  // Fail b/c header of redrt-packet is not REDRT
-  assert(redrt_pkt.header.type == REDRT);
-  
-  // Report REDRT packet received
-  std::cout << "\t- Received REDRT packet providing new finger[" 
-      << finger_idx << "]: " << "<finger-id: " << (int) fingerTable_.at(finger_idx).finger_id 
-      << ", node-id: " << (int) redrt_pkt.node.id << ", port: " << (int) ntohs(redrt_pkt.node.port) 
-      << ", ipv4: " << stringifyIpv4(redrt_pkt.node.ipv4) << ">" << std::endl;
+  // Walk back to the closest finger on another node
+  size_t idx = dead_idx;
+  while (idx > 0 && fingerTable_.at(idx).node_id == dead_finger.node_id) {
+    --idx;
+  }
 
-  // Replace finger in our finger table with the provided one
-  updateFinger(
-      finger_idx,
-      redrt_pkt.node.id,
-      ntohs(redrt_pkt.node.port),
-      ntohl(redrt_pkt.node.ipv4));
+  const finger_t& fallback_finger = fingerTable_.at(idx);
+  if (fallback_finger.node_id == dead_finger.node_id || fallback_finger.node_id == id_) {
+    return false;
+  }
+
+  // We can't tell whether the fallback owns the object
+  srch_pkt.msg.header.type = SRCH;
+  std::string message((const char *) &srch_pkt, sizeof(srch_pkt));
+
+  // Report that we're routing around the unreachable finger
+  std::cout << "\t- Couldn't reach finger[" << dead_idx << "]. Forwarding SRCH to finger["
+      << idx << "] instead: " << stringifyFinger(fallback_finger) << std::endl;
+
+  try {
+    Connection remote = connectToNode(fallback_finger);
+    remote.writeAll(message);
+    remote.close();
+  } catch (const SocketException& e) {
+    return forwardImageQueryAroundFinger(srch_pkt, idx);
+  }
+
+  return true;
 }
 
-void DhtNode::reloadDb() {
-  // Report that we're updating the image db
-  std::cout << "\t- Reloading image database..." << std::endl;
- 
-  const finger_t& predecessor = getPredecessor();
-  imageDb_->load(predecessor.node_id, id_);
+void DhtNode::handleLocalQuerySuccess(const std::string& file_name) {
+
+  // Fail b/c we don't have a valid connection to the netimg client
+  assert(imageClient_);
+
+  streamImage(imageClient_, file_name, imageClientAcceptsRle_);
+  imageClient_ = nullptr;
+
+  // Make this node available to service other image queries
+  servicingImageQuery_ = false;
+  isHedgePending_ = false;
+
+  // Report that we can service other netimg queries again
+  std::cout << "\t- Finished servicing query -- we can now service additional queries!"
+      << std::endl;
 }
 
-void DhtNode::updateFinger(size_t idx, uint8_t id, uint16_t port, uint32_t ipv4) {
-  // Fail b/c the indicated finger is invalid
-  assert(idx < fingerTable_.size());
-  
-  // Report that we're updating the finger
-  std::cout << "\t- Updating finger[" << idx << "] ";
+void DhtNode::streamImage(
+  const Connection* cxn,
+  const std::string& file_name,
+  bool accepts_rle
+) const {
 
-  switch (idx) {
-    case SUCCESSOR_IDX: 
-      std::cout << " (successor) ";
-      break;
-    case PREDECESSOR_IDX:
-      std::cout << " (predecessor) ";
-      break;
-  }
+  // Fail b/c only nodes w/netimg clients read images
+  assert(imageReader_);
 
-  finger_t& finger = fingerTable_.at(idx);
-  finger_t old_finger = finger;
+  // Report that we're reading the image for the client
+  std::cout << "\t- Reading image for client..." << std::endl;
 
-  std::cout << "\n\t\t- Finger (old): " << stringifyFinger(old_finger);
+  imageReader_->submit(cxn, file_name, accepts_rle);
+}
 
-  // Make update
+void DhtNode::sendImage(const ImageReader::read_t& read) const {
+
+  // Report that we're sending the image down to the client
+  std::cout << "\t- Streaming image down to client: " << read.file_name << std::endl;
+
+  // The blob is laid out just as netimg expects it, header and all
+  try {
+    if (read.blobFd != -1) {
+      read.cxn->sendFile(read.blobFd, read.blobSize);
+    } else {
+      read.cxn->writeAll(read.blob);
+    }
+
+    read.cxn->close();
+  } catch (const SocketException& e) {
+    std::cout << "\t- Failed to stream image to netimg client." << std::endl;
+  }
+
+  if (read.blobFd != -1) {
+    ::close(read.blobFd);
+  }
+
+  delete read.cxn;
+}
+
+void DhtNode::encodeImages() const {
+  encodeImages(imageDb_->getImagesInRange(imageDb_->getStart(), imageDb_->getEnd()));
+}
+
+void DhtNode::encodeImages(const std::vector<ImageKey>& images) const {
+  if (images.empty()) {
+    return;
+  }
+
+  ImageReader* reader = getHost()->imageReader_;
+
+  // Report that the images will be ready to send as is
+  std::cout << "\t- Queueing " << images.size() << " image(s) to be encoded for the wire" << std::endl;
+
+  for (const ImageKey& key : images) {
+    reader->encodeLater(key.getName());
+  }
+}
+
+void DhtNode::rejectNetimgQuery(const Connection* cxn) const {
+ 
+  // Report that we're rejecting the netimg query because we're
+  // already servicing another netimg request.
+  std::cout << "\t- Rejecting netimg query because we're already handling another query" << std::endl;
+
+  // Assemble imsg_t packet
+  imsg_t message;
+  message.header = {NETIMG_VERS, NETIMG_RPY};
+  message.im_found = BUSY;
+  
+  std::string message_str( (char *) &message, sizeof(message));
+
+  // Send rejection to netimg client
+  try {
+    cxn->writeAll(message_str);
+    cxn->close();
+  } catch (const SocketException& e) {
+    std::cout << "Failed while sending rejection packet to netimg client." << std::endl;
+    exit(1);
+  }
+}
+
+void DhtNode::reportCliInstructions() const {
+  std::cout << "CLI instructions: \n\t- ['Q' | 'q' | EOF] -> quit\n"
+      << "\t- ['p'] -> print predecessor/successor ID's\n"
+      << "\t- ['l'] -> print load of each virtual node\n"
+      << "\t- ['t'] -> print most requested images" << std::endl;
+}
+
+void DhtNode::reportAdjacentNodes() const {
+  const finger_t& predecessor_finger = getPredecessor();
+  std::cout << "--- Adjacent Node Info ---\n\t- predecessor ID: "
+      << (int) predecessor_finger.node_id;
+  
+  if (predecessor_finger.node_id == id_) {
+    std::cout << " (self)";
+  }
+
+  uint8_t successor_id = fingerTable_.front().node_id;
+  std::cout << "\n\t- successor ID: " << (int) successor_id;
+  
+  if (successor_id == id_) {
+    std::cout << " (self)";
+  }
+
+  std::cout << "\n--------------------" << std::endl;
+}
+
+void DhtNode::handleJoinAndCloseCxn(
+  const dhtmsg_t& join_msg,
+  const Connection& cxn
+) {
+  // Fail b/c msg is not a join message
+  assert(join_msg.header.type == JOIN || join_msg.header.type == JOIN_ATLOC);
+
+  // Report join request
+  std::cout << "\t- Remote is attempting to join with id: " << (int) join_msg.node.id << std::endl;
+
+  // Joining nodes contact several seeds at once, so we may have
+  // accepted this very node already
+  const finger_t& predecessor = getPredecessor();
+  if (predecessor.node_id == join_msg.node.id
+      && predecessor.remote.getRemotePort() == ntohs(join_msg.node.port)
+      && predecessor.remote.getRemoteIpv4Address() == ntohl(join_msg.node.ipv4))
+  {
+    cxn.close();
+
+    // Report that we're dropping the duplicate
+    std::cout << "\t- Remote is already our predecessor. Dropping duplicate join request." 
+        << std::endl;
+    return;
+  }
+  
+  // Reject join request, if node's id collides
+  if (doesJoinCollide(join_msg)) {
+    // Close connection to sender, we're going to reconnect
+    // to join initiator
+    cxn.close();
+
+    // Report that incomming node collides 
+    std::cout << "\t- Join request declined! Requested id collides with us! Id(self) : " << (int) id_ <<
+        ", Id(predecessor) : " << (int) getPredecessor().node_id << std::endl;
+
+    // Notify requesting node of id collision
+    handleJoinCollision(join_msg);
+
+  } else if (inOurPurview(join_msg.node.id)) {
+    // Close connection to sender, we're going to reconnect
+    // to join initiator and send along a WLCM message
+    cxn.close();
+   
+    // Report that we've accepted the join 
+    std::cout << "\t- Join request accepted!" << std::endl;
+
+    // Accept join request, make requester new predecessor
+    handleJoinAcceptance(join_msg);
+
+  } else {
+    // Report failed JOIN attempt
+    std::cout << "\t- Request failed! Couldn't find " << (int) join_msg.node.id
+        << " in identifier space (" << (int) getPredecessor().node_id << ", " << (int) id_
+        << "]" << std::endl;
+
+    if (senderExpectedJoin(join_msg)) {
+      // Report that sender expected the join to succeed but it didn't
+      std::cout << "\t- But sender " << cxn.getRemoteDomainName() << ":"
+          << (int) cxn.getRemotePort() << " DID expect to join with us..."
+          << std::endl;
+
+      // Inform sender that the join failed, even though the sender
+      // expected the join to succeed
+      sendRedrt(cxn);
+      cxn.close();
+
+    } else {
+      // Close connection to sender b/c we're going to forward the join
+      // along the finger table
+      cxn.close();
+
+      // Report that sender did not expect to join with us
+      std::cout << "\t- Sender DID NOT expect to join with us."
+        << std::endl;
+
+      // Kill join request if ttl has run out
+      if (join_msg.ttl == 1) {
+        // Report that we've dropped the join request
+        std::cout << "- Dropped join request b/c ttl is now 0!" << std::endl;
+      } else {
+        // Forward join request to next best node
+        forwardJoin(join_msg);
+      }
+    }
+  }
+}
+
+void DhtNode::handleJoinCollision(const dhtmsg_t& join_msg) {
+  // Assemble reid payload
+  dhtreid_t reid_msg;
+  memset(&reid_msg, 0, sizeof(reid_msg));
+  reid_msg.msg.header = {DHTM_VERS, REID};
+ 
+  // Assemble 'self'
+  dhtnode_t self;
+  self.id = id_;
+  self.port = htons(dhtReceiver_->getPort());
+  self.ipv4 = htonl(dhtReceiver_->getIpv4());
+  reid_msg.msg.node = self;
+
+  // Offer a free id in our range, so the joiner can retry with us directly
+  uint8_t free_id;
+  if (findFreeId(free_id)) {
+    reid_msg.free = self;
+    reid_msg.free.id = free_id;
+
+    // Report the free id
+    std::cout << "\t- Offering free id: " << (int) free_id << std::endl;
+  }
+ 
+  // Serialize packet
+  std::string reid_msg_str((char *) &reid_msg, sizeof(reid_msg));
+
+  // Send reid messsage to node that initiated the join
+  ServerBuilder builder;
+  Connection connection = buildConnection(builder
+    .setRemotePort(ntohs(join_msg.node.port))
+    .setRemoteIpv4Address(ntohl(join_msg.node.ipv4)));
+
+  connection.writeAll(reid_msg_str);
+  connection.close();
+  
+  // Report sending REID
+  std::cout << "\t- Sending REID packet to " << connection.getRemoteDomainName() << ":"
+    << connection.getRemotePort() << std::endl;
+}
+
+bool DhtNode::findFreeId(uint8_t& free_id) const {
+  // Number of ids in (predecessor, self], the whole ring if we're alone
+  uint8_t predecessor_id = getPredecessor().node_id;
+  size_t range_size = static_cast<uint8_t>(id_ - predecessor_id);
+  if (range_size == 0) {
+    range_size = NUM_IDS;
+  }
+
+  // Every id in our range is taken
+  if (range_size < 2) {
+    return false;
+  }
+
+  free_id = foldId(predecessor_id + range_size / 2);
+  return true;
+}
+
+void DhtNode::handleJoinAcceptance(const dhtmsg_t& join_msg) {
+  // Assemble 'wlcm' packet
+  dhtwlcm_t wlcm;
+  wlcm.msg.header = {DHTM_VERS, WLCM};
+  
+  // Make 'self' new successor of joining node
+  dhtnode_t self;
+  self.id = id_;
+  self.port = htons(dhtReceiver_->getPort());
+  self.ipv4 = htonl(dhtReceiver_->getIpv4());
+  wlcm.msg.node = self;
+
+  // Make our current predecessor the predecessor of the joining node
+  const finger_t& predecessor_finger = getPredecessor();
+  
+  dhtnode_t pred;
+  pred.id = predecessor_finger.node_id;
+  pred.port = htons(predecessor_finger.remote.getRemotePort());
+  pred.ipv4 = htonl(predecessor_finger.remote.getRemoteIpv4Address());
+  wlcm.predecessor = pred;
+
+  // Send wlcm messsage to node that initiated the join
+  std::string wlcm_str((char *) &wlcm, sizeof(wlcm));
+
+  ServerBuilder builder;
+  Connection connection = buildConnection(builder
+      .setRemotePort(ntohs(join_msg.node.port))
+      .setRemoteIpv4Address(ntohl(join_msg.node.ipv4)));
+
+  connection.writeAll(wlcm_str);
+  connection.close();
+
+  // Report sending WLCM message
+  std::cout << "\t- Sending WLCM packet to " << connection.getRemoteDomainName() << 
+    ":" << connection.getRemotePort() << std::endl;
+
+  // Hand the joining node the images in its new range, so it starts warm
+  sendXfer(join_msg, imageDb_->getImagesInRange(pred.id, join_msg.node.id));
+  
+  // Report that we're updating our predecessor
+  std::cout << "\t- Replacing former predecessor with joining node..." << std::endl;
+
+  // Make joining node our new predecessor (update) 
+  updatePredecessorAndImageDb(
+      join_msg.node.id,
+      ntohs(join_msg.node.port),
+      ntohl(join_msg.node.ipv4)
+  );
+
+  // Make joining node our successor too, if we were previously the 
+  // only node in the network
+  if (id_ == fingerTable_.front().node_id) {
+    // Report that we're replacing our current successor with a new one
+    std::cout << "\t- Now replacing former successor with joining node..." << std::endl;
+
+    // Replace successor node 
+    updateSuccessor(
+        join_msg.node.id,
+        ntohs(join_msg.node.port),
+        ntohl(join_msg.node.ipv4)
+    );
+  } 
+}
+
+void DhtNode::sendRedrt(const Connection& cxn) {
+  
+  // Assemble REDRT packet
+  dhtmsg_t redrt_msg;
+  redrt_msg.header = {DHTM_VERS, REDRT};
+
+  // Send back our current predecessor to the redirected node.
+  // The redirected node will make our predecessor its new successor
+  // and then try to forward the join across its finger table.
+  const finger_t& predecessor_finger = getPredecessor();
+  
+  dhtnode_t pred;
+  pred.id = predecessor_finger.node_id;
+  pred.port = htons(predecessor_finger.remote.getRemotePort());
+  pred.ipv4 = htonl(predecessor_finger.remote.getRemoteIpv4Address());
+  redrt_msg.node = pred;
+  
+  // Send packet to sender (not neccessarily node that initiated join request)
+  std::string redrt_str((char *) &redrt_msg, sizeof(redrt_msg));
+
+  cxn.writeAll(redrt_str);
+
+  // Report unexpected join failure
+  std::cout << "\t- Sending REDRT packet to " << cxn.getRemoteDomainName() << ":"
+      << (int) cxn.getRemotePort() << " with our predecessor: <id: " << 
+      (int) predecessor_finger.node_id << ", port: " << 
+      (int) predecessor_finger.remote.getRemotePort() << ", ipv4: " <<
+      stringifyIpv4(htonl(predecessor_finger.remote.getRemoteIpv4Address())) << ">" << std::endl;
+}
+
+void DhtNode::forwardJoin(dhtmsg_t join_msg) {
+
+  // Select finger to forward the join to
+  size_t finger_idx = findFingerForForwarding(join_msg.node.id);
+  
+  // Fail b/c finger idx is out of bounds
+  assert(finger_idx < fingerTable_.size() - 1);
+
+  const finger_t& target_finger = fingerTable_.at(finger_idx);   
+  
+  // Fail b/c this is not a JOIN packet
+  assert(join_msg.header.type == JOIN || join_msg.header.type == JOIN_ATLOC);
+  
+  // Set ATLOC bit, if we expect to find the object at the finger 
+  join_msg.header.type = (expectToFindObjectAtRoute(join_msg.node.id))
+      ? JOIN_ATLOC
+      : JOIN;
+
+  // Don't wait on a REDRT from a virtual node that shares our thread
+  const DhtNode* local = findLocalNode(target_finger);
+  if (local && join_msg.header.type == JOIN_ATLOC) {
+    dhtmsg_t redrt_pkt;
+    if (resolveLocalRedrt(*local, join_msg.node.id, redrt_pkt)) {
+      handleJoinRedrt(redrt_pkt, join_msg, finger_idx);
+      return;
+    }
+
+    join_msg.header.type = JOIN;
+  }
+
+  // Report that we're forwarding the join request and that we don't necessarily
+  // expect the target finger to accept the join
+  std::cout << "\t- Forwarding JOIN to finger[" << finger_idx << "]: " <<
+      "<id: " << (int) target_finger.node_id <<
+      ", port: " << (int) target_finger.remote.getRemotePort() <<
+      ", ipv4: " << stringifyIpv4(htonl(target_finger.remote.getRemoteIpv4Address())) << 
+      ", type: " << stringifyDhtType(static_cast<DhtType>(join_msg.header.type)) << 
+      ">" << std::endl;
+
+  // Fail b/c we shouldn't be forwarding to ourselves
+  assert(target_finger.node_id != id_);
+  
+  // Open connection to target finger and send message
+  std::string message((const char *) &join_msg, sizeof(join_msg));
+
+  Connection remote = connectToNode(target_finger);
+
+  try {
+    remote.writeAll(message);
+
+    if (join_msg.header.type == JOIN_ATLOC) {
+      // Wait for REDRT packet or for a closed connection. Remote will send REDRT
+      // if it doesn't have the purview that we expected it to have. Conversely,
+      // the remote will close the connection if it does accept the join request.
+      dhtmsg_t redrt_pkt;  
+      size_t redrt_pkt_size = sizeof(redrt_pkt);
+      
+      // Report that we're waiting for REDRT
+      std::cout << "\t- Waiting for REDRT packet..." << std::endl;
+
+      try {
+        // Try to read REDRT packet
+        remote.readAll( (void *) &redrt_pkt, redrt_pkt_size);
+        remote.close();
+
+        // Handle REDRT pkt
+        handleJoinRedrt(redrt_pkt, join_msg, finger_idx);
+        return;
+
+      } catch (const SocketException& e) {
+        // Report that no REDRT packet was received
+        std::cout << "\t- Remote closed connection. No REDRT packet received." << std::endl;
+      }
+    } 
+   
+    // Finally, close the connection (should never 
+    // reach here if a redrt packet was received)
+    remote.close();
+
+  } catch (const SocketException& e) {
+    std::cout << "Failed while trying to forward join packet!" << std::endl;
+    exit(1);
+  }
+}
+
+void DhtNode::handleRedrt(const dhtmsg_t& redrt_pkt, size_t finger_idx) {
+  // Fail b/c 'finger_idx' is out of bounds
+  assert(finger_idx < fingerTable_.size() - 1);
+
+  // Fail b/c header of redrt-packet is not REDRT
+  assert(redrt_pkt.header.type == REDRT);
+  
+  // Report REDRT packet received
+  std::cout << "\t- Received REDRT packet providing new finger[" 
+      << finger_idx << "]: " << "<finger-id: " << (int) fingerTable_.at(finger_idx).finger_id 
+      << ", node-id: " << (int) redrt_pkt.node.id << ", port: " << (int) ntohs(redrt_pkt.node.port) 
+      << ", ipv4: " << stringifyIpv4(redrt_pkt.node.ipv4) << ">" << std::endl;
+
+  // Replace finger in our finger table with the provided one
+  updateFinger(
+      finger_idx,
+      redrt_pkt.node.id,
+      ntohs(redrt_pkt.node.port),
+      ntohl(redrt_pkt.node.ipv4));
+}
+
+void DhtNode::reloadDb() {
+  // Report that we're updating the image db
+  std::cout << "\t- Reloading image database..." << std::endl;
+ 
+  const finger_t& predecessor = getPredecessor();
+  imageDb_->load(predecessor.node_id, id_);
+  encodeImages();
+}
+
+void DhtNode::updateFinger(size_t idx, uint8_t id, uint16_t port, uint32_t ipv4) {
+  // Fail b/c the indicated finger is invalid
+  assert(idx < fingerTable_.size());
+  
+  // Report that we're updating the finger
+  std::cout << "\t- Updating finger[" << idx << "] ";
+
+  switch (idx) {
+    case SUCCESSOR_IDX: 
+      std::cout << " (successor) ";
+      break;
+    case PREDECESSOR_IDX:
+      std::cout << " (predecessor) ";
+      break;
+  }
+
+  finger_t& finger = fingerTable_.at(idx);
+  finger_t old_finger = finger;
+
+  std::cout << "\n\t\t- Finger (old): " << stringifyFinger(old_finger);
+
+  // Make update
   finger.node_id = id;
   finger.remote
       .setRemotePort(port)
@@ -985,270 +2105,985 @@ void DhtNode::updateFinger(size_t idx, uint8_t id, uint16_t port, uint32_t ipv4)
       
   std::cout << "\n\t\t- Finger (new): " << stringifyFinger(finger) << std::endl;
   
-  // Check if update already happened during a table-fix
-  if (id == old_finger.node_id 
-      && port == old_finger.remote.getRemotePort() 
-      && ipv4 == old_finger.remote.getRemoteIpv4Address())
-  {
-    // Report that there is nothing to update 
-    std::cout << "\t\t- Nothing to update! Probably occurred previously during fixUp() or fixDwn()" << std::endl;
+  // Check if update already happened during a table-fix
+  if (id == old_finger.node_id 
+      && port == old_finger.remote.getRemotePort() 
+      && ipv4 == old_finger.remote.getRemoteIpv4Address())
+  {
+    // Report that there is nothing to update 
+    std::cout << "\t\t- Nothing to update! Probably occurred previously during fixUp() or fixDwn()" << std::endl;
+    return;
+  } 
+
+  // Fix finger table
+  if (idx) {
+    fixDown(idx);
+  }
+
+  if (idx < FINGER_TABLE_SIZE) {
+    fixUp(idx);
+  }
+
+  // Routing decisions depend on every finger, so recompute them all
+  rebuildRoutingTable();
+}
+
+const std::string DhtNode::stringifyFinger(const finger_t& finger) const {
+  std::string finger_str = "<finger-id: ";
+  finger_str += std::to_string(finger.finger_id);
+  finger_str += ", node-id: " + std::to_string(finger.node_id);
+  finger_str += ", port: " + std::to_string(finger.remote.getRemotePort());
+  finger_str += ", ipv4: " + stringifyIpv4(htonl(finger.remote.getRemoteIpv4Address()));
+  finger_str += ">";
+
+  return finger_str;
+}
+
+void DhtNode::updatePredecessorAndImageDb(uint8_t id, uint16_t port, uint32_t ipv4) {
+  // Update finger
+  updateFinger(PREDECESSOR_IDX, id, port, ipv4);
+
+  // Reload the db
+  reloadDb();
+}
+
+void DhtNode::updateSuccessor(uint8_t id, uint16_t port, uint32_t ipv4) {
+  updateFinger(SUCCESSOR_IDX, id, port, ipv4);
+}
+
+void DhtNode::handleSrchRedrt(
+  const dhtmsg_t& redrt_pkt,
+  const dhtsrch_t& srch_pkt,
+  size_t finger_idx
+) {
+  // Fail b/c header of join-packet is not SRCH_ATLOC
+  assert(srch_pkt.msg.header.type == SRCH_ATLOC);
+
+  // Update finger table 
+  handleRedrt(redrt_pkt, finger_idx);
+
+  // Forward search packet to the DHT
+  forwardImageQuery(srch_pkt);
+}
+
+void DhtNode::handleJoinRedrt(
+  const dhtmsg_t& redrt_pkt,
+  const dhtmsg_t& join_pkt,
+  size_t finger_idx
+) {
+  // Fail b/c header of join-packet is not JOIN_ATLOC
+  assert(join_pkt.header.type == JOIN_ATLOC);
+
+  // Update finger table 
+  handleRedrt(redrt_pkt, finger_idx);
+  
+  // Forward join back to network
+  forwardJoin(join_pkt);
+}
+
+void DhtNode::handleReidAndCloseCxn(
+  const dhtmsg_t& msg,
+  const Connection& connection
+) {
+  // Read remainder of reid packet
+  dhtreid_t reid_pkt;
+  reid_pkt.msg = msg;
+
+  // Older nodes and refdhtdb send a bare dhtmsg_t and hang up, so there's
+  // no free id to read. Fall back to generating a new id.
+  try {
+    connection.readAll((void *) &reid_pkt.free, sizeof(reid_pkt.free));
+  } catch (const PrematurelyClosedSocketException& e) {
+    memset(&reid_pkt.free, 0, sizeof(reid_pkt.free));
+  }
+
+  connection.close();
+
+  // Another seed got us in already
+  if (hasJoined_) {
+    std::cout << "\t- We've already been welcomed. Ignoring REID..." << std::endl;
+    return;
+  }
+
+  // Every seed may have run into the same collision
+  if (reid_pkt.free.port && reid_pkt.free.id == id_) {
+    std::cout << "\t- We've already adopted id " << (int) id_ << ". Ignoring REID..." << std::endl;
+    return;
+  }
+
+  // Don't let outstanding requests for our old id race with the new one
+  awaitJoinRequests();
+
+  if (reid_pkt.free.port) {
+    // Report that we're adopting the provided id
+    std::cout << "\t- Adopting free id " << (int) reid_pkt.free.id << " provided by node "
+        << (int) msg.node.id << "..." << std::endl;
+
+    // Keep our dht socket, just recompute fingers for the new id
+    id_ = reid_pkt.free.id;
+    initFingers();
+    reportId();
+
+    // Reload images because we've changed our identifier ring
+    reloadDb();
+
+    // Retry join with the node that owns the free id
+    ServerBuilder builder;
+    builder
+        .setRemotePort(ntohs(reid_pkt.free.port))
+        .setRemoteIpv4Address(ntohl(reid_pkt.free.ipv4));
+
+    sendJoinRequest(builder, "node " + std::to_string(msg.node.id));
+    return;
+  }
+
+  // Report that we're generating a new id
+  std::cout << "\t- Restarting dht socket and generating new id..." << std::endl;
+
+  // Close dht receiver socket and create a new one
+  dhtReceiver_->close();
+  delete dhtReceiver_;
+  initDhtReceiver();
+
+  // Derive a new id from the new address+port of the new 
+  // receiving socket and recompute fingers
+  deriveId();
+  initFingers();
+  reportId();
+  
+  // Reload images because we've changed our identifier ring
+  reloadDb();
+
+  // Retry join
+  sendJoinRequest();
+}
+
+void DhtNode::handleSrchAndCloseCxn(
+  const dhtmsg_t& msg,
+  const Connection& connection
+) {
+
+  // Fail due to incorrect message type
+  assert(msg.header.type == SRCH || msg.header.type == SRCH_ATLOC);
+
+  // Read remainder of search packet
+  dhtsrch_t srch_pkt;
+  srch_pkt.msg = msg;
+  
+  connection.readAll((void *) &srch_pkt.img, sizeof(dhtimg_t));
+
+  // Report that we've received an image query from the network
+  std::cout << "\t- Received SRCH packet from DHT network " << stringifySrchPkt(srch_pkt)
+      << "\n\t- Checking local db... " << std::endl;
+
+  // Query local db for requested image, w/the hashes computed by the proxy
+  const ImageKey key(srch_pkt.img);
+  recordImageRequest(key);
+  QueryResult result = imageDb_->query(key);
+  
+  switch (result) {
+    //// IMAGE IS LOCAL -> FORWARD TO DHT PROXY ////
+    case QUERY_SUCCESS:
+      // Report image found locally
+      std::cout << "\t- Image found!" << std::endl;
+      connection.close();
+      handleRemoteImageQuerySuccess(srch_pkt);
+      return;
+
+    //// IMAGE IS NOT LOCAL -> FORWARD TO DHT OR SQUASH ////
+    case BLOOM_FILTER_MISS:
+      // Report bloom filter miss
+      std::cout << "\t- Image NOT found (bloom filter false positive)" << std::endl;
+      break;
+
+    case QUERY_FAILURE:
+      std::cout << "\t- Image NOT found (not in bloom filter either)" << std::endl;
+      break;
+
+    default:
+      std::cout << "Invalid QueryResult type" << std::endl;
+      exit(1);
+  }
+
+  if (inOurPurview(srch_pkt.img.id)) {
+    // Close connection, b/c we're done with it
+    connection.close();
+    
+    // The image doesn't exist, notify dht image proxy 
+    returnNotFoundToImageProxy(srch_pkt);
+
+  } else if (senderExpectedSearchSuccess(srch_pkt)) {
+    // Reply to sender with REDRT message 
+    sendRedrt(connection); 
+    
+    // Close connection, b/c we're done with it (after we send redrt to sender)
+    connection.close();
+
+  } else {
+    // Close connection, b/c we're done with it
+    connection.close();
+    // Forward along DHT network
+    forwardImageQuery(srch_pkt);
+
+    // Pull the image closer, if it's in demand
+    prefetchIfHot(srch_pkt);
+  }
+}
+
+void DhtNode::handleIsrchAndCloseCxn(
+  const dhtmsg_t& msg,
+  const Connection& connection
+) {
+
+  // Fail due to incorrect message type
+  assert(msg.header.type == ISRCH || msg.header.type == ISRCH_ATLOC);
+
+  // Read remainder of search packet
+  dhtsrch_t srch_pkt;
+  srch_pkt.msg = msg;
+
+  connection.readAll((void *) &srch_pkt.img, sizeof(dhtimg_t));
+
+  // Report that we've been probed
+  std::cout << "\t- Received ISRCH packet from DHT network " << stringifySrchPkt(srch_pkt)
+      << "\n\t- Checking local db... " << std::endl;
+
+  dhtsrch_t reply_pkt;
+  memset(&reply_pkt, 0, sizeof(reply_pkt));
+  reply_pkt.img = srch_pkt.img;
+
+  // Identify ourselves so that the proxy can contact us directly next time
+  reply_pkt.msg.node.id = id_;
+  reply_pkt.msg.node.port = htons(dhtReceiver_->getPort());
+  reply_pkt.msg.node.ipv4 = htonl(dhtReceiver_->getIpv4());
+
+  size_t reply_size = sizeof(reply_pkt);
+  const ImageKey key(srch_pkt.img);
+  recordImageRequest(key);
+
+  if (imageDb_->query(key) == QUERY_SUCCESS) {
+    // Report image found locally
+    std::cout << "\t- Image found! Sending RPLY to probing proxy..." << std::endl;
+    reply_pkt.msg.header = {DHTM_VERS, RPLY};
+
+    // Leave the port unset if we're only serving a cached copy
+    if (!inOurPurview(srch_pkt.img.id)) {
+      reply_pkt.msg.node.port = 0;
+      reply_pkt.msg.node.ipv4 = 0;
+    }
+
+  } else if (inOurPurview(srch_pkt.img.id)) {
+    // Report that the image doesn't exist
+    std::cout << "\t- Image NOT found in our purview. Sending MISS to probing proxy..." << std::endl;
+    reply_pkt.msg.header = {DHTM_VERS, MISS};
+
+  } else {
+    // Point the proxy at our predecessor if it wrongly expected us to own 
+    // the image. Otherwise, point it at our next hop towards the image.
+    bool is_redirect = srch_pkt.msg.header.type == ISRCH_ATLOC;
+    const finger_t& next = is_redirect
+        ? getPredecessor()
+        : fingerTable_.at(findFingerForForwarding(srch_pkt.img.id));
+    bool atloc = is_redirect || expectToFindObjectAtRoute(srch_pkt.img.id);
+
+    reply_pkt.msg.header = {DHTM_VERS, static_cast<uint8_t>(atloc ? NEXT_ATLOC : NEXT)};
+    reply_pkt.msg.node.id = next.node_id;
+    reply_pkt.msg.node.port = htons(next.remote.getRemotePort());
+    reply_pkt.msg.node.ipv4 = htonl(next.remote.getRemoteIpv4Address());
+    reply_size = sizeof(dhtmsg_t);
+
+    // Report next hop
+    std::cout << "\t- Image NOT found. Sending next hop to probing proxy: " 
+        << stringifyFinger(next) << std::endl;
+  }
+
+  std::string payload((const char *) &reply_pkt, reply_size);
+
+  try {
+    connection.writeAll(payload);
+  } catch (const SocketException& e) {
+    // Proxy gave up on us
+    std::cout << "\t- Probing proxy hung up before we could answer." << std::endl;
+  }
+
+  connection.close();
+
+  // Pull the image closer, if it's in demand
+  if (reply_size == sizeof(dhtmsg_t)) {
+    prefetchIfHot(srch_pkt);
+  }
+}
+
+void DhtNode::handleRemoteImageQuerySuccess(const dhtsrch_t& srch_pkt) {
+ 
+  // Report that we're notifying the dht image proxy that we've found
+  // the image
+  std::cout << "\t- Sending RPLY to DHT image proxy <" << 
+      "id: " << (int) srch_pkt.msg.node.id << 
+      ", port: " << (int) ntohs(srch_pkt.msg.node.port) << 
+      ", ipv4: " << stringifyIpv4(srch_pkt.msg.node.ipv4) << 
+      ">" << std::endl;
+
+  // Assemble packet indicating 'image-found'
+  dhtsrch_t image_found_pkt;
+  image_found_pkt.msg.header = {DHTM_VERS, RPLY};
+  image_found_pkt.msg.ttl = 0;
+  image_found_pkt.img = srch_pkt.img;
+
+  // Identify ourselves as the owner so that the proxy can contact us directly
+  // next time. Leave the port unset if we're only serving a cached copy.
+  memset(&image_found_pkt.msg.node, 0, sizeof(dhtnode_t));
+  image_found_pkt.msg.node.id = id_;
+  if (inOurPurview(srch_pkt.img.id)) {
+    image_found_pkt.msg.node.port = htons(dhtReceiver_->getPort());
+    image_found_pkt.msg.node.ipv4 = htonl(dhtReceiver_->getIpv4());
+  }
+
+  std::string payload( (char *) &image_found_pkt, sizeof(image_found_pkt));
+
+  ServerBuilder builder;
+  Connection cxn = buildConnection(builder
+      .setRemotePort(ntohs(srch_pkt.msg.node.port))
+      .setRemoteIpv4Address(ntohl(srch_pkt.msg.node.ipv4)));
+
+  cxn.writeAll(payload);
+  cxn.close();
+}
+
+void DhtNode::handleRplyAndCloseCxn(
+  const dhtmsg_t& msg,
+  const Connection& connection
+) {
+  // Read remainder of search packet
+  dhtsrch_t srch_pkt;
+  srch_pkt.msg = msg;
+  
+  connection.readAll((void *) &srch_pkt.img, sizeof(dhtimg_t));
+  connection.close();
+
+  // Cache hot images that we searched for on our own behalf
+  if (!isReplyForPendingQuery(srch_pkt) && takePendingPrefetch(srch_pkt.img.name)) {
+    std::cout << "\t- Received RPLY for hot image. Caching it..." << std::endl;
+    rememberOwner(srch_pkt.img.id, srch_pkt.msg.node);
+    imageDb_->cacheImage(ImageKey(srch_pkt.img));
+    return;
+  }
+
+  // A hedged search may be answered more than once. The first reply wins.
+  if (!isReplyForPendingQuery(srch_pkt)) {
+    std::cout << "\t- Received late RPLY for a search that's already been answered. Ignoring..." 
+        << std::endl;
+    rememberOwner(srch_pkt.img.id, srch_pkt.msg.node);
+    return;
+  }
+
+  isHedgePending_ = false;
+
+  // Report that we've received a RPLY message
+  std::cout << "\t- Received RPLY from DHT network => the image exists!" << std::endl;
+  reportLookupLatency();
+
+  // Remember who owns this image
+  rememberOwner(srch_pkt.img.id, srch_pkt.msg.node);
+
+  // Cache image
+  imageDb_->cacheImage(ImageKey(srch_pkt.img));
+
+  // Stream image to client (puts us back in proper state)
+  handleLocalQuerySuccess(srch_pkt.img.name);
+}
+
+void DhtNode::handleMissAndCloseCxn(
+  const dhtmsg_t& msg,
+  const Connection& connection
+) {
+  // Read remainder of search packet and close ASAP
+  dhtsrch_t srch_pkt;
+  srch_pkt.msg = msg;
+  
+  connection.readAll((void *) &srch_pkt.img, sizeof(dhtimg_t));
+  connection.close();
+
+  // Remember who owns this image-id
+  rememberOwner(srch_pkt.img.id, srch_pkt.msg.node);
+
+  // The hot image we searched for doesn't exist after all
+  if (!isReplyForPendingQuery(srch_pkt) && takePendingPrefetch(srch_pkt.img.name)) {
+    std::cout << "\t- Received MISS for hot image. Dropping prefetch..." << std::endl;
+    return;
+  }
+
+  // A hedged search may be answered more than once. The first reply wins.
+  if (!isReplyForPendingQuery(srch_pkt)) {
+    std::cout << "\t- Received late MISS for a search that's already been answered. Ignoring..." 
+        << std::endl;
+    return;
+  }
+
+  isHedgePending_ = false;
+  
+  // Report that we're sending "image not found" message to the
+  // querying netimg client
+  std::cout << "\t- Received MISS from DHT network. The image could not be found. " 
+      << " Notifying netimg client..." << std::endl;
+  reportLookupLatency();
+
+
+  // Send image-not-found response to netimg
+  sendImageNotFound();
+}
+
+
+void DhtNode::handleWlcmAndCloseCxn(
+  const dhtmsg_t& msg,
+  const Connection& connection
+) {
+  
+  const dhtnode_t& succ = msg.node;
+ 
+  // Read predecessor dhtnode_t from wire
+  dhtnode_t pred;
+  size_t pred_size = sizeof(pred);
+
+  connection.readAll((void *) &pred, pred_size);
+  connection.close();
+
+  // The first WLCM wins
+  if (hasJoined_) {
+    std::cout << "\t- We've already been welcomed. Ignoring WLCM..." << std::endl;
     return;
-  } 
+  }
 
-  // Fix finger table
-  if (idx) {
-    fixDown(idx);
+  hasJoined_ = true;
+
+  // Report WLCM message w/successor/predecessor data
+  std::cout << "\t- We've been welcomed into the DHT! Here are our new predecessor/successor nodes:" <<
+      "\n\t\t- Predecessor: <id: " << (int) pred.id << ", port: " << 
+      (int) ntohs(pred.port) << ", ipv4: " << stringifyIpv4(pred.ipv4) << 
+      ">\n\t\t- Successor:   <id: " << (int) succ.id << ", port: " << 
+      (int) ntohs(succ.port) << ", ipv4: " << stringifyIpv4(succ.ipv4) << ">" << std::endl;
+
+  // Make predecessor/successor nodes provided in WLCM message our new predecessor/successor nodes
+  updatePredecessorAndImageDb(pred.id, ntohs(pred.port), ntohl(pred.ipv4));
+  updateSuccessor(succ.id, ntohs(succ.port), ntohl(succ.ipv4));
+
+  // Now that we're part of the ring, let the next virtual node join
+  getHost()->joinNextVirtualNode();
+}
+
+void DhtNode::sendXfer(
+  const dhtmsg_t& join_msg,
+  const std::vector<ImageKey>& images
+) {
+  finger_t joiner;
+  joiner.remote
+      .setRemotePort(ntohs(join_msg.node.port))
+      .setRemoteIpv4Address(ntohl(join_msg.node.ipv4));
+  joiner.finger_id = join_msg.node.id;
+  joiner.node_id = join_msg.node.id;
+
+  std::vector<handoff_t> handoff = prepareHandoff(images);
+
+  // A virtual node may share our thread, so don't stream to it over a
+  // socket that it can't drain until we return
+  DhtNode* local = findLocalNode(joiner);
+  if (local) {
+    std::cout << "\t- Handing " << handoff.size() << " image(s) to the joining "
+        << "virtual node" << std::endl;
+
+    local->absorbXfer(id_, handoff);
+    return;
   }
 
-  if (idx < FINGER_TABLE_SIZE) {
-    fixUp(idx);
+  // Assemble 'xfer' packet
+  dhtxfer_t xfer_pkt;
+  memset(&xfer_pkt, 0, sizeof(xfer_pkt));
+  xfer_pkt.msg.header = {DHTM_VERS, XFER};
+  xfer_pkt.msg.node.id = id_;
+  xfer_pkt.msg.node.port = htons(dhtReceiver_->getPort());
+  xfer_pkt.msg.node.ipv4 = htonl(dhtReceiver_->getIpv4());
+  xfer_pkt.num_imgs = htons(static_cast<uint16_t>(handoff.size()));
+
+  // Report sending XFER message
+  std::cout << "\t- Sending XFER packet with " << handoff.size() 
+      << " image(s) to the joining node" << std::endl;
+
+  std::string header((const char *) &xfer_pkt, sizeof(xfer_pkt));
+  if (!sendImageStream(joiner.remote, header, handoff)) {
+    std::cout << "\t- Failed to send XFER packet to the joining node!" << std::endl;
   }
 }
 
-const std::string DhtNode::stringifyFinger(const finger_t& finger) const {
-  std::string finger_str = "<finger-id: ";
-  finger_str += std::to_string(finger.finger_id);
-  finger_str += ", node-id: " + std::to_string(finger.node_id);
-  finger_str += ", port: " + std::to_string(finger.remote.getRemotePort());
-  finger_str += ", ipv4: " + stringifyIpv4(htonl(finger.remote.getRemoteIpv4Address()));
-  finger_str += ">";
+void DhtNode::handleXferAndCloseCxn(
+  const dhtmsg_t& msg,
+  const Connection& connection
+) {
+  // Read remainder of xfer packet
+  dhtxfer_t xfer_pkt;
+  xfer_pkt.msg = msg;
 
-  return finger_str;
+  connection.readAll(
+      (void *) &xfer_pkt.num_imgs,
+      sizeof(xfer_pkt) - sizeof(xfer_pkt.msg));
+
+  std::vector<handoff_t> images = readImageStream(
+      connection,
+      ntohs(xfer_pkt.num_imgs));
+  connection.close();
+
+  absorbXfer(msg.node.id, images);
 }
 
-void DhtNode::updatePredecessorAndImageDb(uint8_t id, uint16_t port, uint32_t ipv4) {
-  // Update finger
-  updateFinger(PREDECESSOR_IDX, id, port, ipv4);
+void DhtNode::absorbXfer(uint8_t sender_id, const std::vector<handoff_t>& images) {
+  // Add the images that our manifest didn't give us
+  size_t num_added = absorbHandoff(images);
 
-  // Reload the db
-  reloadDb();
+  // Report the transfer
+  std::cout << "\t- Received " << images.size() << " image(s) from node " 
+      << (int) sender_id << ", " << num_added << " of which were new" << std::endl;
 }
 
-void DhtNode::updateSuccessor(uint8_t id, uint16_t port, uint32_t ipv4) {
-  updateFinger(SUCCESSOR_IDX, id, port, ipv4);
+void DhtNode::handleLeaveAndCloseCxn(
+  const dhtmsg_t& msg,
+  const Connection& connection
+) {
+  // Read remainder of leave packet
+  dhtleave_t leave_pkt;
+  leave_pkt.msg = msg;
+
+  connection.readAll(
+      (void *) &leave_pkt.leaving,
+      sizeof(leave_pkt) - sizeof(leave_pkt.msg));
+
+  // Read the images cached by the leaving node
+  std::vector<handoff_t> images = readImageStream(
+      connection,
+      ntohs(leave_pkt.num_imgs));
+  connection.close();
+
+  absorbLeavingNode(leave_pkt.msg.node, leave_pkt.leaving, images);
 }
 
-void DhtNode::handleSrchRedrt(
-  const dhtmsg_t& redrt_pkt,
-  const dhtsrch_t& srch_pkt,
-  size_t finger_idx
+void DhtNode::handleSuccAndCloseCxn(
+  const dhtmsg_t& msg,
+  const Connection& connection
 ) {
-  // Fail b/c header of join-packet is not SRCH_ATLOC
-  assert(srch_pkt.msg.header.type == SRCH_ATLOC);
+  // Read remainder of leave packet
+  dhtleave_t leave_pkt;
+  leave_pkt.msg = msg;
 
-  // Update finger table 
-  handleRedrt(redrt_pkt, finger_idx);
+  connection.readAll(
+      (void *) &leave_pkt.leaving,
+      sizeof(leave_pkt) - sizeof(leave_pkt.msg));
+  connection.close();
 
-  // Forward search packet to the DHT
-  forwardImageQuery(srch_pkt);
+  bypassLeavingNode(leave_pkt.msg.node, leave_pkt.leaving);
 }
 
-void DhtNode::handleJoinRedrt(
-  const dhtmsg_t& redrt_pkt,
-  const dhtmsg_t& join_pkt,
-  size_t finger_idx
-) {
-  // Fail b/c header of join-packet is not JOIN_ATLOC
-  assert(join_pkt.header.type == JOIN_ATLOC);
+void DhtNode::leaveNetwork() {
+  const finger_t successor = fingerTable_.front();
+  const finger_t predecessor = getPredecessor();
 
-  // Update finger table 
-  handleRedrt(redrt_pkt, finger_idx);
-  
-  // Forward join back to network
-  forwardJoin(join_pkt);
+  // Nothing to hand off if we're the only node in the ring
+  if (successor.node_id == id_ && predecessor.node_id == id_) {
+    return;
+  }
+
+  // Report that we're leaving
+  std::cout << "\t- Leaving the DHT. Handing our range to our successor: "
+      << stringifyFinger(successor) << std::endl;
+
+  dhtnode_t self;
+  memset(&self, 0, sizeof(self));
+  self.id = id_;
+  self.port = htons(dhtReceiver_->getPort());
+  self.ipv4 = htonl(dhtReceiver_->getIpv4());
+
+  dhtnode_t succ;
+  memset(&succ, 0, sizeof(succ));
+  succ.id = successor.node_id;
+  succ.port = htons(successor.remote.getRemotePort());
+  succ.ipv4 = htonl(successor.remote.getRemoteIpv4Address());
+
+  dhtnode_t pred;
+  memset(&pred, 0, sizeof(pred));
+  pred.id = predecessor.node_id;
+  pred.port = htons(predecessor.remote.getRemotePort());
+  pred.ipv4 = htonl(predecessor.remote.getRemoteIpv4Address());
+
+  std::vector<handoff_t> images = prepareHandoff(imageDb_->getCachedImages());
+
+  // Hand our range and cached images to our successor
+  DhtNode* local_succ = findLocalNode(successor);
+  if (local_succ) {
+    local_succ->absorbLeavingNode(pred, self, images);
+  } else {
+    dhtleave_t leave_pkt;
+    memset(&leave_pkt, 0, sizeof(leave_pkt));
+    leave_pkt.msg.header = {DHTM_VERS, LEAVE};
+    leave_pkt.msg.node = pred;
+    leave_pkt.leaving = self;
+    leave_pkt.num_imgs = htons(static_cast<uint16_t>(images.size()));
+
+    sendLeavePacket(successor, leave_pkt, images);
+  }
+
+  // Report that we're updating our predecessor
+  std::cout << "\t- Handing our successor to our predecessor: " 
+      << stringifyFinger(predecessor) << std::endl;
+
+  // Make our successor our predecessor's successor 
+  DhtNode* local_pred = findLocalNode(predecessor);
+  if (local_pred) {
+    local_pred->bypassLeavingNode(succ, self);
+  } else {
+    dhtleave_t succ_pkt;
+    memset(&succ_pkt, 0, sizeof(succ_pkt));
+    succ_pkt.msg.header = {DHTM_VERS, SUCC};
+    succ_pkt.msg.node = succ;
+    succ_pkt.leaving = self;
+
+    sendLeavePacket(predecessor, succ_pkt, std::vector<handoff_t>());
+  }
 }
 
-void DhtNode::handleReid() {
-  // Report that we're generating a new id
-  std::cout << "\t- Restarting dht socket and generating new id..." << std::endl;
+void DhtNode::sendLeavePacket(
+  const finger_t& target,
+  const dhtleave_t& leave_pkt,
+  const std::vector<handoff_t>& images
+) const {
+  std::string header((const char *) &leave_pkt, sizeof(leave_pkt));
+  if (!sendImageStream(target.remote, header, images)) {
+    // Report that the node is gone -- the ring will have to recover without us
+    std::cout << "\t- Failed to send " 
+        << stringifyDhtType(static_cast<DhtType>(leave_pkt.msg.header.type))
+        << " packet to " << stringifyFinger(target) << std::endl;
+  }
+}
 
-  // Close dht receiver socket and create a new one
-  dhtReceiver_->close();
-  delete dhtReceiver_;
-  initDhtReceiver();
+bool DhtNode::sendImageStream(
+  const ServerBuilder& remote_builder,
+  const std::string& header,
+  const std::vector<handoff_t>& images
+) const {
+  // Stream the header and every image in one go
+  std::string message = header;
+  for (const handoff_t& image : images) {
+    dhthandoff_t handoff_pkt;
+    memset(&handoff_pkt, 0, sizeof(handoff_pkt));
+    image.key.serialize(handoff_pkt.img);
+    handoff_pkt.count = htonl(image.count);
+
+    message += std::string((const char *) &handoff_pkt, sizeof(handoff_pkt));
+  }
 
-  // Derive a new id from the new address+port of the new 
-  // receiving socket and recompute fingers
-  deriveId();
-  initFingers();
-  reportId();
-  
-  // Reload images because we've changed our identifier ring
-  reloadDb();
+  try {
+    Connection remote = buildConnection(remote_builder);
+    remote.writeAll(message);
+    remote.close();
+  } catch (const SocketException& e) {
+    return false;
+  }
 
-  // Retry join
-  sendJoinRequest();
+  return true;
 }
 
-void DhtNode::handleSrchAndCloseCxn(
-  const dhtmsg_t& msg,
-  const Connection& connection
-) {
+std::vector<DhtNode::handoff_t> DhtNode::readImageStream(
+  const Connection& connection,
+  uint16_t num_imgs
+) const {
+  std::vector<handoff_t> images;
+  for (uint16_t i = 0; i < num_imgs; ++i) {
+    dhthandoff_t handoff_pkt;
+    connection.readAll((void *) &handoff_pkt, sizeof(handoff_pkt));
+    images.push_back({ImageKey(handoff_pkt.img), ntohl(handoff_pkt.count)});
+  }
 
-  // Fail due to incorrect message type
-  assert(msg.header.type == SRCH || msg.header.type == SRCH_ATLOC);
+  return images;
+}
 
-  // Read remainder of search packet
-  dhtsrch_t srch_pkt;
-  srch_pkt.msg = msg;
-  
-  connection.readAll((void *) &srch_pkt.img, sizeof(dhtimg_t));
+std::vector<DhtNode::handoff_t> DhtNode::prepareHandoff(
+  const std::vector<ImageKey>& images
+) const {
+  std::vector<handoff_t> handoff;
+  for (const ImageKey& key : images) {
+    handoff.push_back({key, popularity_.estimate(key.getName())});
+  }
 
-  // Report that we've received an image query from the network
-  std::cout << "\t- Received SRCH packet from DHT network " << stringifySrchPkt(srch_pkt)
-      << "\n\t- Checking local db... " << std::endl;
+  // Most requested first, so that the receiver can favor them
+  std::stable_sort(handoff.begin(), handoff.end(),
+      [](const handoff_t& lhs, const handoff_t& rhs) { return lhs.count > rhs.count; });
 
-  // Query local db for requested image
-  const std::string file_name(srch_pkt.img.name);
-  QueryResult result = imageDb_->query(file_name);
-  
-  switch (result) {
-    //// IMAGE IS LOCAL -> FORWARD TO DHT PROXY ////
-    case QUERY_SUCCESS:
-      // Report image found locally
-      std::cout << "\t- Image found!" << std::endl;
-      connection.close();
-      handleRemoteImageQuerySuccess(srch_pkt);
+  // num_imgs is 16 bits
+  if (handoff.size() > MAX_HANDOFF_IMAGES) {
+    std::cout << "\t- Dropping the " << handoff.size() - MAX_HANDOFF_IMAGES
+        << " least requested image(s) from the handoff" << std::endl;
+
+    handoff.resize(MAX_HANDOFF_IMAGES);
+  }
+
+  return handoff;
+}
+
+size_t DhtNode::absorbHandoff(const std::vector<handoff_t>& images) {
+  // Keep the requests that made the images popular at the sender
+  std::vector<ImageKey> keys;
+  for (const handoff_t& image : images) {
+    popularity_.add(image.key.getName(), image.count);
+    keys.push_back(image.key);
+  }
+
+  // Later images push out earlier ones, so pass the most requested last
+  std::reverse(keys.begin(), keys.end());
+
+  return imageDb_->preloadCache(keys);
+}
+
+void DhtNode::absorbLeavingNode(
+  const dhtnode_t& pred,
+  const dhtnode_t& leaving,
+  const std::vector<handoff_t>& images
+) {
+  const finger_t predecessor = getPredecessor();
+  bool is_predecessor = predecessor.node_id == leaving.id
+      && predecessor.remote.getRemotePort() == ntohs(leaving.port)
+      && predecessor.remote.getRemoteIpv4Address() == ntohl(leaving.ipv4);
+
+  // The leaving node's successor is stale if other nodes joined between it
+  // and us. Pass the LEAVE back towards the node that really follows it.
+  if (!is_predecessor && !ID_inrange(leaving.id, predecessor.node_id, id_)) {
+    // Report that we're passing the LEAVE on
+    std::cout << "\t- Node " << (int) leaving.id << " isn't our predecessor. Passing LEAVE to: "
+        << stringifyFinger(predecessor) << std::endl;
+
+    DhtNode* local_pred = findLocalNode(predecessor);
+    if (local_pred) {
+      local_pred->absorbLeavingNode(pred, leaving, images);
       return;
+    }
 
-    //// IMAGE IS NOT LOCAL -> FORWARD TO DHT OR SQUASH ////
-    case BLOOM_FILTER_MISS:
-      // Report bloom filter miss
-      std::cout << "\t- Image NOT found (bloom filter false positive)" << std::endl;
-      break;
+    dhtleave_t leave_pkt;
+    memset(&leave_pkt, 0, sizeof(leave_pkt));
+    leave_pkt.msg.header = {DHTM_VERS, LEAVE};
+    leave_pkt.msg.node = pred;
+    leave_pkt.leaving = leaving;
+    leave_pkt.num_imgs = htons(static_cast<uint16_t>(images.size()));
 
-    case QUERY_FAILURE:
-      std::cout << "\t- Image NOT found (not in bloom filter either)" << std::endl;
-      break;
+    sendLeavePacket(predecessor, leave_pkt, images);
+    return;
+  }
 
-    default:
-      std::cout << "Invalid QueryResult type" << std::endl;
-      exit(1);
+  // Report that we're taking over our predecessor's range
+  std::cout << "\t- Node " << (int) leaving.id << " is leaving. Taking over its range and "
+      << images.size() << " cached image(s)..." << std::endl;
+
+  forgetOwner(leaving.id);
+
+  // We now own every id that the leaving node owned
+  dhtnode_t self;
+  memset(&self, 0, sizeof(self));
+  self.id = id_;
+  self.port = htons(dhtReceiver_->getPort());
+  self.ipv4 = htonl(dhtReceiver_->getIpv4());
+  replaceFingers(leaving, self);
+
+  // Make leaving node's predecessor our predecessor (reloads range). If we
+  // never learned about the leaving node, our predecessor is still correct.
+  if (is_predecessor) {
+    updatePredecessorAndImageDb(pred.id, ntohs(pred.port), ntohl(pred.ipv4));
   }
 
-  if (inOurPurview(srch_pkt.img.id)) {
-    // Close connection, b/c we're done with it
-    connection.close();
-    
-    // The image doesn't exist, notify dht image proxy 
-    returnNotFoundToImageProxy(srch_pkt);
+  // Keep the leaving node's cache warm
+  size_t num_added = absorbHandoff(images);
 
-  } else if (senderExpectedSearchSuccess(srch_pkt)) {
-    // Reply to sender with REDRT message 
-    sendRedrt(connection); 
-    
-    // Close connection, b/c we're done with it (after we send redrt to sender)
-    connection.close();
+  // Report the handoff
+  std::cout << "\t- Cached " << num_added << " of the leaving node's image(s)" << std::endl;
+}
 
-  } else {
-    // Close connection, b/c we're done with it
-    connection.close();
-    // Forward along DHT network
-    forwardImageQuery(srch_pkt);
+void DhtNode::bypassLeavingNode(const dhtnode_t& succ, const dhtnode_t& leaving) {
+  // Report that our successor is leaving
+  std::cout << "\t- Node " << (int) leaving.id << " is leaving. Making node "
+      << (int) succ.id << " our successor..." << std::endl;
+
+  forgetOwner(leaving.id);
+  replaceFingers(leaving, succ);
+}
+
+void DhtNode::replaceFingers(const dhtnode_t& old_node, const dhtnode_t& new_node) {
+  for (size_t idx = 0; idx < PREDECESSOR_IDX; ++idx) {
+    const finger_t& finger = fingerTable_.at(idx);
+    if (finger.node_id == old_node.id
+        && finger.remote.getRemotePort() == ntohs(old_node.port)
+        && finger.remote.getRemoteIpv4Address() == ntohl(old_node.ipv4))
+    {
+      updateFinger(idx, new_node.id, ntohs(new_node.port), ntohl(new_node.ipv4));
+    }
   }
 }
 
-void DhtNode::handleRemoteImageQuerySuccess(const dhtsrch_t& srch_pkt) {
- 
-  // Report that we're notifying the dht image proxy that we've found
-  // the image
-  std::cout << "\t- Sending RPLY to DHT image proxy <" << 
-      "id: " << (int) srch_pkt.msg.node.id << 
-      ", port: " << (int) ntohs(srch_pkt.msg.node.port) << 
-      ", ipv4: " << stringifyIpv4(srch_pkt.msg.node.ipv4) << 
-      ">" << std::endl;
+bool DhtNode::doesJoinCollide(const dhtmsg_t& join_msg) const {
+  return getPredecessor().node_id == join_msg.node.id || id_ == join_msg.node.id;  
+}
 
-  // Assemble packet indicating 'image-found'
-  dhtsrch_t image_found_pkt;
-  image_found_pkt.msg.header = {DHTM_VERS, RPLY};
-  image_found_pkt.msg.node.id = id_;
-  image_found_pkt.img = srch_pkt.img;
+bool DhtNode::inOurPurview(uint8_t id) const {
+  return ID_inrange(id, getPredecessor().node_id, id_);
+}
 
-  std::string payload( (char *) &image_found_pkt, sizeof(image_found_pkt));
+bool DhtNode::inLocalPurview(uint8_t id) const {
+  const DhtNode* host = getHost();
+  if (host->inOurPurview(id)) {
+    return true;
+  }
+
+  for (const DhtNode* vnode : host->virtualNodes_) {
+    if (vnode->inOurPurview(id)) {
+      return true;
+    }
+  }
+
+  return false;
+}
 
-  ServerBuilder builder;
-  Connection cxn = builder
-      .setRemotePort(ntohs(srch_pkt.msg.node.port))
-      .setRemoteIpv4Address(ntohl(srch_pkt.msg.node.ipv4))
-      .build();
+bool DhtNode::queryLocalNodes(const ImageKey& key) const {
+  for (const DhtNode* vnode : getHost()->virtualNodes_) {
+    if (vnode->imageDb_->query(key) == QUERY_SUCCESS) {
+      return true;
+    }
+  }
 
-  cxn.writeAll(payload);
-  cxn.close();
+  return false;
 }
 
-void DhtNode::handleRplyAndCloseCxn(
-  const dhtmsg_t& msg,
-  const Connection& connection
-) {
-  // Read remainder of search packet
-  dhtsrch_t srch_pkt;
-  
-  connection.readAll((void *) &srch_pkt.img, sizeof(dhtimg_t));
-  connection.close();
+DhtNode* DhtNode::getHost() {
+  return host_ ? host_ : this;
+}
 
-  // Report that we've received a RPLY message
-  std::cout << "\t- Received RPLY from DHT network => the image exists!" << std::endl;
+const DhtNode* DhtNode::getHost() const {
+  return host_ ? host_ : this;
+}
 
-  // Cache image
-  imageDb_->cacheImage(srch_pkt.img.name); 
+DhtNode* DhtNode::findLocalNode(const finger_t& finger) {
+  DhtNode* host = getHost();
+  std::vector<DhtNode*> nodes(host->virtualNodes_);
+  nodes.push_back(host);
+
+  for (DhtNode* node : nodes) {
+    if (node->id_ == finger.node_id
+        && node->dhtReceiver_->getPort() == finger.remote.getRemotePort()
+        && node->dhtReceiver_->getIpv4() == finger.remote.getRemoteIpv4Address())
+    {
+      return node;
+    }
+  }
 
-  // Stream image to client (puts us back in proper state)
-  handleLocalQuerySuccess(srch_pkt.img.name);
+  return nullptr;
 }
 
-void DhtNode::handleMissAndCloseCxn(
-  const dhtmsg_t& msg,
-  const Connection& connection
-) {
-  // Read remainder of search packet and close ASAP
-  dhtsrch_t srch_pkt;
-  
-  connection.readAll((void *) &srch_pkt.img, sizeof(dhtimg_t));
-  connection.close();
-  
-  // Report that we're sending "image not found" message to the
-  // querying netimg client
-  std::cout << "\t- Received MISS from DHT network. The image could not be found. " 
-      << " Notifying netimg client..." << std::endl;
+bool DhtNode::resolveLocalRedrt(
+  const DhtNode& local,
+  uint8_t object_id,
+  dhtmsg_t& redrt_pkt
+) const {
+  if (local.inOurPurview(object_id)) {
+    return false;
+  }
 
+  // Assemble the REDRT packet that 'local' would have sent us
+  const finger_t& predecessor_finger = local.getPredecessor();
+  redrt_pkt.header = {DHTM_VERS, REDRT};
+  redrt_pkt.ttl = 0;
+  memset(&redrt_pkt.node, 0, sizeof(dhtnode_t));
+  redrt_pkt.node.id = predecessor_finger.node_id;
+  redrt_pkt.node.port = htons(predecessor_finger.remote.getRemotePort());
+  redrt_pkt.node.ipv4 = htonl(predecessor_finger.remote.getRemoteIpv4Address());
 
-  // Send image-not-found response to netimg
-  sendImageNotFound();
+  // Report that the local node would have redirected us
+  std::cout << "\t- Virtual node " << (int) local.id_ << " doesn't own "
+      << (int) object_id << ", redirecting locally" << std::endl;
+
+  return true;
 }
 
+void DhtNode::hostVirtualNodes(size_t count) {
+  // Fail b/c virtual nodes can't host other virtual nodes
+  assert(!host_);
 
-void DhtNode::handleWlcmAndCloseCxn(
-  const dhtmsg_t& msg,
-  const Connection& connection
-) {
-  
-  const dhtnode_t& succ = msg.node;
- 
-  // Read predecessor dhtnode_t from wire
-  dhtnode_t pred;
-  size_t pred_size = sizeof(pred);
+  // Fail b/c count is out of bounds
+  assert(count > 0 && count <= MAX_VIRTUAL_NODES);
 
-  connection.readAll((void *) &pred, pred_size);
-  connection.close();
+  for (size_t i = virtualNodes_.size() + 1; i < count; ++i) {
+    virtualNodes_.push_back(new DhtNode(this));
+  }
+}
 
-  // Report WLCM message w/successor/predecessor data
-  std::cout << "\t- We've been welcomed into the DHT! Here are our new predecessor/successor nodes:" <<
-      "\n\t\t- Predecessor: <id: " << (int) pred.id << ", port: " << 
-      (int) ntohs(pred.port) << ", ipv4: " << stringifyIpv4(pred.ipv4) << 
-      ">\n\t\t- Successor:   <id: " << (int) succ.id << ", port: " << 
-      (int) ntohs(succ.port) << ", ipv4: " << stringifyIpv4(succ.ipv4) << ">" << std::endl;
+void DhtNode::setLocalTransport(LocalTransport* transport) {
+  // Fail b/c virtual nodes use their host's transport
+  assert(!host_);
 
-  // Make predecessor/successor nodes provided in WLCM message our new predecessor/successor nodes
-  updatePredecessorAndImageDb(pred.id, ntohs(pred.port), ntohl(pred.ipv4));
-  updateSuccessor(succ.id, ntohs(succ.port), ntohl(succ.ipv4));
+  localTransport_ = transport;
+
+  updateLocalInbox();
+  for (DhtNode* vnode : virtualNodes_) {
+    vnode->updateLocalInbox();
+  }
 }
 
-bool DhtNode::doesJoinCollide(const dhtmsg_t& join_msg) const {
-  return getPredecessor().node_id == join_msg.node.id || id_ == join_msg.node.id;  
+void DhtNode::joinNextVirtualNode() {
+  // Fail b/c only the host tracks virtual nodes
+  assert(!host_);
+
+  if (nextVirtualJoin_ == virtualNodes_.size()) {
+    // Every virtual node is in the ring
+    if (joinedCallback_) {
+      joinedCallback_();
+      joinedCallback_ = nullptr;
+    }
+
+    return;
+  }
+
+  DhtNode* vnode = virtualNodes_.at(nextVirtualJoin_);
+  ++nextVirtualJoin_;
+
+  // Report that another virtual node is joining
+  std::cout << "\t- Joining virtual node " << nextVirtualJoin_ << "/" <<
+      virtualNodes_.size() << " <id: " << (int) vnode->id_ << ">" << std::endl;
+
+  vnode->joinNetwork(dhtReceiver_->getDomainName(), dhtReceiver_->getPort());
 }
 
-bool DhtNode::inOurPurview(uint8_t id) const {
-  return ID_inrange(id, getPredecessor().node_id, id_);
+void DhtNode::reportLoad() const {
+  const DhtNode* host = getHost();
+  std::vector<const DhtNode*> nodes(1, host);
+  nodes.insert(nodes.end(), host->virtualNodes_.begin(), host->virtualNodes_.end());
+
+  std::cout << "--- Virtual Node Load ---" << std::endl;
+
+  size_t total_arc = 0;
+  size_t total_images = 0;
+
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    const DhtNode* node = nodes.at(i);
+    uint8_t pred_id = node->getPredecessor().node_id;
+
+    // Number of ids in (pred_id, id]. The whole ring if we're alone.
+    size_t arc = (pred_id == node->id_)
+        ? NUM_IDS
+        : static_cast<uint8_t>(node->id_ - pred_id);
+    size_t num_images = node->imageDb_->getNumImages();
+
+    std::cout << "\t- vnode[" << i << "] <id: " << (int) node->id_ << ", range: (" <<
+        (int) pred_id << ", " << (int) node->id_ << "], arc: " << arc <<
+        ", images: " << num_images << ", cached: " << node->imageDb_->getNumCachedImages() <<
+        ", cache hit ratio: " << 100.0 * node->imageDb_->getCacheHitRatio() << "%>" << std::endl;
+
+    total_arc += arc;
+    total_images += num_images;
+  }
+
+  std::cout << "\t- total <arc: " << total_arc << " (" <<
+      (100.0 * total_arc / NUM_IDS) << "% of ring), images: " << total_images << ">" <<
+      "\n--------------------" << std::endl;
 }
 
 bool DhtNode::inSuccessorsPurview(uint8_t object_id) const {
@@ -1268,6 +3103,16 @@ void DhtNode::returnNotFoundToImageProxy(const dhtsrch_t& srch_pkt) {
   // Assemble 'not found' packet    
   dhtsrch_t nf_pkt;
   nf_pkt.msg.header = {DHTM_VERS, MISS};
+  nf_pkt.msg.ttl = 0;
+  nf_pkt.img = srch_pkt.img;
+
+  // Identify ourselves as the owner of the image-id
+  dhtnode_t self;
+  memset(&self, 0, sizeof(self));
+  self.id = id_;
+  self.port = htons(dhtReceiver_->getPort());
+  self.ipv4 = htonl(dhtReceiver_->getIpv4());
+  nf_pkt.msg.node = self;
   
   std::string payload( (char *) &nf_pkt, sizeof(nf_pkt));
 
@@ -1279,10 +3124,9 @@ void DhtNode::returnNotFoundToImageProxy(const dhtsrch_t& srch_pkt) {
 
   // Connect to dht image proxy
   ServerBuilder builder;
-  Connection cxn = builder
+  Connection cxn = buildConnection(builder
     .setRemotePort(ntohs(srch_pkt.msg.node.port))
-    .setRemoteIpv4Address(ntohl(srch_pkt.msg.node.ipv4))
-    .build();
+    .setRemoteIpv4Address(ntohl(srch_pkt.msg.node.ipv4)));
 
   // Send NFOUND payload
   cxn.writeAll(payload);
@@ -1310,10 +3154,24 @@ std::string DhtNode::stringifyDhtType(DhtType type) const {
       return SRCH_STR;
     case SRCH_ATLOC:
       return SRCH_ATLOC_STR;
+    case ISRCH:
+      return ISRCH_STR;
+    case ISRCH_ATLOC:
+      return ISRCH_ATLOC_STR;
+    case NEXT:
+      return NEXT_STR;
+    case NEXT_ATLOC:
+      return NEXT_ATLOC_STR;
     case RPLY:
       return RPLY_STR;
     case MISS:
       return MISS_STR;
+    case LEAVE:
+      return LEAVE_STR;
+    case SUCC:
+      return SUCC_STR;
+    case XFER:
+      return XFER_STR;
     default:
       std::cout << "Invalid NodeType: " << type << std::endl;
       exit(1);
@@ -1324,63 +3182,371 @@ void DhtNode::reportId() const {
   std::cout << "DhtNode ID: " << (int) id_ << std::endl;
 }
 
-DhtNode::DhtNode(uint8_t id) : 
+DhtNode::DhtNode(uint8_t id, const ImageStore& image_store) : 
   imageDb_(nullptr),
   imageClient_(nullptr),
+  imageClientAcceptsRle_(false),
+  imageReader_(nullptr),
+  imageStore_(image_store),
   servicingImageQuery_(false),
   id_(id),
-  hasTarget_(false) 
+  proximitySlackIds_(0),
+  lookupLatencyTotalUsec_(0),
+  numLookups_(0),
+  hedgeDelay_(0),
+  isHedgePending_(false),
+  numHedgedLookups_(0),
+  lookupAlpha_(0),
+  popularity_(POPULARITY_SKETCH_WIDTH, POPULARITY_SKETCH_DEPTH, POPULARITY_TOP_K),
+  lastPopularityDecay_(std::chrono::steady_clock::now()),
+  hasTarget_(false),
+  hasJoined_(false),
+  numFailedJoins_(0),
+  host_(nullptr),
+  nextVirtualJoin_(0),
+  localTransport_(nullptr),
+  localInboxFd_(-1),
+  listensToCli_(true),
+  isStopped_(false),
+  isRestored_(false),
+  hasFixedId_(true)
 {
   initImageReceiver();
   initDhtReceiver();
   initFingers();
   reportId();
-  imageDb_ = new ImageDb(id_);
+  imageDb_ = new ImageDb(id_, imageStore_, popularity_);
 }
 
-DhtNode::DhtNode() : 
+DhtNode::DhtNode(const ImageStore& image_store) : 
   imageDb_(nullptr),
   imageClient_(nullptr),
+  imageClientAcceptsRle_(false),
+  imageReader_(nullptr),
+  imageStore_(image_store),
   servicingImageQuery_(false),
-  hasTarget_(false)
+  proximitySlackIds_(0),
+  lookupLatencyTotalUsec_(0),
+  numLookups_(0),
+  hedgeDelay_(0),
+  isHedgePending_(false),
+  numHedgedLookups_(0),
+  lookupAlpha_(0),
+  popularity_(POPULARITY_SKETCH_WIDTH, POPULARITY_SKETCH_DEPTH, POPULARITY_TOP_K),
+  lastPopularityDecay_(std::chrono::steady_clock::now()),
+  hasTarget_(false),
+  hasJoined_(false),
+  numFailedJoins_(0),
+  host_(nullptr),
+  nextVirtualJoin_(0),
+  localTransport_(nullptr),
+  localInboxFd_(-1),
+  listensToCli_(true),
+  isStopped_(false),
+  isRestored_(false),
+  hasFixedId_(false)
 {
   initImageReceiver();
   initDhtReceiver();
   deriveId();
   initFingers();
   reportId();
-  imageDb_ = new ImageDb(id_);
+  imageDb_ = new ImageDb(id_, imageStore_, popularity_);
+}
+
+DhtNode::DhtNode(DhtNode* host) : 
+  imageDb_(nullptr),
+  imageClient_(nullptr),
+  imageClientAcceptsRle_(false),
+  imageReceiver_(nullptr),
+  imageReader_(nullptr),
+  imageStore_(host->imageStore_),
+  servicingImageQuery_(false),
+  proximitySlackIds_(0),
+  lookupLatencyTotalUsec_(0),
+  numLookups_(0),
+  hedgeDelay_(0),
+  isHedgePending_(false),
+  numHedgedLookups_(0),
+  lookupAlpha_(0),
+  popularity_(POPULARITY_SKETCH_WIDTH, POPULARITY_SKETCH_DEPTH, POPULARITY_TOP_K),
+  lastPopularityDecay_(std::chrono::steady_clock::now()),
+  hasTarget_(false),
+  hasJoined_(false),
+  numFailedJoins_(0),
+  host_(host),
+  nextVirtualJoin_(0),
+  localTransport_(nullptr),
+  localInboxFd_(-1),
+  listensToCli_(true),
+  isStopped_(false),
+  isRestored_(false),
+  hasFixedId_(false)
+{
+  initDhtReceiver();
+  deriveId();
+  initFingers();
+  reportId();
+  imageDb_ = new ImageDb(id_, imageStore_, popularity_);
 }
 
 void DhtNode::joinNetwork(const std::string& fqdn, uint16_t port) {
+  joinNetwork(std::vector<seed_t>{{fqdn, port}});
+}
+
+void DhtNode::joinNetwork(const std::vector<seed_t>& seeds) {
   // Fail b/c target should not have been specified before this
   assert(!hasTarget_);
 
-  // Set target node
+  // Fail b/c we need at least one seed
+  assert(!seeds.empty() && seeds.size() <= MAX_NUM_SEEDS);
+
+  // Set target nodes
   hasTarget_ = true;
-  targetFqdn_ = fqdn;
-  targetPort_ = port;
+  seeds_ = seeds;
+
+  // Head straight back to our old neighbors, if we were restored
+  for (const seed_t& snapshot_seed : snapshotSeeds_) {
+    bool is_known = false;
+    for (const seed_t& seed : seeds_) {
+      is_known = is_known || (seed.fqdn == snapshot_seed.fqdn && seed.port == snapshot_seed.port);
+    }
+
+    if (!is_known) {
+      seeds_.push_back(snapshot_seed);
+    }
+  }
 
-  // Attempt to join target
+  // Also try the node that was closest to us last time around
+  seed_t cached_seed;
+  if (hasRingCache() && findCachedEntryPoint(cached_seed)) {
+    bool is_known = false;
+    for (const seed_t& seed : seeds_) {
+      is_known = is_known || (seed.fqdn == cached_seed.fqdn && seed.port == cached_seed.port);
+    }
+
+    if (!is_known) {
+      // Report that we're using the cached entry point
+      std::cout << "\t- Adding entry point from ring cache: " << cached_seed.fqdn << ":"
+          << cached_seed.port << std::endl;
+
+      seeds_.push_back(cached_seed);
+    }
+  }
+
+  // Attempt to join targets
   sendJoinRequest();
 }
 
+void DhtNode::enableSnapshots(const std::string& path) {
+  // Fail b/c we can only restore our state before joining
+  assert(!hasTarget_);
+
+  snapshotPath_ = path;
+  lastSnapshot_ = std::chrono::steady_clock::now();
+  isRestored_ = restoreSnapshot();
+
+  // Make sure that our next run can reclaim our port
+  if (!isRestored_) {
+    rebindDhtReceiver(dhtReceiver_->getPort());
+  }
+}
+
+void DhtNode::enableHedging(size_t delay_msec) {
+  hedgeDelay_ = std::chrono::milliseconds(delay_msec);
+}
+
+void DhtNode::enableIterativeLookups(size_t alpha) {
+  lookupAlpha_ = alpha;
+}
+
+void DhtNode::enableProximityRouting(size_t slack_ids) {
+  // Fail b/c virtual nodes use their host's settings
+  assert(!host_);
+
+  proximitySlackIds_ = slack_ids;
+}
+
+void DhtNode::delayPeers(const std::vector<peer_delay_t>& delays) {
+  // Fail b/c virtual nodes use their host's settings
+  assert(!host_);
+
+  for (const peer_delay_t& delay : delays) {
+    peerDelays_[delay.id] = std::chrono::milliseconds(delay.delay_msec);
+  }
+}
+
+bool DhtNode::restoreSnapshot() {
+  std::ifstream snapshot(snapshotPath_);
+  if (snapshot.fail()) {
+    // Report that there's nothing to restore
+    std::cout << "\t- No snapshot at " << snapshotPath_ << ". Starting cold..." << std::endl;
+    return false;
+  }
+
+  // Validate header
+  std::string magic, node_token, fingers_token;
+  int version, id;
+  uint16_t port;
+  bool has_left;
+  size_t num_fingers;
+
+  if (!(snapshot >> magic >> version >> node_token >> id >> port >> has_left
+        >> fingers_token >> num_fingers)
+      || magic != "DHTDB_SNAPSHOT"
+      || version != SNAPSHOT_VERSION
+      || node_token != "node"
+      || id < 0 || id >= NUM_IDS
+      || fingers_token != "fingers"
+      || num_fingers != fingerTable_.size())
+  {
+    std::cout << "\t- Snapshot at " << snapshotPath_ << " is malformed. Starting cold..." << std::endl;
+    return false;
+  }
+
+  // An id we were given wins over the snapshot's
+  if (hasFixedId_ && id != id_) {
+    std::cout << "\t- Snapshot at " << snapshotPath_ << " is for id " << id 
+        << ", not our id " << (int) id_ << ". Starting cold..." << std::endl;
+    return false;
+  }
+
+  // Read fingers, predecessor last
+  std::vector<dhtnode_t> nodes;
+  for (size_t i = 0; i < num_fingers; ++i) {
+    int node_id;
+    std::string ipv4_str;
+    dhtnode_t node;
+
+    if (!(snapshot >> node_id >> ipv4_str >> node.port)
+        || node_id < 0 || node_id >= NUM_IDS
+        || inet_pton(AF_INET, ipv4_str.c_str(), &node.ipv4) != 1)
+    {
+      std::cout << "\t- Snapshot at " << snapshotPath_ << " has a malformed finger. Starting cold..." 
+          << std::endl;
+      return false;
+    }
+
+    node.id = static_cast<uint8_t>(node_id);
+    nodes.push_back(node);
+  }
+
+  // Our id is derived from our port, so we need the same one back
+  if (!rebindDhtReceiver(port)) {
+    std::cout << "\t- Port " << port << " from snapshot is taken. Starting cold..." << std::endl;
+    return false;
+  }
+
+  // Report that we're restoring our state
+  std::cout << "\t- Restoring node state from " << snapshotPath_ << "..." << std::endl;
+
+  id_ = static_cast<uint8_t>(id);
+  initFingers();
+  reportId();
+
+  // Our successor took our range when we left, so we have no predecessor
+  // until we're welcomed back
+  size_t num_restored = has_left ? PREDECESSOR_IDX : num_fingers;
+  for (size_t i = 0; i < num_restored; ++i) {
+    finger_t& finger = fingerTable_.at(i);
+    finger.node_id = nodes.at(i).id;
+    finger.remote
+        .setRemotePort(nodes.at(i).port)
+        .setRemoteIpv4Address(ntohl(nodes.at(i).ipv4));
+  }
+
+  rebuildRoutingTable();
+
+  // Reuse the db, unless it no longer matches the range we had or our
+  // images. The WLCM reconciles it w/ the range we're given back.
+  if (!imageDb_->restore(snapshot) 
+      || imageDb_->getStart() != nodes.at(PREDECESSOR_IDX).id 
+      || imageDb_->getEnd() != id_)
+  {
+    std::cout << "\t- Snapshot db is stale. Reloading it from the manifest..." << std::endl;
+    reloadDb();
+  }
+
+  // Our old neighbors are the quickest way back into the ring
+  snapshotSeeds_.clear();
+  for (size_t idx : {(size_t) SUCCESSOR_IDX, (size_t) PREDECESSOR_IDX}) {
+    const dhtnode_t& node = nodes.at(idx);
+    if (node.id != id_) {
+      snapshotSeeds_.push_back({stringifyIpv4(node.ipv4), node.port});
+    }
+  }
+
+  return true;
+}
+
+void DhtNode::writeSnapshot(bool has_left) {
+  lastSnapshot_ = std::chrono::steady_clock::now();
+
+  // Write to a temporary file first, so that a crash mid-write
+  // never leaves a partial snapshot behind
+  const std::string tmp_path = snapshotPath_ + ".tmp";
+  std::ofstream snapshot(tmp_path);
+
+  snapshot << "DHTDB_SNAPSHOT " << SNAPSHOT_VERSION << "\n";
+  snapshot << "node " << (int) id_ << " " << dhtReceiver_->getPort() << " " << has_left << "\n";
+  snapshot << "fingers " << fingerTable_.size() << "\n";
+
+  for (const finger_t& finger : fingerTable_) {
+    snapshot << (int) finger.node_id << " " 
+        << stringifyIpv4(htonl(finger.remote.getRemoteIpv4Address())) << " "
+        << finger.remote.getRemotePort() << "\n";
+  }
+
+  imageDb_->save(snapshot);
+  snapshot.close();
+
+  if (snapshot.fail()) {
+    std::cout << "\t- Failed to write snapshot to " << snapshotPath_ << std::endl;
+    std::remove(tmp_path.c_str());
+    return;
+  }
+
+  std::rename(tmp_path.c_str(), snapshotPath_.c_str());
+}
+
+void DhtNode::disableCli() {
+  listensToCli_ = false;
+}
+
+void DhtNode::setJoinedCallback(std::function<void()> callback) {
+  joinedCallback_ = callback;
+}
+
+const std::string& DhtNode::getDomainName() const {
+  return dhtReceiver_->getDomainName();
+}
+
+uint16_t DhtNode::getPort() const {
+  return dhtReceiver_->getPort();
+}
+
+void DhtNode::stop() {
+  isStopped_ = true;
+}
+
 void DhtNode::run() {
   Selector selector;
   
   // Listen on stdin for keyboard input
-  selector.bind(
-      STDIN_FILENO,
-      [&] (int sd) -> bool {
-        bool should_continue = handleCliInput(); 
-        if (should_continue) {
-          // Report that we're waiting for traffic
-          std::cout << "\nWaiting for dht/netimg network traffic or cli input..." << std::endl;
-        }
+  if (listensToCli_) {
+    selector.bind(
+        STDIN_FILENO,
+        [&] (int sd) -> bool {
+          bool should_continue = handleCliInput(); 
+          if (should_continue) {
+            // Report that we're waiting for traffic
+            std::cout << "\nWaiting for dht/netimg network traffic or cli input..." << std::endl;
+          }
 
-        return should_continue;
-      }
-  );
+          return should_continue;
+        }
+    );
+  }
   
   // Listen on 'image receiver' socket for image trafic 
   selector.bind(
@@ -1393,38 +3559,195 @@ void DhtNode::run() {
       }
   );
 
+  // Send images to their clients once they've been read
+  selector.bind(
+      imageReader_->getFd(),
+      [&] (int sd) -> bool {
+        for (const ImageReader::read_t& read : imageReader_->takeFinished()) {
+          sendImage(read);
+        }
+
+        std::cout << "\nWaiting for dht/netimg network traffic or cli input..." << std::endl;
+        return true;
+      }
+  );
+
+  // Virtual nodes join through us, so start now if we're the first node
+  if (!hasTarget_) {
+    // We're starting a new ring, so the restored one doesn't apply
+    if (isRestored_) {
+      std::cout << "\t- No target to rejoin through. Dropping restored fingers..." << std::endl;
+      initFingers();
+      reloadDb();
+    }
+
+    joinNextVirtualNode();
+  }
+
   // Report that we're waiting for traffic
   std::cout << "\nWaiting for dht/netimg network traffic or cli input..." << std::endl;
   
-  bool should_continue = true;
+  std::vector<DhtNode*> nodes(virtualNodes_);
+  nodes.push_back(this);
 
-  do {
-    int receiver_fd = dhtReceiver_->getFd();
+  // Get the images ready to send before anyone asks for them
+  for (DhtNode* node : nodes) {
+    node->encodeImages();
+  }
 
-    // Listen on 'dht receiver' socket for dht traffic
+  // Pick up new and deleted images w/o waiting for a range reload
+  CatalogWatcher catalog_watcher(imageStore_.getRoots(), IMAGE_MANIFEST_FILE_NAME);
+  if (catalog_watcher.getFd() != -1) {
     selector.bind(
-        receiver_fd,
+        catalog_watcher.getFd(),
         [&] (int sd) -> bool {
-          handleDhtTraffic();               
-    
-          // Report that we're waiting for traffic
+          std::vector<CatalogWatcher::change_t> changes = catalog_watcher.readChanges();
+
+          // Report that the image folder changed
+          std::cout << "\nImage folder changed (" << changes.size() << " change(s))" << std::endl;
+
+          for (DhtNode* node : nodes) {
+            node->encodeImages(node->imageDb_->applyCatalogChanges(changes));
+          }
+
           std::cout << "\nWaiting for dht/netimg network traffic or cli input..." << std::endl;
           return true;
         }
     );
+  }
+
+  bool should_continue = true;
+
+  do {
+    std::vector<int> receiver_fds;
+
+    // Listen on every virtual node's 'dht receiver' socket for dht traffic
+    for (DhtNode* node : nodes) {
+      int receiver_fd = node->dhtReceiver_->getFd();
+      receiver_fds.push_back(receiver_fd);
 
-    should_continue = selector.listen();
+      selector.bind(
+          receiver_fd,
+          [node] (int sd) -> bool {
+            node->handleDhtTraffic();               
+      
+            // Report that we're waiting for traffic
+            std::cout << "\nWaiting for dht/netimg network traffic or cli input..." << std::endl;
+            return true;
+          }
+      );
+    }
+
+    // Listen for traffic from the other shards of this process
+    for (DhtNode* node : nodes) {
+      if (node->localInboxFd_ == -1) {
+        continue;
+      }
+
+      receiver_fds.push_back(node->localInboxFd_);
+      selector.bind(
+          node->localInboxFd_,
+          [node] (int sd) -> bool {
+            node->handleLocalDhtTraffic();
+
+            // Report that we're waiting for traffic
+            std::cout << "\nWaiting for dht/netimg network traffic or cli input..." << std::endl;
+            return true;
+          }
+      );
+    }
+
+    // Listen for answers to the iterative lookup's probes
+    std::vector<int> probe_fds;
+    for (const probe_t& probe : probes_) {
+      int probe_fd = probe.cxn.getFd();
+      probe_fds.push_back(probe_fd);
+
+      selector.bind(
+          probe_fd,
+          [this] (int sd) -> bool {
+            handleProbeReply(sd);
+            return true;
+          }
+      );
+    }
+
+    should_continue = selector.listen(0, computeListenTimeout());
+
+    // No seed can get us into the network, so there's nothing to serve
+    for (DhtNode* node : nodes) {
+      if (node->haveJoinsFailed()) {
+        std::cout << "Failed while writing data to every target!" << std::endl;
+        should_continue = false;
+        break;
+      }
+    }
+
+    // Send more probes, now that we've heard back from some of them
+    advanceIterativeLookup();
+
+    // Send the image query down another path if it's taking too long
+    if (isHedgePending_ && servicingImageQuery_
+        && std::chrono::steady_clock::now() >= hedgeDeadline_)
+    {
+      sendHedge();
+    }
+
+    // Keep the snapshot fresh in case we don't get to shut down cleanly
+    if (!snapshotPath_.empty() && std::chrono::steady_clock::now() - lastSnapshot_ 
+        >= std::chrono::seconds(SNAPSHOT_INTERVAL_SECS))
+    {
+      writeSnapshot(false);
+    }
  
-    // Unset callback b/c the receiver's socket 'fd' might have changed
-    selector.erase(receiver_fd);
+    // Unset callbacks b/c the receivers' socket 'fd' might have changed
+    for (int receiver_fd : receiver_fds) {
+      selector.erase(receiver_fd);
+    }
+
+    for (int probe_fd : probe_fds) {
+      selector.erase(probe_fd);
+    }
 
-  } while (should_continue);
+  } while (should_continue && !isStopped_);
 }
 
 void DhtNode::close() {
+  // Tear down the virtual nodes we're hosting. Remove each one before it
+  // leaves so that nobody hands a range back to it.
+  while (!virtualNodes_.empty()) {
+    DhtNode* vnode = virtualNodes_.back();
+    virtualNodes_.pop_back();
+
+    vnode->close();
+    delete vnode;
+  }
+
+  awaitJoinRequests();
+
+  // Remember the ring for next time, then hand our range off 
+  // before the sockets go away
+  if (hasRingCache()) {
+    writeRingCache();
+  }
+
+  leaveNetwork();
+
+  if (!snapshotPath_.empty()) {
+    writeSnapshot(true);
+  }
+
+  // Other shards fall back to TCP, and find nobody listening
+  if (localInboxFd_ != -1) {
+    getHost()->localTransport_->closeInbox(localInboxFd_);
+    localInboxFd_ = -1;
+  }
+
   try {
     dhtReceiver_->close();
-    imageReceiver_->close();
+    if (imageReceiver_) {
+      imageReceiver_->close();
+    }
   } catch (const SocketException& e) {
     std::cout << "Failed to close DhtNode!" << std::endl;
     exit(1);
@@ -1432,4 +3755,5 @@ void DhtNode::close() {
 
   delete dhtReceiver_;
   delete imageReceiver_;
+  delete imageReader_;
 }
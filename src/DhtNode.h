@@ -2,6 +2,11 @@
 
 #include <iostream>
 #include <vector>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <chrono>
+#include <unordered_map>
 
 #include "SocketException.h"
 #include "ServiceBuilder.h"
@@ -12,8 +17,11 @@
 #include "Selector.h"
 #include "dht_packets.h"
 #include "ImageDb.h"
+#include "ImageKey.h"
+#include "CountMinSketch.h"
 #include "netimg_packets.h"
-#include "ltga.h"
+#include "ImageReader.h"
+#include "LocalTransport.h"
 
 #define FINGER_TABLE_SIZE 8
 #define SUCCESSOR_IDX 0
@@ -22,6 +30,38 @@
 #define NUM_IDS 0x100 // 2^FINGER_TABLE_SIZE
 #define SIZE_OF_ADDR_PORT 6
 
+#define OWNER_CACHE_SIZE 16
+
+#define MAX_VIRTUAL_NODES 16
+
+#define POPULARITY_SKETCH_WIDTH 1024
+#define POPULARITY_SKETCH_DEPTH 4
+#define POPULARITY_TOP_K 8
+#define POPULARITY_DECAY_SECS 60  // request counts are halved this often
+
+#define HOT_IMAGE_THRESHOLD 4     // requests for an image before we pull it along the path
+#define MAX_PENDING_PREFETCHES 16
+
+#define MAX_HANDOFF_IMAGES UINT16_MAX // images that fit in an XFER or LEAVE stream
+
+#define SELECT_TIMEOUT_USEC 100000 // 100 ms
+
+#define MAX_NUM_SEEDS 8
+#define RING_CACHE_PATH "ring.cache"  // suffixed w/ the node's id
+
+#define RTT_EWMA_WEIGHT 0.125      // weight of a new sample, as in TCP's SRTT
+#define RTT_REBUILD_THRESHOLD 0.25 // relative change that triggers a rebuild
+#define PROXIMITY_RTT_RATIO 0.5    // nearer finger must have at most this RTT ratio
+
+#define MAX_NUM_HEDGES 2 // extra copies of a search we'll send per query
+
+#define PROBE_TIMEOUT_MSEC 500 // time an iterative lookup waits on a single hop
+
+#define MAX_INGRESS_BATCH 16 // netimg queries we'll accept and look up together
+
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_INTERVAL_SECS 30
+
 // DhtType Strings
 #define JOIN_STR "JOIN"
 #define JOIN_ATLOC_STR "JOIN_ATLOC"
@@ -32,6 +72,30 @@
 #define SRCH_ATLOC_STR "SRCH_ATLOC"
 #define RPLY_STR "RPLY"
 #define MISS_STR "MISS"
+#define LEAVE_STR "LEAVE"
+#define SUCC_STR "SUCC"
+#define XFER_STR "XFER"
+#define ISRCH_STR "ISRCH"
+#define ISRCH_ATLOC_STR "ISRCH_ATLOC"
+#define NEXT_STR "NEXT"
+#define NEXT_ATLOC_STR "NEXT_ATLOC"
+
+/**
+ * Address of a node that we can join the network through.
+ */
+struct seed_t {
+  std::string fqdn;
+  uint16_t port;  // host-byte-order
+};
+
+/**
+ * Artificial delay added to every connection to a node, to emulate one
+ * that's far away.
+ */
+struct peer_delay_t {
+  uint8_t id;
+  size_t delay_msec;
+};
 
 class DhtNode {
 
@@ -45,12 +109,29 @@ class DhtNode {
      * Connection to the netimg client that we're proxying.
      */
     const Connection * imageClient_;
+
+    /**
+     * Specifies whether the netimg client that we're proxying can decode
+     * run-length encoded pixels.
+     */
+    bool imageClientAcceptsRle_;
     
     /**
      * Socket for receiving dht and image traffic.
      */
     const Service * dhtReceiver_, * imageReceiver_; 
 
+    /**
+     * Reads images off the event loop for netimg clients. Null for
+     * virtual nodes, which have no clients of their own.
+     */
+    ImageReader* imageReader_;
+
+    /**
+     * Where the images live. Shared w/our virtual nodes.
+     */
+    ImageStore imageStore_;
+
     /**
      * Specifies whether or not we're currently servicing and image query.
      */
@@ -75,14 +156,144 @@ class DhtNode {
     std::vector<finger_t> fingerTable_;
 
     /**
-     * FQDN of target, if specified.
+     * Routing decision for an object id -- the finger to forward to and
+     * whether we expect that finger to own the object.
+     */
+    struct route_t {
+      uint8_t finger_idx;
+      bool atloc;
+    };
+
+    /**
+     * Routing table indexed by object id. Rebuilt from the finger table
+     * whenever the finger table changes, so that forwarding a message
+     * costs a single lookup.
+     */
+    route_t routingTable_[NUM_IDS];
+
+    /**
+     * Smoothed connect round-trip time (usec) to each node we've
+     * contacted, keyed by address. Ranks ring cache entries and, w/
+     * proximity routing, picks between fingers.
+     */
+    std::unordered_map<uint64_t, double> rttEwmaUsec_;
+
+    /**
+     * Ids of progress that we'll give up to route through a much nearer
+     * finger. Zero routes by progress alone. Only set on the host.
+     */
+    size_t proximitySlackIds_;
+
+    /**
+     * Artificial delay added to connections to each node, by id. Only
+     * set on the host.
+     */
+    std::unordered_map<uint8_t, std::chrono::milliseconds> peerDelays_;
+
+    /**
+     * Time at which we forwarded the image query we're servicing.
+     */
+    std::chrono::steady_clock::time_point queryStart_;
+
+    /**
+     * Sum of lookup latencies (usec) and number of lookups, for
+     * reporting the average.
+     */
+    uint64_t lookupLatencyTotalUsec_;
+    uint64_t numLookups_;
+
+    /**
+     * Time we'll wait on a RPLY before sending the search down another
+     * finger. Zero disables hedging.
+     */
+    std::chrono::milliseconds hedgeDelay_;
+
+    /**
+     * Search we're waiting on a reply for, the time at which we'll hedge it
+     * and the nodes we've already sent it to.
+     */
+    dhtsrch_t pendingSrch_;
+    std::chrono::steady_clock::time_point hedgeDeadline_;
+    std::vector<uint8_t> hedgedNodeIds_;
+    bool isHedgePending_;
+
+    /**
+     * Number of lookups that we had to hedge.
      */
-    std::string targetFqdn_;
+    uint64_t numHedgedLookups_;
 
     /**
-     * Port of target, if specified. Host-byte-order.
+     * Number of probes an iterative lookup keeps in flight. Zero
+     * selects recursive lookups.
      */
-    uint16_t targetPort_;
+    size_t lookupAlpha_;
+
+    /**
+     * Node that an iterative lookup may probe next. 'atloc' is set if
+     * we expect the node to own the image.
+     */
+    struct lookup_candidate_t {
+      finger_t node;
+      bool atloc;
+    };
+
+    /**
+     * ISRCH that's awaiting an answer on 'cxn'.
+     */
+    struct probe_t {
+      Connection cxn;
+      finger_t node;
+      std::chrono::steady_clock::time_point sent;
+    };
+
+    /**
+     * State of the iterative lookup we're servicing: nodes we've heard of
+     * but not probed, probes in flight, and nodes we've already probed.
+     */
+    std::vector<lookup_candidate_t> lookupCandidates_;
+    std::vector<probe_t> probes_;
+    std::vector<uint8_t> probedNodeIds_;
+
+    /**
+     * Owner cache entry -- a remote node that we've learned owns
+     * the object ids in (range_start, node.node_id].
+     */
+    struct owner_t {
+      finger_t node;
+      uint8_t range_start;  // exclusive
+    };
+
+    /**
+     * Bounded cache of known image owners, most recently used first.
+     * Filled from RPLY/MISS senders and invalidated on REDRT.
+     */
+    std::vector<owner_t> ownerCache_;
+
+    /**
+     * Request frequency of each image that we've seen queried, either by
+     * a netimg client or by the DHT. Halved every POPULARITY_DECAY_SECS so
+     * that only recently hot images stand out. Shared w/ the image cache.
+     */
+    CountMinSketch popularity_;
+    std::chrono::steady_clock::time_point lastPopularityDecay_;
+
+    /**
+     * Image handed to another node, w/ our request count for it.
+     */
+    struct handoff_t {
+      ImageKey key;
+      uint32_t count;
+    };
+
+    /**
+     * Hot images that we've searched for on our own behalf, oldest first.
+     */
+    std::vector<std::string> pendingPrefetches_;
+
+    /**
+     * Nodes to send join requests to, if specified.
+     */
+    std::vector<seed_t> seeds_;
 
     /**
      * Indicates whether or not a target has been specified.
@@ -90,6 +301,185 @@ class DhtNode {
      */
     bool hasTarget_;
 
+    /**
+     * Indicates whether or not we've been welcomed into the network.
+     */
+    bool hasJoined_;
+
+    /**
+     * Threads sending join requests to the seeds in parallel.
+     */
+    std::vector<std::thread> joinThreads_;
+
+    /**
+     * Number of seeds that we failed to send a join request to.
+     */
+    std::atomic<size_t> numFailedJoins_;
+
+    /**
+     * Node hosting this virtual node, or nullptr if we're the host.
+     */
+    DhtNode* host_;
+
+    /**
+     * Additional virtual nodes hosted by this process. Only populated
+     * on the host. They share our event loop and image receiver.
+     */
+    std::vector<DhtNode*> virtualNodes_;
+
+    /**
+     * Index of the next virtual node to join the network. Virtual nodes
+     * join one at a time, each after the previous one was welcomed.
+     */
+    size_t nextVirtualJoin_;
+
+    /**
+     * Connects us to the other shards of this process w/o going through
+     * TCP, or nullptr if we're the only one. Only set on the host.
+     */
+    LocalTransport* localTransport_;
+
+    /**
+     * Fd of our inbox in the local transport, or -1 if we have none.
+     */
+    int localInboxFd_;
+
+    /**
+     * Specifies whether or not this node reads commands from stdin.
+     */
+    bool listensToCli_;
+
+    /**
+     * Set from another thread to make run() return.
+     */
+    std::atomic<bool> isStopped_;
+
+    /**
+     * Invoked once this node and all of its virtual nodes have
+     * joined the network.
+     */
+    std::function<void()> joinedCallback_;
+
+    /**
+     * Path of our node-state snapshot. Empty if snapshots are disabled.
+     */
+    std::string snapshotPath_;
+
+    /**
+     * Time at which we last wrote the snapshot.
+     */
+    std::chrono::steady_clock::time_point lastSnapshot_;
+
+    /**
+     * Indicates whether or not our state was restored from a snapshot.
+     */
+    bool isRestored_;
+
+    /**
+     * Indicates whether or not our id was provided, rather than derived
+     * from our address. Only then does it survive a restart.
+     */
+    bool hasFixedId_;
+
+    /**
+     * Successor and predecessor recorded in the snapshot. They're the
+     * quickest way back into our old spot on the ring.
+     */
+    std::vector<seed_t> snapshotSeeds_;
+
+    /**
+     * rebindDhtReceiver()
+     * - Replace the dht receiver with one listening on the provided port
+     *   that allows address reuse.
+     * @param port : port to listen on (host-byte-order)
+     * @return true iff the port could be bound
+     */
+    bool rebindDhtReceiver(uint16_t port);
+
+    /**
+     * restoreSnapshot()
+     * - Validate the snapshot and restore our port, id, fingers and image
+     *   db from it. The db is reloaded from the manifest if it doesn't
+     *   validate on its own. A snapshot taken after we left the ring
+     *   leaves us w/o a predecessor, as our range was handed off. Ignored
+     *   if it's for a different id than the one we were given.
+     * @return true iff our state was restored
+     */
+    bool restoreSnapshot();
+
+    /**
+     * writeSnapshot()
+     * - Save our port, id, fingers and image db to the snapshot file.
+     * @param has_left : true iff we've handed our range off and left
+     */
+    void writeSnapshot(bool has_left);
+
+    /**
+     * DhtNode()
+     * - Create virtual node hosted by the provided node. Virtual nodes
+     *   listen for dht traffic only; image traffic goes to the host.
+     * @param host : node hosting this virtual node
+     */
+    explicit DhtNode(DhtNode* host);
+
+    /**
+     * getHost()
+     * - Return the node hosting this process' virtual nodes.
+     */
+    DhtNode* getHost();
+    const DhtNode* getHost() const;
+
+    /**
+     * joinNextVirtualNode()
+     * - Have the next virtual node join the network through the host.
+     */
+    void joinNextVirtualNode();
+
+    /**
+     * findLocalNode()
+     * - Find the virtual node in this process that the finger points to.
+     * @param finger : finger to look up
+     * @return local node, or nullptr if the finger is remote
+     */
+    DhtNode* findLocalNode(const finger_t& finger);
+
+    /**
+     * resolveLocalRedrt()
+     * - Messages to a node in this process can't wait for a REDRT because
+     *   that node shares our thread. Check its purview directly instead.
+     * @param local : node in this process we're about to forward to
+     * @param object_id : id of object we expect 'local' to own
+     * @param redrt_pkt : set to the REDRT 'local' would send
+     * @return true iff 'local' would redirect us
+     */
+    bool resolveLocalRedrt(
+        const DhtNode& local,
+        uint8_t object_id,
+        dhtmsg_t& redrt_pkt) const;
+
+    /**
+     * queryLocalNodes()
+     * - Query the image dbs of every virtual node in this process.
+     * @param key : key of image
+     * @return true iff one of the dbs has the image
+     */
+    bool queryLocalNodes(const ImageKey& key) const;
+
+    /**
+     * inLocalPurview()
+     * - Test if the id of the object falls in the range of any virtual
+     *   node in this process.
+     * @param id : id of object 
+     */
+    bool inLocalPurview(uint8_t id) const;
+
+    /**
+     * reportLoad()
+     * - Print the arc of the identifier ring and number of images held
+     *   by each virtual node in this process.
+     */
+    void reportLoad() const;
+
     /**
      * initFingers()
      * - Construct and set finger table based on the node's current id.
@@ -103,6 +493,13 @@ class DhtNode {
      */
     void initDhtReceiver();
 
+    /**
+     * updateLocalInbox()
+     * - Accept local connections to our current dht address, if the
+     *   host has a local transport.
+     */
+    void updateLocalInbox();
+
     /**
      * initImageReceiver()
      * - Construct and set listening socket for monitoring image traffic.
@@ -135,21 +532,53 @@ class DhtNode {
      */
     void handleDhtTraffic();
 
+    /**
+     * handleLocalDhtTraffic()
+     * - Process a request from another shard of this process.
+     */
+    void handleLocalDhtTraffic();
+
+    /**
+     * handleDhtConnection()
+     * - Read a dht message off of the connection and process it.
+     * @param connection : connection to requesting node
+     */
+    void handleDhtConnection(const Connection& connection);
+
     /**
      * handleCliInput()
      * - Read cli input from stdin and process request.
      * - EOF | q | Q -> quit node
      * - p -> print node's successor/predecessor IDs and flush input
+     * - l -> print per-virtual-node arc lengths and image counts
      * @return true iff node should continue to listen 
      */
     bool handleCliInput();
 
     /**
      * handleImageTraffic()
-     * - Read data from image socket and process it.
+     * - Accept every waiting netimg client, up to MAX_INGRESS_BATCH, and
+     *   look up their images as one batch.
      */
     void handleImageTraffic();
 
+    /**
+     * handleImageQuery()
+     * - Answer one netimg query from the batch. Local hits are streamed
+     *   right away; anything else is looked up in the DHT, unless we're
+     *   already servicing a query.
+     * @param cxn : connection to netimg client (we take ownership)
+     * @param key : key of requested image
+     * @param result : result of querying our db for the image
+     * @param accepts_rle : true iff the client can decode run-length
+     *                      encoded pixels
+     */
+    void handleImageQuery(
+        const Connection* cxn,
+        const ImageKey& key,
+        QueryResult result,
+        bool accepts_rle);
+
     /**
      * handleLocalQuerySuccess()
      * - Found image in local db. Stream down to client.
@@ -157,6 +586,42 @@ class DhtNode {
      */
     void handleLocalQuerySuccess(const std::string& file_name);
 
+    /**
+     * streamImage()
+     * - Read image w/o blocking the event loop, then send it to netimg
+     *   client. Takes ownership of the connection.
+     * @param cxn : connection to netimg client
+     * @param file_name : name of image file
+     * @param accepts_rle : true iff the client can decode run-length
+     *                      encoded pixels
+     */
+    void streamImage(
+        const Connection* cxn,
+        const std::string& file_name,
+        bool accepts_rle) const;
+
+    /**
+     * sendImage()
+     * - Send image that's been read to netimg client, then close and free
+     *   the connection.
+     * @param read : finished image read
+     */
+    void sendImage(const ImageReader::read_t& read) const;
+
+    /**
+     * encodeImages()
+     * - Have the images in our range encoded for the wire in the
+     *   background, so that they're sent w/o being converted.
+     */
+    void encodeImages() const;
+
+    /**
+     * encodeImages()
+     * - Have the given images encoded for the wire in the background.
+     * @param images : keys of images in our range
+     */
+    void encodeImages(const std::vector<ImageKey>& images) const;
+
     /**
      * reportCliInstructions()
      * - Print instructions for controlling dht node from cli.
@@ -259,11 +724,24 @@ class DhtNode {
     void handleRemoteImageQuerySuccess(const dhtsrch_t& srch_pkt);
 
     /**
-     * handleReid()
+     * handleReidAndCloseCxn()
      * - An ID collision has occurred and we, the newly joining node,
-     *   have been instructed to generate a new ID and reconnect.
+     *   have been instructed to pick a new ID and reconnect. Adopt the
+     *   free id provided by the sender, if any. Otherwise, generate a
+     *   new ID from a new dht socket.
+     * @param msg : packet from the network (network-byte-order)
+     * @param connection : connection to node that detected the collision
+     */
+    void handleReidAndCloseCxn(const dhtmsg_t& msg, const Connection& connection);
+
+    /**
+     * findFreeId()
+     * - Pick an unused id in our range, halfway between our predecessor
+     *   and us.
+     * @param free_id : set to the free id, if found
+     * @return true iff there is an unused id in our range
      */
-    void handleReid();
+    bool findFreeId(uint8_t& free_id) const;
     
     /**
      * handleSrchAndCloseCxn()
@@ -275,6 +753,18 @@ class DhtNode {
      */
     void handleSrchAndCloseCxn(const dhtmsg_t& msg, const Connection& connection);
 
+    /**
+     * handleIsrchAndCloseCxn()
+     * - Read the remainder of the dhtsrch_t packet and answer on the same
+     *   connection: RPLY if we have the image, MISS if it's in our purview,
+     *   NEXT with our next hop towards the image otherwise. If the proxy
+     *   expected us to own the image, point it at our predecessor instead,
+     *   as with REDRT.
+     * @param msg : packet from the network (network-byte-order)
+     * @param connection : connection to the probing proxy
+     */
+    void handleIsrchAndCloseCxn(const dhtmsg_t& msg, const Connection& connection);
+
     /**
      * handleRplyAndCloseCxn()
      * - Read the remainder of the dhtsrch_t packet off of the wire and then
@@ -302,6 +792,144 @@ class DhtNode {
      */
     void handleWlcmAndCloseCxn(const dhtmsg_t& msg, const Connection& connection);
 
+    /**
+     * handleXferAndCloseCxn()
+     * - Read the rest of the dhtxfer_t packet and the images that follow
+     *   it off of the wire, then add any we don't have to our db.
+     * @param msg : packet from the network (network-byte-order)
+     * @param connection : connection to accepting node
+     */
+    void handleXferAndCloseCxn(const dhtmsg_t& msg, const Connection& connection);
+
+    /**
+     * absorbXfer()
+     * - Cache the transferred images that we don't have, skipping the
+     *   admission check, and take on their request counts.
+     * @param sender_id : id of accepting node
+     * @param images : images in our new range, most requested first
+     */
+    void absorbXfer(uint8_t sender_id, const std::vector<handoff_t>& images);
+
+    /**
+     * sendXfer()
+     * - Stream the images in the joining node's new range to it. Hand them
+     *   over directly if it's a virtual node in this process.
+     * @param join_msg : join request
+     * @param images : keys of images in the joining node's range
+     */
+    void sendXfer(const dhtmsg_t& join_msg, const std::vector<ImageKey>& images);
+
+    /**
+     * prepareHandoff()
+     * - Attach our request count to each image, most requested first, and
+     *   drop the least requested ones that don't fit in a single stream.
+     * @param images : keys of images to hand off
+     */
+    std::vector<handoff_t> prepareHandoff(const std::vector<ImageKey>& images) const;
+
+    /**
+     * absorbHandoff()
+     * - Take on the request counts of the handed off images and cache the
+     *   ones we don't have, skipping the admission check.
+     * @param images : handed off images, most requested first
+     * @return number of images that were new to us
+     */
+    size_t absorbHandoff(const std::vector<handoff_t>& images);
+
+    /**
+     * handleLeaveAndCloseCxn()
+     * - Read the rest of the dhtleave_t packet and the cached images that
+     *   follow it off of the wire, then take over the leaving node's range.
+     * @param msg : packet from the network (network-byte-order)
+     * @param connection : connection to leaving node
+     */
+    void handleLeaveAndCloseCxn(const dhtmsg_t& msg, const Connection& connection);
+
+    /**
+     * handleSuccAndCloseCxn()
+     * - Read the rest of the dhtleave_t packet off of the wire and make
+     *   the leaving node's successor our successor.
+     * @param msg : packet from the network (network-byte-order)
+     * @param connection : connection to leaving node
+     */
+    void handleSuccAndCloseCxn(const dhtmsg_t& msg, const Connection& connection);
+
+    /**
+     * leaveNetwork()
+     * - Hand our range and cached images to our successor, and our successor
+     *   to our predecessor, so that the ring stays intact without us.
+     */
+    void leaveNetwork();
+
+    /**
+     * sendLeavePacket()
+     * - Send a LEAVE or SUCC packet, followed by the provided images.
+     * @param target : node to send the packet to
+     * @param leave_pkt : packet to send (network-byte-order)
+     * @param images : cached images to stream after the packet
+     */
+    void sendLeavePacket(
+        const finger_t& target,
+        const dhtleave_t& leave_pkt,
+        const std::vector<handoff_t>& images) const;
+
+    /**
+     * sendImageStream()
+     * - Send the header, followed by a dhthandoff_t for each image, over
+     *   a single connection.
+     * @param remote_builder : node to send the stream to
+     * @param header : serialized packet preceding the images
+     * @param images : images to stream
+     * @return true iff the stream was sent
+     */
+    bool sendImageStream(
+        const ServerBuilder& remote_builder,
+        const std::string& header,
+        const std::vector<handoff_t>& images) const;
+
+    /**
+     * readImageStream()
+     * - Read the provided number of dhthandoff_t off of the wire.
+     * @param connection : connection to read from
+     * @param num_imgs : number of images to read (host-byte-order)
+     * @return images read
+     */
+    std::vector<handoff_t> readImageStream(
+        const Connection& connection,
+        uint16_t num_imgs) const;
+
+    /**
+     * absorbLeavingNode()
+     * - Our predecessor is leaving. Take over its range and cached images.
+     *   Pass the request towards our predecessor if the leaving node
+     *   precedes it.
+     * @param pred : predecessor of leaving node (network-byte-order)
+     * @param leaving : node leaving the ring (network-byte-order)
+     * @param images : images cached by the leaving node, most requested first
+     */
+    void absorbLeavingNode(
+        const dhtnode_t& pred,
+        const dhtnode_t& leaving,
+        const std::vector<handoff_t>& images);
+
+    /**
+     * bypassLeavingNode()
+     * - Our successor is leaving. Point every finger that referenced it
+     *   at its successor.
+     * @param succ : successor of leaving node (network-byte-order)
+     * @param leaving : node leaving the ring (network-byte-order)
+     */
+    void bypassLeavingNode(const dhtnode_t& succ, const dhtnode_t& leaving);
+
+    /**
+     * replaceFingers()
+     * - Replace every finger (excluding the predecessor) that points to
+     *   the old node with the new one.
+     * @param old_node : node to replace (network-byte-order)
+     * @param new_node : replacement node (network-byte-order)
+     */
+    void replaceFingers(const dhtnode_t& old_node, const dhtnode_t& new_node);
+
     /**
      * doesJoinCollide()
      * - Test if the id of the joining node collides with the
@@ -369,10 +997,83 @@ class DhtNode {
 
     /**
      * sendJoinRequest()
-     * - Send request to target for join.
+     * - Send request for join to every seed in parallel. The first
+     *   WLCM wins.
      */
     void sendJoinRequest();
 
+    /**
+     * sendJoinRequestToSeed()
+     * - Send serialized join request to a single seed. Runs on its own
+     *   thread. Counts the seeds that were unreachable.
+     * @param message : serialized join packet
+     * @param seed : node to send the join to
+     */
+    void sendJoinRequestToSeed(const std::string& message, const seed_t& seed);
+
+    /**
+     * haveJoinsFailed()
+     * - Return true iff we're still waiting to join, but every seed was
+     *   unreachable.
+     */
+    bool haveJoinsFailed() const;
+
+    /**
+     * awaitJoinRequests()
+     * - Wait for outstanding join requests to be sent.
+     */
+    void awaitJoinRequests();
+
+    /**
+     * assembleJoinRequest()
+     * - Serialize a join packet for our current id and report it.
+     * @param remote_str : human-readable address of the receiver
+     * @return serialized join packet
+     */
+    std::string assembleJoinRequest(const std::string& remote_str) const;
+
+    /**
+     * getRingCachePath()
+     * - Return the path of our ring cache. Each node has its own, keyed
+     *   by its id, so that nodes sharing a folder don't overwrite each
+     *   other's.
+     */
+    std::string getRingCachePath() const;
+
+    /**
+     * hasRingCache()
+     * - Return true iff we keep a ring cache. Only nodes whose id
+     *   survives a restart come back to one.
+     */
+    bool hasRingCache() const;
+
+    /**
+     * findCachedEntryPoint()
+     * - Look up the node from the last run's ring membership that
+     *   answered us fastest. If we never timed any, take the one that
+     *   follows our id most closely, as it likely owns our id.
+     * @param seed : set to the closest node, if found
+     * @return true iff a node was found
+     */
+    bool findCachedEntryPoint(seed_t& seed) const;
+
+    /**
+     * writeRingCache()
+     * - Save every node we know of and its measured rtt, so that the
+     *   next run can join through the closest one.
+     */
+    void writeRingCache() const;
+
+    /**
+     * sendJoinRequest()
+     * - Send request for join to the provided node.
+     * @param remote_builder : node to send the join to
+     * @param remote_str : human-readable address of the node
+     */
+    void sendJoinRequest(
+        const ServerBuilder& remote_builder,
+        const std::string& remote_str);
+
     /**
      * getPredecessor()
      * - Return reference to predecessor finger. Here to allow const reads.
@@ -381,14 +1082,133 @@ class DhtNode {
     const finger_t& getPredecessor() const;
 
     /**
-     * findFingerForForwarding()
-     * - Find the finger to forward the request to.
+     * rebuildRoutingTable()
+     * - Recompute the routing decision for every object id from the
+     *   current finger table.
+     */
+    void rebuildRoutingTable();
+
+    /**
+     * connectToNode()
+     * - Connect to the provided node, recording the time it took to
+     *   connect as a round-trip time sample.
+     * @param node : node to connect to
+     * @return connection to node
+     */
+    Connection connectToNode(const finger_t& node);
+
+    /**
+     * buildConnection()
+     * - Connect to the remote, through the local transport if it's
+     *   another shard of this process.
+     * @param remote_builder : remote to connect to
+     * @return connection to remote
+     */
+    Connection buildConnection(const ServerBuilder& remote_builder) const;
+
+    /**
+     * recordRtt()
+     * - Fold an RTT sample into the node's smoothed RTT. Rebuild the
+     *   routing table if proximity routing is on and the smoothed RTT
+     *   changed significantly.
+     * @param node : node that was contacted
+     * @param sample_usec : measured RTT
+     */
+    void recordRtt(const finger_t& node, double sample_usec);
+
+    /**
+     * findRtt()
+     * - Look up the smoothed RTT to the node.
+     * @param node : node to look up
+     * @param rtt_usec : set to the smoothed RTT, if known
+     * @return true iff an RTT was measured for the node
+     */
+    bool findRtt(const finger_t& node, double& rtt_usec) const;
+
+    /**
+     * preferNearbyFinger()
+     * - Look for a finger preceding the selected one that makes almost
+     *   as much progress towards the object, but is much closer to us.
+     * @param object_id : id of target object
+     * @param finger_idx : index of finger selected by id progress alone
+     * @return index of finger to forward to
+     */
+    size_t preferNearbyFinger(uint8_t object_id, size_t finger_idx) const;
+
+    /**
+     * reportLookupLatency()
+     * - Print the latency of the image query that just completed along
+     *   with the running average.
+     */
+    void reportLookupLatency();
+
+    /**
+     * armHedge()
+     * - Remember the search we just forwarded so that we can hedge it if
+     *   no reply arrives in time.
+     * @param srch_pkt : search packet we forwarded
+     * @param first_hop : node-id of the node we forwarded it to
+     */
+    void armHedge(const dhtsrch_t& srch_pkt, uint8_t first_hop);
+
+    /**
+     * sendHedge()
+     * - Send the pending search down the finger that makes the most progress
+     *   towards the object, out of those we haven't sent it to yet and
+     *   whose route doesn't run back through our first hop.
+     */
+    void sendHedge();
+
+    /**
+     * isRoutedThrough()
+     * - Return true iff a search for the object sent to the node is likely
+     *   to be forwarded to the hop (or to a node before it), going by the
+     *   finger-ids the node would be forwarding through.
+     * @param node_id : node-id of the node we'd send the search to
+     * @param object_id : id of the object being searched for
+     * @param hop_id : node-id of the hop we're trying to route around
+     */
+    bool isRoutedThrough(uint8_t node_id, uint8_t object_id, uint8_t hop_id) const;
+
+    /**
+     * isReplyForPendingQuery()
+     * - Return true iff the RPLY/MISS answers the query we're servicing,
+     *   rather than being a late answer to a search we hedged.
+     * @param srch_pkt : RPLY/MISS packet
+     */
+    bool isReplyForPendingQuery(const dhtsrch_t& srch_pkt) const;
+
+    /**
+     * computeListenTimeout()
+     * - Return the time to wait for traffic (usec) before we need to hedge
+     *   or expire a probe.
+     */
+    suseconds_t computeListenTimeout() const;
+
+    /**
+     * computeFingerForForwarding()
+     * - Scan the finger table for the finger to forward the request to.
      * - That is, of the fingers in our finger table with IDs less than
      *   the target object, select the finger with the greatest node-id.
      * @param object_id : id of target object
      */
+    size_t computeFingerForForwarding(uint8_t object_id) const;
+
+    /**
+     * findFingerForForwarding()
+     * - Look up the finger to forward the request to in the routing table.
+     * @param object_id : id of target object
+     */
     size_t findFingerForForwarding(uint8_t object_id) const;
 
+    /**
+     * expectToFindObjectAtRoute()
+     * - Look up whether we expect the finger selected by the routing
+     *   table to own the object.
+     * @param object_id : id of object
+     */
+    bool expectToFindObjectAtRoute(uint8_t object_id) const;
+
     /**
      * expectToFindObject()
      * - Return true b/c the object-id is between the finger's fID
@@ -421,21 +1241,131 @@ class DhtNode {
      */
     void rejectNetimgQuery(const Connection* cxn) const;
 
-    /**
-     * loadImsgPacket()
-     * - Inflate imsg packet with data from ltga img
-     * @param ltga : image
-     * @param imsg : packet to return to sender
-     */
-    size_t loadImsgPacket(LTGA& ltga, imsg_t& imsg) const;
-
     /**
      * forwardInitialImageQueryToDht()
      * - Send image query along fingers in dht.
      * - CAUTION: used for first image forward ONLY
-     * @param file_name : name of image file
+     * @param key : key of image
+     */
+    void forwardInitialImageQuery(const ImageKey& key);
+
+    /**
+     * startIterativeLookup()
+     * - Seed the lookup with our fingers (and the cached owner, if any)
+     *   and send the first probes.
+     * @param srch_pkt : search to resolve
+     */
+    void startIterativeLookup(const dhtsrch_t& srch_pkt);
+
+    /**
+     * addLookupCandidate()
+     * - Add node to the iterative lookup's candidates, unless it's us or
+     *   we've already heard of it.
+     * @param node : candidate node
+     * @param atloc : true iff we expect the node to own the image
+     */
+    void addLookupCandidate(const finger_t& node, bool atloc);
+
+    /**
+     * computeLookupDistance()
+     * - Return the distance of the candidate from the image, counting
+     *   expected owners as 0.
+     * @param candidate : candidate node
+     */
+    uint8_t computeLookupDistance(const lookup_candidate_t& candidate) const;
+
+    /**
+     * advanceIterativeLookup()
+     * - Drop probes that timed out, send probes to the closest candidates
+     *   until 'lookupAlpha_' are in flight, and report a miss to the netimg
+     *   client once we've run out of nodes to probe.
+     */
+    void advanceIterativeLookup();
+
+    /**
+     * handleProbeReply()
+     * - Read the answer to the probe on socket 'sd'. Serve the image on
+     *   RPLY/MISS, and add the next hop to the candidates on NEXT.
+     * @param sd : socket of the probe's connection
+     */
+    void handleProbeReply(int sd);
+
+    /**
+     * abortIterativeLookup()
+     * - Close the probes in flight and forget the lookup's state.
+     */
+    void abortIterativeLookup();
+
+    /**
+     * forwardImageQueryToOwner()
+     * - Send image query directly to a cached owner, expecting it to hold
+     *   the image. Fall back to the finger table if the owner redirects
+     *   us or can't be reached.
+     * @param srch_pkt : packet containing search query
+     * @param owner : cached owner of the image-id
+     */
+    void forwardImageQueryToOwner(dhtsrch_t srch_pkt, const finger_t& owner);
+
+    /**
+     * rememberOwner()
+     * - Record that the provided node owns the object id.
+     * @param object_id : id of object
+     * @param owner : node owning the object (network-byte-order)
+     */
+    void rememberOwner(uint8_t object_id, const dhtnode_t& owner);
+
+    /**
+     * findCachedOwner()
+     * - Look up a cached owner for the object id.
+     * @param object_id : id of object
+     * @param owner : set to the owner, if found
+     * @return true iff an owner was found
+     */
+    bool findCachedOwner(uint8_t object_id, finger_t& owner);
+
+    /**
+     * forgetOwner()
+     * - Drop the owner with the provided node id from the owner cache.
+     * @param node_id : id of owner node
+     */
+    void forgetOwner(uint8_t node_id);
+
+    /**
+     * recordImageRequest()
+     * - Count a request for the image in the popularity sketch, which
+     *   the image cache also admits by, and towards the cache hit ratio.
+     * @param key : key of requested image
+     */
+    void recordImageRequest(const ImageKey& key);
+
+    /**
+     * prefetchIfHot()
+     * - Search for the image ourselves once it's hot, so that we can cache
+     *   it and answer later searches before they reach the owner.
+     * @param srch_pkt : search that we passed along
+     */
+    void prefetchIfHot(const dhtsrch_t& srch_pkt);
+
+    /**
+     * reportPopularity()
+     * - Print the most frequently requested images.
      */
-    void forwardInitialImageQuery(const std::string& file_name);
+    void reportPopularity() const;
+
+    /**
+     * prefetchImage()
+     * - Send a search for the image with ourselves as the proxy.
+     * @param img : image to search for
+     */
+    void prefetchImage(const dhtimg_t& img);
+
+    /**
+     * takePendingPrefetch()
+     * - Return true iff we searched for the image on our own behalf, and
+     *   stop waiting on it.
+     * @param file_name : name of image
+     */
+    bool takePendingPrefetch(const std::string& file_name);
     
     /**
      * forwardImageQuery()
@@ -452,6 +1382,17 @@ class DhtNode {
      */
     void returnNotFoundToImageProxy(const dhtsrch_t& srch_pkt);
     
+    /**
+     * forwardImageQueryAroundFinger()
+     * - The finger we tried to forward to is unreachable, most likely
+     *   b/c it left the ring. Forward to the closest preceding finger
+     *   on another node instead, which still makes progress.
+     * @param srch_pkt : packet containing search query 
+     * @param dead_idx : index of unreachable finger
+     * @return true iff the query was forwarded
+     */
+    bool forwardImageQueryAroundFinger(dhtsrch_t srch_pkt, size_t dead_idx);
+
     /**
      * forwardImageQueryWithoutTtl()
      * - Send image query along fingers in dht. May be used for either
@@ -506,14 +1447,59 @@ class DhtNode {
      * DhtNode()
      * - Create node with custom id. 
      * @param id : id of node (override default computation)
+     * @param image_store : where the images live
      */
-    DhtNode(uint8_t id);
+    DhtNode(uint8_t id, const ImageStore& image_store);
 
     /**
      * DhtNode()
      * - Create node with id derived from address.
+     * @param image_store : where the images live
+     */
+    explicit DhtNode(const ImageStore& image_store);
+
+    /**
+     * hostVirtualNodes()
+     * - Host additional virtual nodes in this process, each with its own
+     *   id, finger table and image db range.
+     * @param count : total number of virtual nodes, including this one
+     */
+    void hostVirtualNodes(size_t count);
+
+    /**
+     * setLocalTransport()
+     * - Exchange dht traffic w/ the other shards of this process through
+     *   the transport. Covers the virtual nodes we host too.
+     * @param transport : transport shared by the shards
+     */
+    void setLocalTransport(LocalTransport* transport);
+
+    /**
+     * disableCli()
+     * - Stop listening to stdin. Used when several nodes share a process.
+     */
+    void disableCli();
+
+    /**
+     * setJoinedCallback()
+     * - Register function to call once this node and all of its virtual
+     *   nodes have joined the network. Called from the thread running
+     *   this node.
+     * @param callback : function to call
+     */
+    void setJoinedCallback(std::function<void()> callback);
+
+    /**
+     * getDomainName()
+     * - Return domain name of this node's dht receiver.
+     */
+    const std::string& getDomainName() const;
+
+    /**
+     * getPort()
+     * - Return port of this node's dht receiver in host-byte-order.
      */
-    DhtNode();
+    uint16_t getPort() const;
 
     /**
      * joinNetwork()
@@ -523,15 +1509,72 @@ class DhtNode {
      */
     void joinNetwork(const std::string& fqdn, uint16_t port);
 
+    /**
+     * joinNetwork()
+     * - Send join request to every seed, plus the closest node from the
+     *   last run's ring membership.
+     * @param seeds : nodes to join through
+     */
+    void joinNetwork(const std::vector<seed_t>& seeds);
+
+    /**
+     * enableSnapshots()
+     * - Restore our state from the snapshot at the provided path, if it's
+     *   valid, and keep the snapshot up-to-date from now on.
+     * - CAUTION: call before joining the network
+     * @param path : path of snapshot file
+     */
+    void enableSnapshots(const std::string& path);
+
+    /**
+     * enableHedging()
+     * - Send an image query down another finger if it hasn't been answered
+     *   after 'delay_msec'. The first reply wins.
+     * @param delay_msec : hedge delay in milliseconds
+     */
+    void enableHedging(size_t delay_msec);
+
+    /**
+     * enableIterativeLookups()
+     * - Resolve image queries ourselves, hop by hop, keeping up to 'alpha'
+     *   probes in flight, rather than handing them off to the DHT.
+     * @param alpha : number of parallel probes
+     */
+    void enableIterativeLookups(size_t alpha);
+
+    /**
+     * enableProximityRouting()
+     * - Forward through a finger w/ at most half the RTT of the one that
+     *   makes the most progress, if it falls short by at most 'slack_ids'.
+     *   Covers the virtual nodes we host too.
+     * @param slack_ids : ids of progress we'll give up
+     */
+    void enableProximityRouting(size_t slack_ids);
+
+    /**
+     * delayPeers()
+     * - Hold up every connection to the provided nodes, e.g. to measure
+     *   proximity routing on a single machine. Covers the virtual nodes
+     *   we host too.
+     * @param delays : delay to add per node
+     */
+    void delayPeers(const std::vector<peer_delay_t>& delays);
+
     /**
      * run()
      * - Await incoming messages.
      */
     void run();
 
+    /**
+     * stop()
+     * - Make run() return. Safe to call from another thread.
+     */
+    void stop();
+
     /**
      * close()
-     * - Tear down this node.
+     * - Leave the network and tear down this node.
      */
     void close();
 
@@ -0,0 +1,189 @@
+#include "ImageCache.h"
+
+#include <algorithm>
+#include <assert.h>
+
+ImageCache::ImageCache(size_t capacity, const CountMinSketch& frequency) :
+  frequency_(frequency),
+  capacity_(capacity),
+  windowCapacity_(std::max<size_t>(1, capacity * CACHE_WINDOW_PERCENT / 100)),
+  protectedCapacity_(0),
+  numHits_(0),
+  numMisses_(0)
+{
+  // Fail b/c the cache must hold at least one image
+  assert(capacity_);
+
+  windowCapacity_ = std::min(windowCapacity_, capacity_);
+  protectedCapacity_ = (capacity_ - windowCapacity_) * CACHE_PROTECTED_PERCENT / 100;
+}
+
+ImageCache::segment_t& ImageCache::getSegment(Segment segment) {
+  switch (segment) {
+    case WINDOW:
+      return window_;
+    case PROBATION:
+      return probation_;
+    case PROTECTED:
+      return protected_;
+  }
+
+  // Fail b/c every segment is handled above
+  assert(false);
+  return window_;
+}
+
+void ImageCache::moveToFront(segment_t::iterator it, Segment segment) {
+  segment_t& from = getSegment(it->segment);
+  segment_t& to = getSegment(segment);
+
+  it->segment = segment;
+  to.splice(to.begin(), from, it);
+}
+
+bool ImageCache::access(const std::string& file_name) {
+  auto idx_it = index_.find(file_name);
+  if (idx_it == index_.end()) {
+    ++numMisses_;
+    return false;
+  }
+
+  ++numHits_;
+  segment_t::iterator it = idx_it->second;
+
+  switch (it->segment) {
+    case WINDOW:
+      moveToFront(it, WINDOW);
+      break;
+
+    case PROBATION:
+      // Second hit, so protect it from scans
+      moveToFront(it, PROTECTED);
+
+      // Demote the least recently used protected entry to make room
+      if (protected_.size() > protectedCapacity_) {
+        moveToFront(std::prev(protected_.end()), PROBATION);
+      }
+      break;
+
+    case PROTECTED:
+      moveToFront(it, PROTECTED);
+      break;
+  }
+
+  return true;
+}
+
+std::vector<ImageKey> ImageCache::insert(const ImageKey& key) {
+  std::vector<ImageKey> evicted;
+  if (contains(key.getName())) {
+    return evicted;
+  }
+
+  // Every new image gets a chance in the window
+  window_.push_front(entry_t{key, WINDOW});
+  index_[key.getName()] = window_.begin();
+
+  if (window_.size() > windowCapacity_) {
+    admitFromWindow(evicted);
+  }
+
+  return evicted;
+}
+
+std::vector<ImageKey> ImageCache::preload(const ImageKey& key) {
+  std::vector<ImageKey> evicted;
+  if (contains(key.getName())) {
+    return evicted;
+  }
+
+  // All of the cache is window, so it has to go through there
+  if (capacity_ == windowCapacity_) {
+    return insert(key);
+  }
+
+  // Make room in the main cache, from its coldest end
+  if (probation_.size() + protected_.size() >= capacity_ - windowCapacity_) {
+    evict(probation_.empty() ? PROTECTED : PROBATION, evicted);
+  }
+
+  probation_.push_front(entry_t{key, PROBATION});
+  index_[key.getName()] = probation_.begin();
+  return evicted;
+}
+
+void ImageCache::admitFromWindow(std::vector<ImageKey>& evicted) {
+  segment_t::iterator candidate = std::prev(window_.end());
+
+  // Take it, if the main cache has room
+  if (probation_.size() + protected_.size() < capacity_ - windowCapacity_) {
+    moveToFront(candidate, PROBATION);
+    return;
+  }
+
+  // Nothing to compete with
+  if (probation_.empty() && protected_.empty()) {
+    evict(WINDOW, evicted);
+    return;
+  }
+
+  Segment victim_segment = probation_.empty() ? PROTECTED : PROBATION;
+  const entry_t& victim = getSegment(victim_segment).back();
+
+  // Keep whichever is used more often. Ties go to the incumbent, so
+  // that a scan of one-off images can't flush the main cache.
+  if (frequency_.estimate(candidate->key.getName()) > frequency_.estimate(victim.key.getName())) {
+    evict(victim_segment, evicted);
+    moveToFront(candidate, PROBATION);
+  } else {
+    evict(WINDOW, evicted);
+  }
+}
+
+void ImageCache::evict(Segment segment, std::vector<ImageKey>& evicted) {
+  segment_t& entries = getSegment(segment);
+
+  // Fail b/c there's nothing to evict
+  assert(!entries.empty());
+
+  evicted.push_back(entries.back().key);
+  index_.erase(entries.back().key.getName());
+  entries.pop_back();
+}
+
+bool ImageCache::contains(const std::string& file_name) const {
+  return index_.count(file_name);
+}
+
+bool ImageCache::erase(const std::string& file_name, ImageKey& erased) {
+  auto idx_it = index_.find(file_name);
+  if (idx_it == index_.end()) {
+    return false;
+  }
+
+  segment_t::iterator it = idx_it->second;
+  erased = it->key;
+  getSegment(it->segment).erase(it);
+  index_.erase(idx_it);
+  return true;
+}
+
+std::vector<ImageKey> ImageCache::getImages() const {
+  std::vector<ImageKey> images;
+  for (const segment_t* entries : {&window_, &probation_, &protected_}) {
+    for (const entry_t& entry : *entries) {
+      images.push_back(entry.key);
+    }
+  }
+
+  return images;
+}
+
+size_t ImageCache::size() const {
+  return index_.size();
+}
+
+double ImageCache::getHitRatio() const {
+  uint64_t num_accesses = numHits_ + numMisses_;
+  return num_accesses ? static_cast<double>(numHits_) / num_accesses : 0.0;
+}
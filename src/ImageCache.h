@@ -0,0 +1,168 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+
+#include "CountMinSketch.h"
+#include "ImageKey.h"
+
+#define CACHE_WINDOW_PERCENT 1      // share of capacity for the admission window
+#define CACHE_PROTECTED_PERCENT 80  // share of the main cache for the protected segment
+
+class ImageCache {
+
+  private:
+    /**
+     * Segments of the cache. New images enter the window. The window's
+     * victims must beat the probation segment's victim on frequency to
+     * enter the main cache, and are promoted to the protected segment on
+     * their next hit.
+     */
+    enum Segment {
+      WINDOW,
+      PROBATION,
+      PROTECTED
+    };
+
+    /**
+     * Represents a cached image.
+     */
+    struct entry_t {
+      ImageKey key;
+      Segment segment;
+    };
+
+    typedef std::list<entry_t> segment_t;
+
+    /**
+     * Entries of each segment, most recently used first.
+     */
+    segment_t window_, probation_, protected_;
+
+    /**
+     * Entries by image name.
+     */
+    std::unordered_map<std::string, segment_t::iterator> index_;
+
+    /**
+     * Recent request frequency of every image the node has been asked
+     * about, cached or not (TinyLFU). Owned and aged by the node.
+     */
+    const CountMinSketch& frequency_;
+
+    /**
+     * Maximum number of entries overall, in the window and in the
+     * protected segment.
+     */
+    size_t capacity_, windowCapacity_, protectedCapacity_;
+
+    /**
+     * Hit/miss counts, for reporting the hit ratio.
+     */
+    uint64_t numHits_, numMisses_;
+
+    /**
+     * getSegment()
+     * - Return the list holding entries of the segment.
+     * @param segment : segment to look up
+     */
+    segment_t& getSegment(Segment segment);
+
+    /**
+     * moveToFront()
+     * - Move entry to the front of the provided segment.
+     * @param it : entry to move
+     * @param segment : segment to move the entry to
+     */
+    void moveToFront(segment_t::iterator it, Segment segment);
+
+    /**
+     * admitFromWindow()
+     * - Move the window's least recently used entry into the main cache,
+     *   if it's used more often than the entry it would push out.
+     * @param evicted : keys of evicted images are appended here
+     */
+    void admitFromWindow(std::vector<ImageKey>& evicted);
+
+    /**
+     * evict()
+     * - Drop the least recently used entry of the segment.
+     * @param segment : segment to evict from
+     * @param evicted : key of evicted image is appended here
+     */
+    void evict(Segment segment, std::vector<ImageKey>& evicted);
+
+  public:
+    /**
+     * ImageCache()
+     * - Ctor for ImageCache.
+     * @param capacity : maximum number of cached images
+     * @param frequency : request frequencies to admit images by
+     */
+    ImageCache(size_t capacity, const CountMinSketch& frequency);
+
+    /**
+     * access()
+     * - Count a hit or miss for the image, and refresh its entry if it's
+     *   cached. Call once per request for an image we could cache.
+     * @param file_name : name of requested image
+     * @return true iff the image is cached
+     */
+    bool access(const std::string& file_name);
+
+    /**
+     * insert()
+     * - Cache the image. May evict other images, or the image itself if
+     *   it's requested less often than the images it would replace.
+     * @param key : key of image
+     * @return keys of evicted images
+     */
+    std::vector<ImageKey> insert(const ImageKey& key);
+
+    /**
+     * preload()
+     * - Cache the image in the main cache, skipping the admission check,
+     *   e.g. b/c another node already found it popular. May evict the
+     *   least recently used images.
+     * @param key : key of image
+     * @return keys of evicted images
+     */
+    std::vector<ImageKey> preload(const ImageKey& key);
+
+    /**
+     * contains()
+     * - Return true iff the image is cached.
+     * @param file_name : name of image
+     */
+    bool contains(const std::string& file_name) const;
+
+    /**
+     * erase()
+     * - Drop the image, if it's cached.
+     * @param file_name : name of image
+     * @param erased : set to the key the image was cached under
+     * @return true iff the image was cached
+     */
+    bool erase(const std::string& file_name, ImageKey& erased);
+
+    /**
+     * getImages()
+     * - Return keys of the cached images.
+     */
+    std::vector<ImageKey> getImages() const;
+
+    /**
+     * size()
+     * - Return the number of cached images.
+     */
+    size_t size() const;
+
+    /**
+     * getHitRatio()
+     * - Return the fraction of accesses that found the image cached.
+     */
+    double getHitRatio() const;
+};
@@ -2,58 +2,290 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iterator>
+#include <algorithm>
+#include <sys/stat.h>
 
-ImageDb::ImageDb(uint8_t id) : 
+ImageDb::ImageDb(uint8_t id, const ImageStore& store, const CountMinSketch& popularity) : 
   isInitialized_(false),
-  idRange_{id, id}
+  idRange_{id, id},
+  numImages_(0),
+  cache_(IMAGE_CACHE_SIZE, popularity),
+  isIndexStale_(true),
+  manifestOffset_(0),
+  manifestInode_(0),
+  store_(store)
 {
   load(id, id);  
 }
 
 void ImageDb::load(uint8_t start, uint8_t end) {
 
+  // Same range (e.g. a restored node was welcomed back into its old range).
+  // Keep what we have, but pick up manifest changes like a reload would.
+  if (isInitialized_ && idRange_.start == start && idRange_.end == end) {
+    syncManifest(true);
+    publish();
+    return;
+  }
+
   // We are now in the 'initialized' state
   isInitialized_ = true;
   
   // Store the new bounds of the identifier ring
   idRange_ = {start, end};
 
-  // Clear current data
-  bloomFilter_ = 0;
-  numImages_ = 0;
+  // Drop images that left our range. Cached images are still valid 
+  // after the range changes.
+  for (uint16_t idx = 0; idx < numImages_; ) {
+    if (ID_inrange(images_[idx].getId(), idRange_.start, idRange_.end)) {
+      ++idx;
+    } else {
+      removeImage(idx);
+    }
+  }
 
   // Report that we're loading the db with images in our range
   std::cout << "\t- Loading database with images in range: (" << (int) idRange_.start <<
       ", " << (int) idRange_.end << "]" << std::endl;
 
-  // Load images
-  std::ifstream manifest(IMAGE_MANIFEST_PATH);
+  // Load images that entered our range
+  manifestNames_.clear();
+  manifestOffset_ = 0;
+  addImages(readManifest());
+
+  publish();
+}
+
+std::vector<std::string> ImageDb::readManifest() {
+  std::vector<std::string> file_names;
+
+  struct stat manifest_stat;
+  std::string manifest_path = store_.getManifestPath();
+  std::ifstream manifest(manifest_path);
+  if (::stat(manifest_path.c_str(), &manifest_stat) == -1 || manifest.fail()) {
+    return file_names;
+  }
+
+  manifestInode_ = manifest_stat.st_ino;
+
+  // Pick up where we left off
+  manifest.seekg(manifestOffset_);
+  std::string text((std::istreambuf_iterator<char>(manifest)), std::istreambuf_iterator<char>());
+  manifest.close();
+
+  // Read the last name again next time if it isn't terminated, in case 
+  // it's only partly written
+  size_t num_read = text.size();
+  size_t last_space = text.find_last_of(" \t\r\n");
+  if (!text.empty() && last_space != text.size() - 1) {
+    num_read = (last_space == std::string::npos) ? 0 : last_space + 1;
+  }
+
+  manifestOffset_ += num_read;
+
+  std::istringstream names(text);
   std::string file_name;
+  while (names >> file_name) {
+    if (manifestNames_.insert(file_name).second) {
+      file_names.push_back(file_name);
+    }
+  }
 
-  while (manifest >> file_name && numImages_ < MAX_DB_SIZE) {
-    unsigned char md[SHA1_MDLEN];
+  return file_names;
+}
+
+std::vector<ImageKey> ImageDb::addImages(const std::vector<std::string>& file_names) {
+  std::vector<ImageKey> added;
+
+  // Hash the names in batches
+  for (const ImageKey& key : ImageKey::hashNames(file_names)) {
+    if (numImages_ == MAX_DB_SIZE) {
+      break;
+    }
 
-    SHA1((unsigned char *) file_name.c_str(), file_name.size(), md);
-    uint8_t id = static_cast<uint8_t>(ID(md));
+    if (ID_inrange(key.getId(), idRange_.start, idRange_.end) 
+        && !isInRange(key)
+        && imageExists(key.getName())) 
+    {
+      // We own it now, so it no longer needs a cache entry
+      uncacheImage(key);
 
-    if (ID_inrange(id, idRange_.start, idRange_.end)) {
-      storeImage(id, md, file_name);
+      storeImage(key);
+      added.push_back(key);
     }
   }
 
-  manifest.close();
+  return added;
+}
+
+bool ImageDb::imageExists(const std::string& file_name) const {
+  struct stat image_stat;
+  return ::stat(store_.getPath(file_name).c_str(), &image_stat) == 0 && S_ISREG(image_stat.st_mode);
+}
+
+std::vector<ImageKey> ImageDb::syncManifest(bool is_rescan) {
+  struct stat manifest_stat;
+  if (::stat(store_.getManifestPath().c_str(), &manifest_stat) == -1) {
+    return std::vector<ImageKey>();
+  }
+
+  // We can't tell what changed if the manifest was replaced or truncated
+  if (manifest_stat.st_ino != manifestInode_ || manifest_stat.st_size < manifestOffset_) {
+    is_rescan = true;
+  }
+
+  if (!is_rescan) {
+    std::vector<std::string> file_names = readManifest();
+
+    // Report the appended images
+    std::cout << "\t- Manifest lists " << file_names.size() << " new image(s)" << std::endl;
+
+    return addImages(file_names);
+  }
+
+  // Report that we're starting over
+  std::cout << "\t- Rescanning the whole manifest..." << std::endl;
+
+  manifestNames_.clear();
+  manifestOffset_ = 0;
+  std::vector<std::string> file_names = readManifest();
+
+  // Drop images that are no longer listed, or whose file is gone
+  for (uint16_t idx = 0; idx < numImages_; ) {
+    const std::string& file_name = images_[idx].getName();
+    if (manifestNames_.count(file_name) && imageExists(file_name)) {
+      ++idx;
+    } else {
+      removeImage(idx);
+    }
+  }
+
+  for (const ImageKey& key : cache_.getImages()) {
+    if (!manifestNames_.count(key.getName()) || !imageExists(key.getName())) {
+      uncacheImage(key);
+    }
+  }
+
+  return addImages(file_names);
+}
+
+void ImageDb::dropImage(const ImageKey& key) {
+  int idx = findImage(key);
+  if (idx != -1) {
+    // Report that the image is gone
+    std::cout << "\t- Dropping deleted image from db: " << key.getName() << std::endl;
+    removeImage(idx);
+  }
+
+  uncacheImage(key);
 }
 
-void ImageDb::storeImage(
-  uint8_t id,
-  unsigned char * md,
-  const std::string& file_name
+std::vector<ImageKey> ImageDb::applyCatalogChanges(
+  const std::vector<CatalogWatcher::change_t>& changes
 ) {
+  std::vector<ImageKey> changed;
+
+  // The next load() reads everything anyway
+  if (!isInitialized_) {
+    return changed;
+  }
+
+  for (const CatalogWatcher::change_t& change : changes) {
+    std::vector<ImageKey> added;
+
+    switch (change.type) {
+      case CatalogWatcher::IMAGE_ADDED: {
+        // Images only count once the manifest lists them
+        if (!manifestNames_.count(change.name)) {
+          break;
+        }
+
+        // An image we already store may have been rewritten
+        ImageKey key(change.name);
+        if (isInRange(key)) {
+          changed.push_back(key);
+        } else {
+          added = addImages(std::vector<std::string>(1, change.name));
+        }
+        break;
+      }
+
+      case CatalogWatcher::IMAGE_REMOVED:
+        // A file of that name may have left a root that doesn't hold it
+        if (!imageExists(change.name)) {
+          dropImage(ImageKey(change.name));
+        }
+        break;
+
+      case CatalogWatcher::MANIFEST_CHANGED:
+        added = syncManifest(false);
+        break;
+
+      case CatalogWatcher::CHANGES_LOST:
+        added = syncManifest(true);
+        break;
+    }
+
+    changed.insert(changed.end(), added.begin(), added.end());
+  }
+
+  publish();
+  return changed;
+}
+
+void ImageDb::removeImage(uint16_t idx) {
+  // Fail b/c 'idx' is out of bounds
+  assert(idx < numImages_);
+
+  ImageKey& image = images_[idx];
+  bloomFilter_.remove(image);
+
+  std::vector<uint16_t>& bucket = buckets_[image.getId()];
+  bucket.erase(std::find(bucket.begin(), bucket.end(), idx));
+
+  // Fill the hole with the last image
+  uint16_t last_idx = numImages_ - 1;
+  if (idx != last_idx) {
+    image = images_[last_idx];
+
+    std::vector<uint16_t>& last_bucket = buckets_[image.getId()];
+    *std::find(last_bucket.begin(), last_bucket.end(), last_idx) = idx;
+  }
+
+  --numImages_;
+  isIndexStale_ = true;
+}
+
+bool ImageDb::isInRange(const ImageKey& key) const {
+  return findImage(key) != -1;
+}
+
+int ImageDb::findImage(const ImageKey& key) const {
+  for (uint16_t idx : buckets_[key.getId()]) {
+    if (images_[idx].getName() == key.getName()) {
+      return idx;
+    }
+  }
+
+  return -1;
+}
+
+void ImageDb::uncacheImage(const ImageKey& key) {
+  // The bloom indices it was cached under may have come from a peer
+  ImageKey cached_key;
+  if (cache_.erase(key.getName(), cached_key)) {
+    bloomFilter_.remove(cached_key);
+  }
+}
+
+void ImageDb::storeImage(const ImageKey& key) {
   // Fail if the image db has not yet been initialized
   assert(isInitialized_);
 
   // Check that image can be loaded from file system
-  std::string image_path = IMAGE_FOLDER + file_name;
+  std::string image_path = store_.getPath(key.getName());
   std::ifstream image_file(image_path);
 
   // Fail if image can't be loaded
@@ -62,69 +294,308 @@ void ImageDb::storeImage(
   image_file.close();
 
   // Store image info in db
-  image_t& image = images_[numImages_];
-  image.id = id;
-  image.name = file_name;
+  images_[numImages_] = key;
 
   // Report that we'res storing a new image
-  std::cout << "\t\t- Storing new image in db: <id: " << (int) image.id << ", name: " <<
-      image.name << ", idx: " << (int) numImages_ << ">" << std::endl;
+  std::cout << "\t\t- Storing new image in db: <id: " << (int) key.getId() << ", name: " <<
+      key.getName() << ", idx: " << (int) numImages_ << ">" << std::endl;
+
+  // Index by id
+  buckets_[key.getId()].push_back(numImages_);
 
   // Update bloom filter
-  bloomFilter_ |= (1L << (int) bfIDX(BFIDX1, md)) |
-      (1L << (int) bfIDX(BFIDX2, md)) | (1L << (int) bfIDX(BFIDX3, md));
+  bloomFilter_.add(key);
   
   // Track the newly added image
   ++numImages_;
+  isIndexStale_ = true;
+}
+
+void ImageDb::clear() {
+  while (numImages_) {
+    removeImage(numImages_ - 1);
+  }
 }
 
-void ImageDb::cacheImage(const std::string& file_name) {
+void ImageDb::save(std::ostream& out) const {
+  out << "range " << (int) idRange_.start << " " << (int) idRange_.end << "\n";
+  out << "images " << numImages_ + cache_.size() << "\n";
+
+  for (const std::vector<uint16_t>& bucket : buckets_) {
+    for (uint16_t idx : bucket) {
+      const ImageKey& image = images_[idx];
+      out << (int) image.getId() << " " << false << " " << image.getName() << "\n";
+    }
+  }
+
+  for (const ImageKey& image : cache_.getImages()) {
+    out << (int) image.getId() << " " << true << " " << image.getName() << "\n";
+  }
+}
+
+bool ImageDb::restore(std::istream& in) {
+  std::string range_token, images_token;
+  int start, end;
+  size_t num_images;
+
+  if (!(in >> range_token >> start >> end >> images_token >> num_images)
+      || range_token != "range" 
+      || images_token != "images"
+      || start < 0 || start > HASH_IDMAX
+      || end < 0 || end > HASH_IDMAX
+      || num_images > MAX_DB_SIZE + IMAGE_CACHE_SIZE)
+  {
+    isInitialized_ = false;
+    return false;
+  }
+
+  isInitialized_ = true;
+  idRange_ = {static_cast<uint8_t>(start), static_cast<uint8_t>(end)};
+  clear();
+
+  std::vector<int> ids(num_images);
+  std::vector<bool> is_cached(num_images);
+  std::vector<std::string> file_names(num_images);
+
+  for (size_t i = 0; i < num_images; ++i) {
+    bool cached;
+    if (!(in >> ids[i] >> cached >> file_names[i])) {
+      clear();
+      isInitialized_ = false;
+      publish();
+      return false;
+    }
+
+    is_cached[i] = cached;
+  }
+
+  // Hash every name in batches, then check each image
+  std::vector<ImageKey> keys = ImageKey::hashNames(file_names);
+  std::vector<ImageKey> cached_images;
+
+  for (size_t i = 0; i < num_images; ++i) {
+    const ImageKey& key = keys[i];
+
+    // The image must still exist and hash to the same id
+    std::ifstream image_file(store_.getPath(key.getName()));
+
+    if (key.getId() != ids[i] || image_file.fail()) {
+      clear();
+      isInitialized_ = false;
+      publish();
+      return false;
+    }
+
+    if (is_cached[i]) {
+      cached_images.push_back(key);
+    } else if (numImages_ != MAX_DB_SIZE) {
+      storeImage(key);
+    }
+  }
+
+  for (const ImageKey& key : cached_images) {
+    insertIntoCache(key);
+  }
+
+  // Learn what the manifest lists, so that we can follow changes to it
+  manifestNames_.clear();
+  manifestOffset_ = 0;
+  readManifest();
+
+  publish();
+  return true;
+}
+
+uint8_t ImageDb::getStart() const {
+  return idRange_.start;
+}
+
+uint8_t ImageDb::getEnd() const {
+  return idRange_.end;
+}
+
+void ImageDb::cacheImage(const ImageKey& key) {
+  insertIntoCache(key);
+  publish();
+}
+
+size_t ImageDb::preloadCache(const std::vector<ImageKey>& keys) {
+  size_t num_added = 0;
+  for (const ImageKey& key : keys) {
+    if (isInRange(key) || cache_.contains(key.getName())) {
+      continue;
+    }
+
+    std::vector<ImageKey> evicted = cache_.preload(key);
+    bloomFilter_.add(key);
+    ++num_added;
+
+    for (const ImageKey& evicted_key : evicted) {
+      bloomFilter_.remove(evicted_key);
+    }
+  }
+
+  publish();
+  return num_added;
+}
+
+void ImageDb::insertIntoCache(const ImageKey& key) {
   // Report that we're trying to cache the image
   std::cout << "\t- Attempting to cache image..." << std::endl;
- 
-  // Compute SHA1 hash and id of image name
-  unsigned char md[SHA1_MDLEN];
-  SHA1((unsigned char *) file_name.c_str(), file_name.size(), md);
-  uint8_t id = static_cast<uint8_t>(ID(md));
-
-  // Insert into db, if there's room
-  if (numImages_ != MAX_DB_SIZE) {
-    // Add image to the cache
-    storeImage(id, md, file_name);
-    
+
+  // Nothing to do if we already track the image
+  if (isInRange(key) || cache_.contains(key.getName())) {
+    std::cout << "\t- Image is already in the db!" << std::endl;
+    return;
+  }
+
+  // Add image to the cache, which may push out less popular images
+  std::vector<ImageKey> evicted = cache_.insert(key);
+  bloomFilter_.add(key);
+
+  // Keep the bloom filter accurate
+  for (const ImageKey& evicted_key : evicted) {
+    bloomFilter_.remove(evicted_key);
+
+    if (evicted_key.getName() != key.getName()) {
+      std::cout << "\t- Evicted less popular image from the cache: " <<
+          evicted_key.getName() << std::endl;
+    }
+  }
+
+  if (cache_.contains(key.getName())) {
     // Report that we've cached the image
     std::cout << "\t- Successfully cached image!" << std::endl;
-
   } else {
-    // Report that the cache is full
-    std::cout << "\t- Couldn't cache image because db is full!" << std::endl;
+    // Report that the image lost out to more popular ones
+    std::cout << "\t- Didn't cache image b/c cached images are requested more often!" << std::endl;
   }
 }
 
-QueryResult ImageDb::query(const std::string& file_name) const {
-  
-  // Compute SHA1 and id
-  unsigned char md[SHA1_MDLEN];
-  SHA1((unsigned char *) file_name.c_str(), file_name.size(), md);
-  uint8_t id = ID(md);
-
-  if (!((bloomFilter_ & (1L << (int) bfIDX(BFIDX1, md))) &&
-      (bloomFilter_ & (1L << (int) bfIDX(BFIDX2, md))) &&
-      (bloomFilter_ & (1L << (int) bfIDX(BFIDX3, md)))))
-  { 
+void ImageDb::recordAccess(const ImageKey& key) {
+  if (ID_inrange(key.getId(), idRange_.start, idRange_.end)) {
+    return;
+  }
+
+  cache_.access(key.getName());
+}
+
+QueryResult ImageDb::query(const ImageKey& key) const {
+
+  // Pin the current snapshot. Writers publish new ones w/o waiting on us.
+  std::shared_ptr<const snapshot_t> snapshot = std::atomic_load(&snapshot_);
+
+  if (!snapshot->bloomFilter.mayContain(key)) { 
     return QUERY_FAILURE;
   }
 
   
   /* To get here means that you've got a hit at the Bloom Filter.
-   * Search the DB for a match to BOTH the image ID and name.
+   * Search the DB and the cache for a match to BOTH the image ID and name.
   */
+  if (isInSnapshot(*snapshot, key)) {
+    return QUERY_SUCCESS;
+  }
+
+  return BLOOM_FILTER_MISS; 
+}
+
+std::vector<QueryResult> ImageDb::queryBatch(const std::vector<ImageKey>& keys) const {
+  std::vector<QueryResult> results(keys.size(), QUERY_FAILURE);
+
+  // Answer the whole batch from one snapshot
+  std::shared_ptr<const snapshot_t> snapshot = std::atomic_load(&snapshot_);
+  const index_t& index = *snapshot->index;
+
+  // Probe the bloom filter for every key, and prefetch the buckets of 
+  // keys that pass
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (snapshot->bloomFilter.mayContain(keys[i])) {
+      results[i] = BLOOM_FILTER_MISS;
+      __builtin_prefetch(index.buckets[keys[i].getId()].data());
+    }
+  }
+
+  // Search the buckets, which should be in cache by now
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (results[i] == BLOOM_FILTER_MISS && isInSnapshot(*snapshot, keys[i])) {
+      results[i] = QUERY_SUCCESS;
+    }
+  }
+
+  return results;
+}
+
+bool ImageDb::isInSnapshot(const snapshot_t& snapshot, const ImageKey& key) const {
+  for (const ImageKey& image : snapshot.index->buckets[key.getId()]) {
+    if (image.getName() == key.getName()) {
+      return true;
+    }
+  }
+
+  return snapshot.cachedNames->count(key.getName());
+}
+
+void ImageDb::publish() {
+  std::shared_ptr<const snapshot_t> current = std::atomic_load(&snapshot_);
+  std::shared_ptr<snapshot_t> next = std::make_shared<snapshot_t>();
+
+  next->bloomFilter = bloomFilter_;
+
+  // Reindex our range only if it changed
+  if (isIndexStale_ || !current) {
+    std::shared_ptr<index_t> index = std::make_shared<index_t>();
+    for (uint16_t idx = 0; idx < numImages_; ++idx) {
+      index->buckets[images_[idx].getId()].push_back(images_[idx]);
+    }
+
+    next->index = index;
+    isIndexStale_ = false;
+  } else {
+    next->index = current->index;
+  }
+
+  std::shared_ptr<std::unordered_set<std::string>> cached_names = 
+      std::make_shared<std::unordered_set<std::string>>();
+  for (const ImageKey& image : cache_.getImages()) {
+    cached_names->insert(image.getName());
+  }
+
+  next->cachedNames = cached_names;
+
+  // Readers that still hold the old snapshot keep it alive until they're done
+  std::atomic_store(&snapshot_, std::shared_ptr<const snapshot_t>(next));
+}
+
+std::vector<ImageKey> ImageDb::getCachedImages() const {
+  return cache_.getImages();
+}
+
+std::vector<ImageKey> ImageDb::getImagesInRange(uint8_t start, uint8_t end) const {
+  std::vector<ImageKey> images;
   for (size_t i = 0; i < numImages_; ++i) {
-    const image_t& image = images_[i];
-    if (id == image.id && file_name == image.name) {
-      return QUERY_SUCCESS;
+    if (ID_inrange(images_[i].getId(), start, end)) {
+      images.push_back(images_[i]);
     }
   }
 
-  return BLOOM_FILTER_MISS; 
+  for (const ImageKey& image : cache_.getImages()) {
+    if (ID_inrange(image.getId(), start, end)) {
+      images.push_back(image);
+    }
+  }
+
+  return images;
+}
+
+uint16_t ImageDb::getNumImages() const {
+  return numImages_ + cache_.size();
+}
+
+size_t ImageDb::getNumCachedImages() const {
+  return cache_.size();
+}
+
+double ImageDb::getCacheHitRatio() const {
+  return cache_.getHitRatio();
 }
@@ -1,17 +1,26 @@
 #pragma once
 
 #include "hash.h"
+#include "ImageKey.h"
+#include "ImageCache.h"
+#include "CountingBloomFilter.h"
+#include "CatalogWatcher.h"
+#include "ImageStore.h"
 
 #include <stdint.h>
 #include <string>
+#include <vector>
+#include <memory>
+#include <unordered_set>
+#include <iostream>
 #include <assert.h>
+#include <sys/types.h>
 
 #define MAX_DB_SIZE 1024
+#define IMAGE_CACHE_SIZE 64
 #define MAX_IMAGE_NAME 256
 
-#define IMAGE_FOLDER "images/"
-#define IMAGE_MANIFEST_FILE_NAME "FILELIST.txt"
-#define IMAGE_MANIFEST_PATH IMAGE_FOLDER IMAGE_MANIFEST_FILE_NAME 
+#define NUM_IMAGE_BUCKETS (HASH_IDMAX + 1)
 
 enum QueryResult {
   QUERY_SUCCESS,      // IMGDB_HIT
@@ -39,68 +48,319 @@ class ImageDb {
     id_range_t idRange_;
 
     /**
-     * Bloom filter bits.
+     * Bloom filter over the images in our range and the cached images.
+     * Counting, so that images can leave without a rebuild.
      */
-    uint64_t bloomFilter_;
+    CountingBloomFilter bloomFilter_;
 
     /**
-     * Tracks the number of images in the db.
+     * Tracks the number of images in our range.
      */
     uint16_t numImages_;
 
     /**
-     * Represents an image in our database.
+     * Tracks the images in our range.
      */
-    struct image_t {
-      uint8_t id;
-      std::string name;
+    ImageKey images_[MAX_DB_SIZE];
+
+    /**
+     * Images fetched from other nodes.
+     */
+    ImageCache cache_;
+
+    /**
+     * Indices into 'images_' bucketed by image id, so that a query only
+     * compares names with images that share its id.
+     */
+    std::vector<uint16_t> buckets_[NUM_IMAGE_BUCKETS];
+
+    /**
+     * Images in our range, by image id, as seen by queries.
+     */
+    struct index_t {
+      std::vector<ImageKey> buckets[NUM_IMAGE_BUCKETS];
+    };
+
+    /**
+     * Everything a query reads. Never modified once published. Writers
+     * change the members above, then publish a new snapshot, so that 
+     * queries on other threads never see a half-done update or wait on
+     * a writer. Parts that didn't change are shared with the previous
+     * snapshot.
+     */
+    struct snapshot_t {
+      CountingBloomFilter bloomFilter;
+      std::shared_ptr<const index_t> index;
+      std::shared_ptr<const std::unordered_set<std::string>> cachedNames;
     };
 
     /**
-     * Tracks the images in our database.
+     * Latest snapshot. Only accessed w/std::atomic_load/atomic_store.
+     */
+    std::shared_ptr<const snapshot_t> snapshot_;
+
+    /**
+     * Specifies whether the images in our range changed since the last
+     * snapshot.
+     */
+    bool isIndexStale_;
+
+    /**
+     * Names listed in the manifest, how many of its bytes we've read, and
+     * which file we read them from, so that appends are read incrementally.
+     */
+    std::unordered_set<std::string> manifestNames_;
+    std::streamoff manifestOffset_;
+    ino_t manifestInode_;
+
+    /**
+     * Where the images and the manifest live.
+     */
+    ImageStore store_;
+
+    /**
+     * readManifest()
+     * - Read the manifest from where we left off.
+     * @return names that the manifest didn't list before
+     */
+    std::vector<std::string> readManifest();
+
+    /**
+     * addImages()
+     * - Store the images that are in our range, not yet stored, and whose
+     *   file exists.
+     * @param file_names : names of image files
+     * @return images that were stored
+     */
+    std::vector<ImageKey> addImages(const std::vector<std::string>& file_names);
+
+    /**
+     * imageExists()
+     * - Return true iff the image file is in the image folder.
+     * @param file_name : name of image file
+     */
+    bool imageExists(const std::string& file_name) const;
+
+    /**
+     * syncManifest()
+     * - Add images that were appended to the manifest. Rescans the whole
+     *   manifest, and drops images it no longer lists, if it was replaced
+     *   or truncated.
+     * @param is_rescan : rescan, even if the manifest was only appended to
+     * @return images that were stored
+     */
+    std::vector<ImageKey> syncManifest(bool is_rescan);
+
+    /**
+     * dropImage()
+     * - Drop the image, in our range or cached, e.g. b/c its file is gone.
+     * @param key : key of image
+     */
+    void dropImage(const ImageKey& key);
+
+    /**
+     * publish()
+     * - Publish a snapshot of the db for queries. Call after every change.
+     */
+    void publish();
+
+    /**
+     * isInSnapshot()
+     * - Return true iff the snapshot holds the image, in our range or in 
+     *   the cache.
+     * @param snapshot : snapshot to search
+     * @param key : key of image
+     */
+    bool isInSnapshot(const snapshot_t& snapshot, const ImageKey& key) const;
+
+    /**
+     * clear()
+     * - Drop every image in our range. Cached images are kept.
+     */
+    void clear();
+
+    /**
+     * removeImage()
+     * - Drop the image in our range at the provided index.
+     * @param idx : index into 'images_'
+     */
+    void removeImage(uint16_t idx);
+
+    /**
+     * isInRange()
+     * - Return true iff we hold the image as one of the images in our range.
+     * @param key : key of image
      */
-    image_t images_[MAX_DB_SIZE];
+    bool isInRange(const ImageKey& key) const;
+
+    /**
+     * findImage()
+     * - Return the index into 'images_' of the image in our range, or -1.
+     * @param key : key of image
+     */
+    int findImage(const ImageKey& key) const;
+
+    /**
+     * uncacheImage()
+     * - Drop the image from the cache and from the bloom filter.
+     * @param key : key of image
+     */
+    void uncacheImage(const ImageKey& key);
 
     /**
      * storeImage()
-     * - Incorporate image into db.
-     * @param id : id of image
-     * @param md : sha1 hash of image name
-     * @parm file_name : name of image file
+     * - Incorporate image in our range into db.
+     * @param key : key of image
+     */
+    void storeImage(const ImageKey& key);
+
+    /**
+     * insertIntoCache()
+     * - cacheImage() w/o publishing a snapshot.
+     * @param key : key of image to add to the cache.
      */
-    void storeImage(uint8_t id, unsigned char * md, const std::string& file_name);
+    void insertIntoCache(const ImageKey& key);
 
   public:
 
     /**
      * ImageDb()
      * - Ctor for image db. Starts w/everything in its db.
+     * @param id : id of the node that owns the db
+     * @param store : where the images live
+     * @param popularity : request frequencies, for cache admission
      */
-    ImageDb(uint8_t id);
+    ImageDb(uint8_t id, const ImageStore& store, const CountMinSketch& popularity);
 
     /**
      * load()
-     * - Clear db/bloomfilter and load contents based on current id-range.
+     * - Drop images that left our id-range and add those that entered it.
+     *   Cached images are kept. If the range is unchanged, only picks up
+     *   changes to the manifest.
      * @param start : beginning of new identifier ring (exclusive)
      * @param end : end of new identifier ring (inclusive)
      */
     void load(uint8_t start, uint8_t end);
 
+    /**
+     * applyCatalogChanges()
+     * - Add and drop images as the image folder and manifest change, w/o
+     *   reloading the whole manifest.
+     * @param changes : changes reported by a CatalogWatcher
+     * @return images in our range that were added or whose file changed
+     */
+    std::vector<ImageKey> applyCatalogChanges(const std::vector<CatalogWatcher::change_t>& changes);
+
+    /**
+     * save()
+     * - Write the id-range and images, bucket by bucket, to the stream.
+     * @param out : stream to write to
+     */
+    void save(std::ostream& out) const;
+
+    /**
+     * restore()
+     * - Replace our contents with those written by save(). Leaves the db
+     *   empty and uninitialized, so that the next load() rescans the
+     *   manifest, if the stream is malformed or an image no longer exists.
+     * @param in : stream to read from
+     * @return true iff the db was restored
+     */
+    bool restore(std::istream& in);
+
+    /**
+     * getStart()
+     * - Return the start of our id-range (exclusive).
+     */
+    uint8_t getStart() const;
+
+    /**
+     * getEnd()
+     * - Return the end of our id-range (inclusive).
+     */
+    uint8_t getEnd() const;
+
     /**
      * cacheImage()
      * - Register the image with the cache. Only store name
      *   because directory contains all of the images. We just need
      *   to 'track' which images are recognized by this node.
-     * @param file_name : name of image file to add to the cache.
+     * - The cache may turn the image away if it's requested less often
+     *   than the images it would replace.
+     * @param key : key of image to add to the cache.
      */
-    void cacheImage(const std::string& file_name);
+    void cacheImage(const ImageKey& key);
+
+    /**
+     * preloadCache()
+     * - Cache the images w/o the admission check, e.g. b/c another node
+     *   handed them to us. Later images push out earlier ones if the cache
+     *   fills up, so pass the most popular ones last.
+     * @param keys : keys of images to cache
+     * @return number of images that weren't in our db yet
+     */
+    size_t preloadCache(const std::vector<ImageKey>& keys);
+
+    /**
+     * recordAccess()
+     * - Count a request for the image towards the cache hit ratio, and
+     *   refresh its cache entry if it's cached. Images in our range are
+     *   never cached, so they don't count.
+     * @param key : key of requested image
+     */
+    void recordAccess(const ImageKey& key);
 
     /**
      * query()
-     * - Query db for image.
-     * @param file_name : name of image file
+     * - Query db for image. Unlike every other method, safe to call from
+     *   any thread.
+     * @param key : key of image
      * @return result of query
      */
-    QueryResult query(const std::string& file_name) const; 
+    QueryResult query(const ImageKey& key) const; 
+
+    /**
+     * queryBatch()
+     * - Query db for several images at once, against one snapshot. The
+     *   bloom filter is probed for every key before any bucket is searched,
+     *   prefetching the buckets of keys that pass, so that their cache
+     *   misses overlap instead of stalling one query at a time. Safe to
+     *   call from any thread.
+     * @param keys : keys of images
+     * @return result of each query, in the order of 'keys'
+     */
+    std::vector<QueryResult> queryBatch(const std::vector<ImageKey>& keys) const;
+
+    /**
+     * getCachedImages()
+     * - Return keys of images that were cached from other nodes.
+     */
+    std::vector<ImageKey> getCachedImages() const;
+
+    /**
+     * getImagesInRange()
+     * - Return keys of images with ids in (start, end].
+     * @param start : start of id range (exclusive)
+     * @param end : end of id range (inclusive)
+     */
+    std::vector<ImageKey> getImagesInRange(uint8_t start, uint8_t end) const;
+
+    /**
+     * getNumImages()
+     * - Return the number of images tracked by the db.
+     */
+    uint16_t getNumImages() const;
+
+    /**
+     * getNumCachedImages()
+     * - Return the number of images cached from other nodes.
+     */
+    size_t getNumCachedImages() const;
+
+    /**
+     * getCacheHitRatio()
+     * - Return the fraction of recorded accesses that hit the cache.
+     */
+    double getCacheHitRatio() const;
     
 };
@@ -0,0 +1,87 @@
+#include "ImageKey.h"
+#include "Sha1Batch.h"
+
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+
+/**
+ * Offsets into the sha1 hash of the bloom filter's index functions.
+ */
+static const int BFIDX_STARTS[NUM_BLOOM_INDICES] = {BFIDX1, BFIDX2, BFIDX3};
+
+ImageKey::ImageKey() :
+  id_(0),
+  bloomIndices_{0, 0, 0}
+{}
+
+ImageKey::ImageKey(const std::string& file_name) :
+  name_(file_name)
+{
+  unsigned char md[SHA1_MDLEN];
+  SHA1((unsigned char *) name_.c_str(), name_.size(), md);
+  deriveFromDigest(md);
+}
+
+void ImageKey::deriveFromDigest(unsigned char * md) {
+  id_ = ID(md);
+  for (size_t i = 0; i < NUM_BLOOM_INDICES; ++i) {
+    bloomIndices_[i] = static_cast<uint8_t>(bfIDX(BFIDX_STARTS[i], md));
+  }
+}
+
+ImageKey::ImageKey(const dhtimg_t& img) :
+  name_(img.name, strnlen(img.name, DHT_MAX_FILE_NAME)),
+  id_(img.id)
+{
+  // Older senders leave the bloom indices out, or garbage in their place
+  for (size_t i = 0; i < NUM_BLOOM_INDICES; ++i) {
+    if ((img.rsvd[i] & DHTM_BFIDX_TAG_MASK) != DHTM_BFIDX_VALID) {
+      uint8_t id = id_;
+      *this = ImageKey(name_);
+      id_ = id;
+      return;
+    }
+
+    // Masked, as they index our filter
+    bloomIndices_[i] = img.rsvd[i] & DHTM_BFIDX_MASK;
+  }
+}
+
+std::vector<ImageKey> ImageKey::hashNames(const std::vector<std::string>& file_names) {
+  std::vector<Sha1Batch::digest_t> digests = Sha1Batch::digest(file_names);
+
+  std::vector<ImageKey> keys(file_names.size());
+  for (size_t i = 0; i < file_names.size(); ++i) {
+    keys[i].name_ = file_names[i];
+    keys[i].deriveFromDigest(digests[i].md);
+  }
+
+  return keys;
+}
+
+void ImageKey::serialize(dhtimg_t& img) const {
+  img.id = id_;
+
+  memset(img.name, 0, DHT_MAX_FILE_NAME);
+  memcpy(img.name, name_.c_str(), std::min(name_.size(), (size_t) DHT_MAX_FILE_NAME - 1));
+
+  for (size_t i = 0; i < NUM_BLOOM_INDICES; ++i) {
+    img.rsvd[i] = DHTM_BFIDX_VALID | bloomIndices_[i];
+  }
+}
+
+const std::string& ImageKey::getName() const {
+  return name_;
+}
+
+uint8_t ImageKey::getId() const {
+  return id_;
+}
+
+uint8_t ImageKey::getBloomIndex(size_t i) const {
+  // Fail b/c 'i' is out of bounds
+  assert(i < NUM_BLOOM_INDICES);
+
+  return bloomIndices_[i];
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "dht_packets.h"
+
+#define NUM_BLOOM_INDICES 3
+
+class ImageKey {
+
+  private:
+    /**
+     * Name of image file.
+     */
+    std::string name_;
+
+    /**
+     * Ring id of image, folded from the sha1 hash of its name.
+     */
+    uint8_t id_;
+
+    /**
+     * Bloom filter indices, derived from the sha1 hash of the name.
+     */
+    uint8_t bloomIndices_[NUM_BLOOM_INDICES];
+
+    /**
+     * deriveFromDigest()
+     * - Fold the sha1 hash of the name into the id and bloom indices.
+     * @param md : sha1 hash of the name
+     */
+    void deriveFromDigest(unsigned char * md);
+
+  public:
+    /**
+     * ImageKey()
+     * - Ctor for an empty ImageKey.
+     */
+    ImageKey();
+
+    /**
+     * ImageKey()
+     * - Hash the image name once, and derive the id and bloom indices.
+     * @param file_name : name of image file
+     */
+    explicit ImageKey(const std::string& file_name);
+
+    /**
+     * ImageKey()
+     * - Take the id and bloom indices computed by the node that sent the
+     *   image over the wire. The name is hashed for the indices only if the
+     *   sender didn't tag them as set.
+     * @param img : image from the network
+     */
+    explicit ImageKey(const dhtimg_t& img);
+
+    /**
+     * hashNames()
+     * - Return the keys of the names, hashed several at a time. Use it
+     *   over the single-name ctor when there are many names.
+     * @param file_names : names of image files
+     */
+    static std::vector<ImageKey> hashNames(const std::vector<std::string>& file_names);
+
+    /**
+     * serialize()
+     * - Write the name, id and tagged bloom indices into the wire format.
+     * @param img : image to fill
+     */
+    void serialize(dhtimg_t& img) const;
+
+    /**
+     * getName()
+     * - Return the name of the image file.
+     */
+    const std::string& getName() const;
+
+    /**
+     * getId()
+     * - Return the ring id of the image.
+     */
+    uint8_t getId() const;
+
+    /**
+     * getBloomIndex()
+     * - Return one of the image's bloom filter indices.
+     * @param i : which index, in [0, NUM_BLOOM_INDICES)
+     */
+    uint8_t getBloomIndex(size_t i) const;
+};
@@ -0,0 +1,521 @@
+#include "ImageReader.h"
+
+#include <iostream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#ifdef __APPLE__
+#include <GLUT/glut.h>
+#else
+#include <GL/glut.h>
+#endif
+
+#include "SocketException.h"
+#include "netimg_packets.h"
+#include "ltga.h"
+
+ImageReader::ImageReader(const ImageStore& store, size_t num_workers) :
+  store_(store),
+  isStopped_(false)
+{
+  if (::pipe(wakeFds_) == -1) {
+    std::cout << "Failed to create image reader pipe. Errno: " << errno << std::endl;
+    exit(1);
+  }
+
+  // Workers never wait on the loop, and the loop never waits on the workers
+  for (int fd : wakeFds_) {
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+
+  for (size_t root = 0; root < store_.getRoots().size(); ++root) {
+    disks_.push_back(std::unique_ptr<disk_t>(new disk_t()));
+  }
+
+  for (const std::unique_ptr<disk_t>& disk : disks_) {
+    disk_t* worker_disk = disk.get();
+    for (size_t i = 0; i < num_workers; ++i) {
+      workers_.push_back(std::thread([this, worker_disk] () { work(*worker_disk); }));
+    }
+  }
+}
+
+ImageReader::~ImageReader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    isStopped_ = true;
+  }
+
+  for (const std::unique_ptr<disk_t>& disk : disks_) {
+    disk->isPending.notify_all();
+  }
+
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+
+  // Nobody is left to send these images, so hang up on their clients
+  std::vector<const Connection*> abandoned;
+  for (const std::unique_ptr<disk_t>& disk : disks_) {
+    for (const job_t& job : disk->pending) {
+      abandoned.push_back(job.read.cxn);
+    }
+  }
+
+  for (const read_t& read : finished_) {
+    abandoned.push_back(read.cxn);
+    if (read.blobFd != -1) {
+      ::close(read.blobFd);
+    }
+  }
+
+  for (const Connection* cxn : abandoned) {
+    try {
+      cxn->close();
+    } catch (const SocketException& e) {
+      std::cout << "\t- Failed to close netimg client connection." << std::endl;
+    }
+
+    delete cxn;
+  }
+
+  ::close(wakeFds_[0]);
+  ::close(wakeFds_[1]);
+}
+
+int ImageReader::getFd() const {
+  return wakeFds_[0];
+}
+
+void ImageReader::submit(
+  const Connection* cxn,
+  const std::string& file_name,
+  bool accepts_rle
+) {
+  disk_t& disk = *disks_[store_.getStripe(file_name)];
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    disk.pending.push_back(job_t{read_t{cxn, file_name, accepts_rle, -1, 0, ""}, false});
+  }
+
+  disk.isPending.notify_one();
+}
+
+void ImageReader::encodeLater(const std::string& file_name) {
+  disk_t& disk = *disks_[store_.getStripe(file_name)];
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!disk.queuedEncodes.insert(file_name).second) {
+      return;
+    }
+
+    disk.encodes.push_back(file_name);
+  }
+
+  disk.isPending.notify_one();
+}
+
+std::vector<ImageReader::read_t> ImageReader::takeFinished() {
+  // Drain the wake-ups first. A read finished after this wakes us again.
+  char buf[64];
+  while (::read(wakeFds_[0], buf, sizeof(buf)) > 0) {}
+
+  std::vector<read_t> finished;
+  std::lock_guard<std::mutex> lock(mutex_);
+  finished.swap(finished_);
+  return finished;
+}
+
+void ImageReader::work(disk_t& disk) {
+  while (true) {
+    read_t read;
+    std::string encode_name;
+    std::vector<std::string> to_hint;
+
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      disk.isPending.wait(lock, [this, &disk] () {
+        return isStopped_ || !disk.pending.empty() || !disk.encodes.empty();
+      });
+
+      if (isStopped_) {
+        return;
+      }
+
+      // Clients are waiting on reads, but nobody is waiting on encodes
+      if (disk.pending.empty()) {
+        encode_name = disk.encodes.front();
+        disk.encodes.pop_front();
+        disk.queuedEncodes.erase(encode_name);
+      } else {
+        // Hint the reads queued behind this one too. During a cold burst the
+        // disk then works on many files at once, rather than one per worker.
+        std::deque<job_t>& pending = disk.pending;
+        for (size_t i = 0; i < pending.size() && i <= IMAGE_READAHEAD_DEPTH; ++i) {
+          if (!pending[i].isHinted) {
+            pending[i].isHinted = true;
+            to_hint.push_back(pending[i].read.file_name);
+          }
+        }
+
+        read = std::move(pending.front().read);
+        pending.pop_front();
+      }
+    }
+
+    if (!encode_name.empty()) {
+      size_t blob_size;
+      imsg_t header;
+      int blob_fd = openBlob(encode_name, blob_size, header);
+      if (blob_fd == -1) {
+        encode(encode_name);
+      } else {
+        ::close(blob_fd);
+      }
+
+      continue;
+    }
+
+    // Only the blob is read, unless it has to be encoded first
+    for (const std::string& file_name : to_hint) {
+      if (!hint(store_.getBlobPath(file_name))) {
+        hint(store_.getPath(file_name));
+      }
+    }
+
+    readImage(read);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      finished_.push_back(std::move(read));
+    }
+
+    // A full pipe already has a wake-up in it, so a failed write is fine
+    char wake = 0;
+    ssize_t len = ::write(wakeFds_[1], &wake, sizeof(wake));
+    (void) len;
+  }
+}
+
+bool ImageReader::hint(const std::string& path) const {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+
+#ifdef POSIX_FADV_WILLNEED
+  // Starts readahead of the whole file w/o waiting for it
+  ::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
+
+  ::close(fd);
+  return true;
+}
+
+void ImageReader::readImage(read_t& read) const {
+  imsg_t header;
+  read.blobFd = openBlob(read.file_name, read.blobSize, header);
+
+  if (read.blobFd != -1) {
+    // The loop sends the blob w/ sendfile(), so get it off the disk here
+    if (!header.im_rle || read.acceptsRle) {
+      if (faultIn(read.blobFd, read.blobSize)) {
+        return;
+      }
+
+      ::close(read.blobFd);
+      read.blobFd = -1;
+    } else {
+      // Decode this one in memory for a client that can't
+      read.blob.resize(read.blobSize);
+      bool is_read = ::pread(read.blobFd, &read.blob[0], read.blobSize, 0)
+          == (ssize_t) read.blobSize;
+
+      ::close(read.blobFd);
+      read.blobFd = -1;
+      if (is_read && decodeBlob(read.blob)) {
+        return;
+      }
+    }
+  }
+
+  // Send this one from memory. Later reads find the blob.
+  read.blob = encode(read.file_name);
+  if (!read.acceptsRle) {
+    decodeBlob(read.blob);
+  }
+}
+
+bool ImageReader::faultIn(int fd, size_t size) const {
+  // Discarded; the point is that the kernel keeps the pages
+  char buf[BLOB_FAULT_CHUNK];
+  size_t num_read = 0;
+  while (num_read < size) {
+    ssize_t len = ::pread(fd, buf, sizeof(buf), num_read);
+    if (len <= 0) {
+      return false;
+    }
+
+    num_read += len;
+  }
+
+  return true;
+}
+
+int ImageReader::openBlob(
+  const std::string& file_name,
+  size_t& blob_size,
+  imsg_t& header
+) const {
+  struct stat image_stat;
+  if (::stat(store_.getPath(file_name).c_str(), &image_stat) == -1) {
+    return -1;
+  }
+
+  int fd = ::open(store_.getBlobPath(file_name).c_str(), O_RDONLY);
+  if (fd == -1) {
+    return -1;
+  }
+
+  struct stat blob_stat;
+  bool is_valid = ::fstat(fd, &blob_stat) == 0
+      && ::pread(fd, &header, sizeof(header), 0) == sizeof(header);
+
+  // The blob must be whole, and encoded from this version of the image. Its
+  // pixels are only run-length encoded if that made them smaller, and then
+  // its type says so.
+  if (is_valid) {
+    struct timespec image_mtime = getMtime(image_stat);
+    struct timespec blob_mtime = getMtime(blob_stat);
+    size_t expected_size = sizeof(header) + (size_t) ntohs(header.im_width)
+        * ntohs(header.im_height) * header.im_depth;
+
+    is_valid = blob_mtime.tv_sec == image_mtime.tv_sec
+        && blob_mtime.tv_nsec == image_mtime.tv_nsec
+        && (header.im_rle != 0) == ((header.header.type & NETIMG_RLE_OK) != 0)
+        && (header.im_rle
+            ? (size_t) blob_stat.st_size < expected_size
+            : (size_t) blob_stat.st_size == expected_size);
+  }
+
+  if (!is_valid) {
+    ::close(fd);
+    return -1;
+  }
+
+  blob_size = blob_stat.st_size;
+  return fd;
+}
+
+std::string ImageReader::encode(const std::string& file_name) const {
+  std::string image_path = store_.getPath(file_name);
+
+  // Stat first, so that a change made while we encode makes the blob stale
+  struct stat image_stat;
+  bool has_stat = ::stat(image_path.c_str(), &image_stat) == 0;
+
+  LTGA ltga(image_path);
+
+  imsg_t message;
+  memset(&message, 0, sizeof(message));
+  message.header = {NETIMG_VERS, NETIMG_RPY};
+  message.im_found = FOUND;
+  message.im_depth = (unsigned char)(ltga.GetPixelDepth() / 8);
+  message.im_width = htons(ltga.GetImageWidth());
+  message.im_height = htons(ltga.GetImageHeight());
+
+  int alpha = ltga.GetAlphaDepth();
+  int greyscale = ltga.GetImageType();
+  greyscale = (greyscale == 3 || greyscale == 11);
+  if (greyscale) {
+    message.im_format = alpha ? GL_LUMINANCE_ALPHA : GL_LUMINANCE;
+  } else {
+    message.im_format = alpha ? GL_RGBA : GL_RGB;
+  }
+
+  message.im_format = htons(message.im_format);
+
+  if (!ltga.IsLoaded()) {
+    return std::string((char *) &message, sizeof(message));
+  }
+
+  const unsigned char* pixels = ltga.GetPixels();
+  size_t num_pixels = (size_t) ltga.GetImageWidth() * ltga.GetImageHeight();
+  size_t pixels_size = num_pixels * message.im_depth;
+
+  // Graphics shrink a lot; noisy photos don't, and are sent raw
+  std::string packets = rleEncode(pixels, num_pixels, message.im_depth);
+  message.im_rle = packets.size() < pixels_size;
+  if (message.im_rle) {
+    message.header.type |= NETIMG_RLE_OK;
+  }
+
+  std::string blob((char *) &message, sizeof(message));
+  if (message.im_rle) {
+    blob.append(packets);
+  } else {
+    blob.append((const char *) pixels, pixels_size);
+  }
+
+  if (has_stat && saveBlob(file_name, blob, getMtime(image_stat))) {
+    // Report that the image won't need to be encoded again
+    std::cout << "\t- Encoded image for the wire: " << file_name << std::endl;
+  }
+
+  return blob;
+}
+
+bool ImageReader::decodeBlob(std::string& blob) {
+  imsg_t header;
+  memcpy(&header, blob.data(), sizeof(header));
+  if (!header.im_rle) {
+    return true;
+  }
+
+  size_t num_pixels = (size_t) ntohs(header.im_width) * ntohs(header.im_height);
+  header.header.type = NETIMG_RPY;
+  header.im_rle = 0;
+
+  std::string raw((char *) &header, sizeof(header));
+  raw.resize(sizeof(header) + num_pixels * header.im_depth);
+
+  bool is_decoded = rleDecode(
+      (const unsigned char *) blob.data() + sizeof(header),
+      blob.size() - sizeof(header),
+      (unsigned char *) &raw[sizeof(header)],
+      num_pixels,
+      header.im_depth);
+
+  if (is_decoded) {
+    blob.swap(raw);
+  }
+
+  return is_decoded;
+}
+
+std::string ImageReader::rleEncode(
+  const unsigned char* pixels,
+  size_t num_pixels,
+  size_t depth
+) {
+  std::string packets;
+  size_t i = 0;
+  while (i < num_pixels) {
+    size_t count = 1;
+    while (i + count < num_pixels && count < NETIMG_RLE_MAX_PIXELS
+        && memcmp(pixels + i * depth, pixels + (i + count) * depth, depth) == 0) {
+      ++count;
+    }
+
+    if (count > 1) {
+      packets += (char) (NETIMG_RLE_RUN | (count - 1));
+      packets.append((const char *) pixels + i * depth, depth);
+      i += count;
+      continue;
+    }
+
+    // Take raw pixels up to the start of the next run
+    while (i + count < num_pixels && count < NETIMG_RLE_MAX_PIXELS
+        && !(i + count + 1 < num_pixels
+            && memcmp(pixels + (i + count) * depth,
+                pixels + (i + count + 1) * depth, depth) == 0)) {
+      ++count;
+    }
+
+    packets += (char) (count - 1);
+    packets.append((const char *) pixels + i * depth, count * depth);
+    i += count;
+  }
+
+  return packets;
+}
+
+bool ImageReader::rleDecode(
+  const unsigned char* packets,
+  size_t size,
+  unsigned char* pixels,
+  size_t num_pixels,
+  size_t depth
+) {
+  size_t i = 0;
+  size_t num_decoded = 0;
+  while (i < size) {
+    size_t count = (size_t) (packets[i] & (NETIMG_RLE_RUN - 1)) + 1;
+    bool is_run = packets[i] & NETIMG_RLE_RUN;
+    size_t packet_size = 1 + (is_run ? depth : count * depth);
+    if (i + packet_size > size || num_decoded + count > num_pixels) {
+      return false;
+    }
+
+    unsigned char* out = pixels + num_decoded * depth;
+    if (is_run) {
+      for (size_t j = 0; j < count; ++j) {
+        memcpy(out + j * depth, packets + i + 1, depth);
+      }
+    } else {
+      memcpy(out, packets + i + 1, count * depth);
+    }
+
+    num_decoded += count;
+    i += packet_size;
+  }
+
+  return num_decoded == num_pixels;
+}
+
+bool ImageReader::saveBlob(
+  const std::string& file_name,
+  const std::string& blob,
+  const struct timespec& mtime
+) const {
+  std::string folder = store_.getBlobFolder(file_name);
+  if (::mkdir(folder.c_str(), 0755) == -1 && errno != EEXIST) {
+    return false;
+  }
+
+  // Write a temp file, then move it into place in one step
+  std::string blob_path = store_.getBlobPath(file_name);
+  std::string temp_path = blob_path + ".XXXXXX";
+  int fd = ::mkstemp(&temp_path[0]);
+  if (fd == -1) {
+    return false;
+  }
+
+  size_t num_written = 0;
+  while (num_written < blob.size()) {
+    ssize_t len = ::write(fd, blob.data() + num_written, blob.size() - num_written);
+    if (len <= 0) {
+      break;
+    }
+
+    num_written += len;
+  }
+
+  struct timespec times[2] = {mtime, mtime};
+  bool is_saved = num_written == blob.size()
+      && ::fchmod(fd, 0644) == 0
+      && ::futimens(fd, times) == 0;
+
+  is_saved = (::close(fd) == 0) && is_saved;
+  is_saved = is_saved && ::rename(temp_path.c_str(), blob_path.c_str()) == 0;
+
+  if (!is_saved) {
+    ::unlink(temp_path.c_str());
+  }
+
+  return is_saved;
+}
+
+struct timespec ImageReader::getMtime(const struct stat& file_stat) {
+#ifdef __APPLE__
+  return file_stat.st_mtimespec;
+#else
+  return file_stat.st_mtim;
+#endif
+}
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
+#include <sys/stat.h>
+
+#include "Connection.h"
+#include "ImageStore.h"
+#include "netimg_packets.h"
+
+#define NUM_IMAGE_READERS 4       // per image root
+#define IMAGE_READAHEAD_DEPTH 16  // queued reads to hint to the kernel early
+#define BLOB_FAULT_CHUNK 65536    // bytes read at a time to bring a blob into memory
+
+class ImageReader {
+
+  public:
+    /**
+     * Image read on behalf of a netimg client. The reply is either the
+     * image's blob on disk, or held in memory if there's no blob or the
+     * client can't take the blob as is.
+     */
+    struct read_t {
+      const Connection* cxn;  // client waiting for the image
+      std::string file_name;
+      bool acceptsRle;        // client decodes run-length encoded pixels
+      int blobFd;             // -1 if the reply is in 'blob'
+      size_t blobSize;
+      std::string blob;
+    };
+
+  private:
+    /**
+     * Read waiting for a worker, and whether the kernel has been told
+     * that we'll want its file soon.
+     */
+    struct job_t {
+      read_t read;
+      bool isHinted;
+    };
+
+    /**
+     * Work waiting on one root's disk, and the signal that more was queued.
+     * Clients' reads go first; blobs are encoded when there's nothing else
+     * to do.
+     */
+    struct disk_t {
+      std::deque<job_t> pending;
+      std::deque<std::string> encodes;
+      std::unordered_set<std::string> queuedEncodes;
+      std::condition_variable isPending;
+    };
+
+    /**
+     * Where the images live.
+     */
+    ImageStore store_;
+
+    /**
+     * One per root. Each root has its own workers, so that the disks are
+     * read in parallel and a slow one doesn't hold up the others.
+     */
+    std::vector<std::unique_ptr<disk_t>> disks_;
+
+    /**
+     * Reads that are done, but not yet taken by the event loop.
+     */
+    std::vector<read_t> finished_;
+
+    /**
+     * Guards the queues in 'disks_', 'finished_' and 'isStopped_'.
+     */
+    std::mutex mutex_;
+
+    /**
+     * Set to make the workers return.
+     */
+    bool isStopped_;
+
+    /**
+     * Pipe that wakes the event loop when a read is done. The loop
+     * selects on [0]; workers write to [1].
+     */
+    int wakeFds_[2];
+
+    std::vector<std::thread> workers_;
+
+    /**
+     * work()
+     * - Run reads from one root until stopped. Body of each worker thread.
+     * @param disk : queue of the worker's root
+     */
+    void work(disk_t& disk);
+
+    /**
+     * hint()
+     * - Tell the kernel to start reading a file into the page cache, so
+     *   that the read that follows doesn't wait on the disk.
+     * @param path : path of file
+     * @return false iff the file couldn't be opened
+     */
+    bool hint(const std::string& path) const;
+
+    /**
+     * readImage()
+     * - Fill in the reply to a client: open the image's blob and bring it
+     *   into memory, encoding it first if it's missing or stale. A run-
+     *   length encoded blob is decoded in memory for clients that can't
+     *   decode it.
+     * @param read : read to fill in
+     */
+    void readImage(read_t& read) const;
+
+    /**
+     * faultIn()
+     * - Read a blob through the page cache, so that sending it later
+     *   doesn't wait on the disk. A fadvise() hint alone may not be acted on.
+     * @param fd : fd of blob
+     * @param size : size of blob in bytes
+     * @return false iff the blob couldn't be read
+     */
+    bool faultIn(int fd, size_t size) const;
+
+    /**
+     * openBlob()
+     * - Return an fd of the image's blob, or -1 if it's missing, cut
+     *   short, or was encoded from a different version of the image.
+     * @param file_name : name of image file
+     * @param blob_size : size of the blob is written here
+     * @param header : header of the blob is written here
+     */
+    int openBlob(const std::string& file_name, size_t& blob_size, imsg_t& header) const;
+
+    /**
+     * encode()
+     * - Return the image laid out as sent to netimg clients: the imsg_t
+     *   header in network byte order, then the pixels. The pixels are run-
+     *   length encoded iff that makes them smaller. Store it as the image's
+     *   blob too, so that this is done once per image.
+     * @param file_name : name of image file
+     */
+    std::string encode(const std::string& file_name) const;
+
+    /**
+     * decodeBlob()
+     * - Replace a run-length encoded blob w/ its raw pixels. Does nothing
+     *   to a raw blob.
+     * @param blob : blob, header first
+     * @return false iff the packets don't fill the image exactly
+     */
+    static bool decodeBlob(std::string& blob);
+
+    /**
+     * rleEncode()
+     * - Return pixels as TGA-style RLE packets. Each starts w/ a byte that
+     *   holds its pixel count - 1. If NETIMG_RLE_RUN is set, one pixel
+     *   follows that repeats count times, else count raw pixels follow.
+     * @param pixels : pixels to encode
+     * @param num_pixels : number of pixels
+     * @param depth : bytes per pixel
+     */
+    static std::string rleEncode(
+        const unsigned char* pixels,
+        size_t num_pixels,
+        size_t depth);
+
+    /**
+     * rleDecode()
+     * - Decode RLE packets made by rleEncode().
+     * @param packets : packets to decode
+     * @param size : size of packets in bytes
+     * @param pixels : decoded pixels are written here
+     * @param num_pixels : number of pixels that 'pixels' holds
+     * @param depth : bytes per pixel
+     * @return false iff the packets don't fill 'pixels' exactly
+     */
+    static bool rleDecode(
+        const unsigned char* packets,
+        size_t size,
+        unsigned char* pixels,
+        size_t num_pixels,
+        size_t depth);
+
+    /**
+     * saveBlob()
+     * - Store the image's blob. Readers never see a partial blob.
+     * @param file_name : name of image file
+     * @param blob : encoded image
+     * @param mtime : modification time of the image the blob was encoded
+     *                from. The blob gets it too, so that a changed image
+     *                no longer matches.
+     * @return true iff the blob was stored
+     */
+    bool saveBlob(
+        const std::string& file_name,
+        const std::string& blob,
+        const struct timespec& mtime) const;
+
+    /**
+     * getMtime()
+     * - Return the modification time of a file, as precisely as the
+     *   platform tracks it.
+     * @param file_stat : stat of file
+     */
+    static struct timespec getMtime(const struct stat& file_stat);
+
+  public:
+    /**
+     * ImageReader()
+     * - Ctor for ImageReader. Starts the worker threads.
+     * @param store : where the images live
+     * @param num_workers : number of reads to block on each root at once
+     */
+    ImageReader(const ImageStore& store, size_t num_workers);
+
+    /**
+     * ~ImageReader()
+     * - Dtor for ImageReader. Stops the workers and closes the
+     *   connections of reads that were never taken.
+     */
+    ~ImageReader();
+
+    ImageReader(const ImageReader&) = delete;
+    ImageReader& operator=(const ImageReader&) = delete;
+
+    /**
+     * getFd()
+     * - Return the fd that becomes readable when reads are done.
+     */
+    int getFd() const;
+
+    /**
+     * submit()
+     * - Queue a read of an image for a client. Doesn't block on the disk.
+     * @param cxn : client waiting for the image. Owned by the read until
+     *              it's taken.
+     * @param file_name : name of image file
+     * @param accepts_rle : true iff the client decodes run-length encoded
+     *                      pixels
+     */
+    void submit(const Connection* cxn, const std::string& file_name, bool accepts_rle);
+
+    /**
+     * encodeLater()
+     * - Queue the encoding of an image's blob, so that its first client
+     *   doesn't wait on it. Does nothing if the blob is up to date.
+     * @param file_name : name of image file
+     */
+    void encodeLater(const std::string& file_name);
+
+    /**
+     * takeFinished()
+     * - Return the reads that are done, oldest first. Doesn't block. The
+     *   caller closes their blob fds.
+     */
+    std::vector<read_t> takeFinished();
+};
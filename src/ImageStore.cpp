@@ -0,0 +1,55 @@
+#include "ImageStore.h"
+
+#include <stdint.h>
+#include <assert.h>
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+ImageStore::ImageStore(const std::vector<std::string>& roots) :
+  roots_(roots)
+{
+  // Fail b/c images need somewhere to live
+  assert(!roots_.empty() && roots_.size() <= MAX_IMAGE_ROOTS);
+
+  for (std::string& root : roots_) {
+    if (root.empty() || root.back() != '/') {
+      root += '/';
+    }
+  }
+}
+
+const std::vector<std::string>& ImageStore::getRoots() const {
+  return roots_;
+}
+
+size_t ImageStore::getStripe(const std::string& file_name) const {
+  if (roots_.size() == 1) {
+    return 0;
+  }
+
+  // FNV-1a rather than std::hash, b/c files are placed by it and it must
+  // not change between builds
+  uint32_t hash = FNV_OFFSET_BASIS;
+  for (unsigned char c : file_name) {
+    hash = (hash ^ c) * FNV_PRIME;
+  }
+
+  return hash % roots_.size();
+}
+
+std::string ImageStore::getPath(const std::string& file_name) const {
+  return roots_[getStripe(file_name)] + file_name;
+}
+
+std::string ImageStore::getBlobFolder(const std::string& file_name) const {
+  return roots_[getStripe(file_name)] + IMAGE_BLOB_FOLDER;
+}
+
+std::string ImageStore::getBlobPath(const std::string& file_name) const {
+  return getBlobFolder(file_name) + file_name + IMAGE_BLOB_SUFFIX;
+}
+
+std::string ImageStore::getManifestPath() const {
+  return roots_.front() + IMAGE_MANIFEST_FILE_NAME;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#define IMAGE_FOLDER "images/"  // root when none are specified
+#define IMAGE_MANIFEST_FILE_NAME "FILELIST.txt"
+#define IMAGE_BLOB_FOLDER "imsg/"  // within each root
+#define IMAGE_BLOB_SUFFIX ".imsg"
+#define MAX_IMAGE_ROOTS 16
+
+class ImageStore {
+
+  private:
+    /**
+     * Folders that hold the images, each ending in '/'. The first one also
+     * holds the manifest.
+     */
+    std::vector<std::string> roots_;
+
+  public:
+    /**
+     * ImageStore()
+     * - Ctor for ImageStore. Images are striped across the roots by the
+     *   hash of their name.
+     * @param roots : image folders, usually one per disk
+     */
+    explicit ImageStore(const std::vector<std::string>& roots);
+
+    /**
+     * getRoots()
+     * - Return the image folders.
+     */
+    const std::vector<std::string>& getRoots() const;
+
+    /**
+     * getStripe()
+     * - Return the index of the root that holds the image.
+     * @param file_name : name of image file
+     */
+    size_t getStripe(const std::string& file_name) const;
+
+    /**
+     * getPath()
+     * - Return the path of the image within its root.
+     * @param file_name : name of image file
+     */
+    std::string getPath(const std::string& file_name) const;
+
+    /**
+     * getBlobFolder()
+     * - Return the folder that holds the image's wire-format blob. It's in
+     *   the image's root, so that the blob is read from the same disk.
+     * @param file_name : name of image file
+     */
+    std::string getBlobFolder(const std::string& file_name) const;
+
+    /**
+     * getBlobPath()
+     * - Return the path of the image's wire-format blob.
+     * @param file_name : name of image file
+     */
+    std::string getBlobPath(const std::string& file_name) const;
+
+    /**
+     * getManifestPath()
+     * - Return the path of the manifest, which lists the images of every
+     *   root.
+     */
+    std::string getManifestPath() const;
+};
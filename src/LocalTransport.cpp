@@ -0,0 +1,110 @@
+#include "LocalTransport.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+
+LocalTransport::~LocalTransport() {
+  while (!inboxes_.empty()) {
+    closeInbox(inboxes_.begin()->first);
+  }
+}
+
+uint64_t LocalTransport::toAddress(uint16_t port, uint32_t ipv4) {
+  return (static_cast<uint64_t>(ipv4) << 16) | port;
+}
+
+int LocalTransport::openInbox(uint16_t port, uint32_t ipv4) {
+  int wake_fds[2];
+  if (::pipe(wake_fds) == -1) {
+    std::cout << "Failed to create local transport pipe. Errno: " << errno << std::endl;
+    exit(1);
+  }
+
+  // The owner checks for pending connections before reading
+  ::fcntl(wake_fds[0], F_SETFL, ::fcntl(wake_fds[0], F_GETFL) | O_NONBLOCK);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  inboxes_[wake_fds[0]] = inbox_t{port, ipv4, wake_fds[1], std::deque<int>()};
+  addresses_[toAddress(port, ipv4)] = wake_fds[0];
+  return wake_fds[0];
+}
+
+void LocalTransport::moveInbox(int inbox_fd, uint16_t port, uint32_t ipv4) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  inbox_t& inbox = inboxes_.at(inbox_fd);
+
+  addresses_.erase(toAddress(inbox.port, inbox.ipv4));
+  inbox.port = port;
+  inbox.ipv4 = ipv4;
+  addresses_[toAddress(port, ipv4)] = inbox_fd;
+}
+
+void LocalTransport::closeInbox(int inbox_fd) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  inbox_t& inbox = inboxes_.at(inbox_fd);
+
+  // Senders see a closed connection, as they would w/ a closed socket
+  for (int fd : inbox.pending) {
+    ::close(fd);
+  }
+
+  addresses_.erase(toAddress(inbox.port, inbox.ipv4));
+  ::close(inbox.wakeFd);
+  ::close(inbox_fd);
+  inboxes_.erase(inbox_fd);
+}
+
+bool LocalTransport::hasInbox(uint16_t port, uint32_t ipv4) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return addresses_.count(toAddress(port, ipv4)) > 0;
+}
+
+Connection LocalTransport::connect(uint16_t port, uint32_t ipv4) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto address_it = addresses_.find(toAddress(port, ipv4));
+  if (address_it == addresses_.end()) {
+    throw SocketException("No local node at the address.");
+  }
+
+  int fds[2];
+  if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    throw SocketException("Failed to create local socket pair.");
+  }
+
+  // Wake the owner on the first pending connection only, so that the
+  // pipe never fills up
+  inbox_t& inbox = inboxes_.at(address_it->second);
+  inbox.pending.push_back(fds[1]);
+  if (inbox.pending.size() == 1) {
+    char wake = 0;
+    ssize_t len = ::write(inbox.wakeFd, &wake, sizeof(wake));
+    (void) len;
+  }
+
+  return Connection(fds[0], 0, ipv4, port, ipv4);
+}
+
+Connection LocalTransport::accept(int inbox_fd) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  inbox_t& inbox = inboxes_.at(inbox_fd);
+
+  // Fail b/c the inbox's fd wasn't readable
+  assert(!inbox.pending.empty());
+
+  int fd = inbox.pending.front();
+  inbox.pending.pop_front();
+
+  // Stay readable while there's more to accept
+  if (inbox.pending.empty()) {
+    char wake;
+    ssize_t len = ::read(inbox_fd, &wake, sizeof(wake));
+    (void) len;
+  }
+
+  return Connection(fd, inbox.port, inbox.ipv4, 0, inbox.ipv4);
+}
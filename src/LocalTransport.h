@@ -0,0 +1,111 @@
+#pragma once
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+
+#include "Connection.h"
+#include "SocketException.h"
+
+class LocalTransport {
+
+  private:
+    /**
+     * Connections waiting for a dht node in this process to accept them.
+     */
+    struct inbox_t {
+      uint16_t port;    // dht address of the node in host-byte-order
+      uint32_t ipv4;    // host-byte-order
+      int wakeFd;       // write end of the pipe that the node selects on
+      std::deque<int> pending;
+    };
+
+    /**
+     * Inboxes by the read end of their pipe. The pipe holds a byte iff
+     * the inbox has pending connections.
+     */
+    std::map<int, inbox_t> inboxes_;
+
+    /**
+     * Read end of each inbox's pipe by dht address.
+     */
+    std::map<uint64_t, int> addresses_;
+
+    /**
+     * Guards 'inboxes_' and 'addresses_'. Shards connect to each other
+     * from their own threads.
+     */
+    mutable std::mutex mutex_;
+
+    /**
+     * toAddress()
+     * - Return the key of a dht address in 'addresses_'.
+     * @param port : port in host-byte-order
+     * @param ipv4 : ipv4 in host-byte-order
+     */
+    static uint64_t toAddress(uint16_t port, uint32_t ipv4);
+
+  public:
+    LocalTransport() {}
+
+    /**
+     * ~LocalTransport()
+     * - Dtor for LocalTransport. Closes the inboxes that are left.
+     */
+    ~LocalTransport();
+
+    LocalTransport(const LocalTransport&) = delete;
+    LocalTransport& operator=(const LocalTransport&) = delete;
+
+    /**
+     * openInbox()
+     * - Accept local connections to a dht address.
+     * @param port : port of dht receiver in host-byte-order
+     * @param ipv4 : ipv4 of dht receiver in host-byte-order
+     * @return fd that is readable while connections are pending
+     */
+    int openInbox(uint16_t port, uint32_t ipv4);
+
+    /**
+     * moveInbox()
+     * - Accept local connections to a new dht address, e.g. after the
+     *   node rebound its receiver.
+     * @param inbox_fd : fd returned by openInbox()
+     * @param port : new port of dht receiver in host-byte-order
+     * @param ipv4 : new ipv4 of dht receiver in host-byte-order
+     */
+    void moveInbox(int inbox_fd, uint16_t port, uint32_t ipv4);
+
+    /**
+     * closeInbox()
+     * - Stop accepting local connections and hang up on pending ones.
+     * @param inbox_fd : fd returned by openInbox()
+     */
+    void closeInbox(int inbox_fd);
+
+    /**
+     * hasInbox()
+     * - Return true iff a node in this process accepts connections to
+     *   the dht address.
+     * @param port : port in host-byte-order
+     * @param ipv4 : ipv4 in host-byte-order
+     */
+    bool hasInbox(uint16_t port, uint32_t ipv4) const;
+
+    /**
+     * connect()
+     * - Connect to a node in this process w/o going through TCP.
+     * @param port : port of node's dht receiver in host-byte-order
+     * @param ipv4 : ipv4 of node's dht receiver in host-byte-order
+     */
+    Connection connect(uint16_t port, uint32_t ipv4);
+
+    /**
+     * accept()
+     * - Take the oldest pending connection. Call once the inbox's fd
+     *   is readable.
+     * @param inbox_fd : fd returned by openInbox()
+     */
+    Connection accept(int inbox_fd);
+};
@@ -44,6 +44,10 @@ uint32_t ServerBuilder::getRemoteIpv4Address() const {
   return remoteIpv4Address_;
 }
 
+bool ServerBuilder::hasRemoteIpv4Address() const {
+  return hasRemoteIpv4Address_;
+}
+
 ServerBuilder& ServerBuilder::enableAddressReuse() {
   shouldEnableAddressReuse_ = true;
   return *this;
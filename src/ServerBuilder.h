@@ -100,6 +100,12 @@ class ServerBuilder {
      */
     uint32_t getRemoteIpv4Address() const;
 
+    /**
+     * hasRemoteIpv4Address()
+     * - Return true iff the remote's ipv4 address has been specified.
+     */
+    bool hasRemoteIpv4Address() const;
+
     /**
      * enableAddressReuse()
      * - Configure socket for address reuse.
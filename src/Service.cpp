@@ -119,6 +119,21 @@ const Connection* Service::acceptNew() const {
   return new Connection(fd);
 }
 
+bool Service::hasPendingConnection() const {
+  fd_set sd_set;
+  FD_ZERO(&sd_set);
+  FD_SET(fileDescriptor_, &sd_set);
+
+  // Poll w/o waiting
+  struct timeval timeout = {0, 0};
+  int result = ::select(fileDescriptor_ + 1, &sd_set, 0, 0, &timeout);
+  if (result == -1) {
+    throw SocketException("Failed to poll for pending connections.");
+  }
+
+  return result == 1;
+}
+
 void Service::close() const {
   if (::close(fileDescriptor_) == -1) {
     throw SocketException("Failed to clost socket");
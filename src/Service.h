@@ -115,6 +115,13 @@ class Service {
      */
     const Connection* acceptNew() const;
 
+    /**
+     * hasPendingConnection()
+     * - Return true iff a client is waiting to be accepted, i.e. accept()
+     *   won't block.
+     */
+    bool hasPendingConnection() const;
+
     /**
      * close()
      * - Closes socket.
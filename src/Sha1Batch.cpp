@@ -0,0 +1,155 @@
+#include "Sha1Batch.h"
+
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+
+/**
+ * One 32-bit word of every lane. GCC lowers operations on it to AVX2 or
+ * SSE2, whichever the function is compiled for.
+ */
+typedef uint32_t lanes_t __attribute__((vector_size(SHA1_BATCH_LANES * sizeof(uint32_t))));
+
+/**
+ * Compile the compression function for AVX2 and for the baseline ISA, and
+ * pick one at load time. SHA1_BATCH_NO_CLONES keeps the baseline only.
+ */
+#if defined(__x86_64__) && defined(__linux__) && !defined(SHA1_BATCH_NO_CLONES)
+#define SHA1_BATCH_TARGETS __attribute__((target_clones("avx2", "default")))
+#else
+#define SHA1_BATCH_TARGETS
+#endif
+
+#define SHA1_NUM_ROUNDS 80
+
+static const uint32_t SHA1_INIT[] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+static const uint32_t SHA1_K[] = {0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6};
+
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/**
+ * compress()
+ * - Fold one 64-byte block of every lane into the lane's state.
+ * @param state : five state words of every lane
+ * @param block : sixteen message words of every lane
+ * @param active : all ones for lanes whose message has this block, zero
+ *                 for lanes that are done
+ */
+SHA1_BATCH_TARGETS
+static void compress(lanes_t* state, const lanes_t* block, const lanes_t* active) {
+  lanes_t w[SHA1_NUM_ROUNDS];
+  for (int t = 0; t < 16; ++t) {
+    w[t] = block[t];
+  }
+
+  for (int t = 16; t < SHA1_NUM_ROUNDS; ++t) {
+    w[t] = ROTL(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+  }
+
+  lanes_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+  for (int t = 0; t < SHA1_NUM_ROUNDS; ++t) {
+    lanes_t f;
+    if (t < 20) {
+      f = (b & c) | (~b & d);
+    } else if (t < 40 || t >= 60) {
+      f = b ^ c ^ d;
+    } else {
+      f = (b & c) | (b & d) | (c & d);
+    }
+
+    lanes_t temp = ROTL(a, 5) + f + e + SHA1_K[t / 20] + w[t];
+    e = d;
+    d = c;
+    c = ROTL(b, 30);
+    b = a;
+    a = temp;
+  }
+
+  // Lanes that are done keep their state
+  state[0] += a & *active;
+  state[1] += b & *active;
+  state[2] += c & *active;
+  state[3] += d & *active;
+  state[4] += e & *active;
+}
+
+void Sha1Batch::hashLanes(
+  const std::string* messages,
+  size_t num_messages,
+  digest_t* digests
+) {
+  // Fail b/c there are more messages than lanes
+  assert(num_messages <= SHA1_BATCH_LANES);
+
+  size_t num_blocks[SHA1_BATCH_LANES] = {0};
+  size_t max_blocks = 0;
+
+  for (size_t lane = 0; lane < num_messages; ++lane) {
+    num_blocks[lane] = (messages[lane].size() + 8) / SHA1_BLOCK_SIZE + 1;
+    max_blocks = std::max(max_blocks, num_blocks[lane]);
+  }
+
+  // Pad every message: 0x80, zeros, then the length in bits (big-endian)
+  size_t lane_size = max_blocks * SHA1_BLOCK_SIZE;
+  std::vector<unsigned char> padded(num_messages * lane_size, 0);
+
+  for (size_t lane = 0; lane < num_messages; ++lane) {
+    const std::string& message = messages[lane];
+    unsigned char* bytes = &padded[lane * lane_size];
+
+    memcpy(bytes, message.data(), message.size());
+    bytes[message.size()] = 0x80;
+
+    uint64_t num_bits = (uint64_t) message.size() * 8;
+    for (int i = 0; i < 8; ++i) {
+      bytes[num_blocks[lane] * SHA1_BLOCK_SIZE - 1 - i] = num_bits >> (8 * i);
+    }
+  }
+
+  lanes_t state[5];
+  for (int i = 0; i < 5; ++i) {
+    state[i] = lanes_t{} + SHA1_INIT[i];
+  }
+
+  for (size_t blk = 0; blk < max_blocks; ++blk) {
+    lanes_t block[16] = {};
+    lanes_t active = {};
+
+    // Transpose: word 't' of every lane's block goes into block[t]
+    for (size_t lane = 0; lane < num_messages; ++lane) {
+      if (blk >= num_blocks[lane]) {
+        continue;
+      }
+
+      active[lane] = UINT32_MAX;
+      const unsigned char* bytes = &padded[lane * lane_size + blk * SHA1_BLOCK_SIZE];
+      for (int t = 0; t < 16; ++t) {
+        block[t][lane] = (uint32_t) bytes[4 * t] << 24 | (uint32_t) bytes[4 * t + 1] << 16
+            | (uint32_t) bytes[4 * t + 2] << 8 | (uint32_t) bytes[4 * t + 3];
+      }
+    }
+
+    compress(state, block, &active);
+  }
+
+  for (size_t lane = 0; lane < num_messages; ++lane) {
+    for (int i = 0; i < 5; ++i) {
+      uint32_t word = state[i][lane];
+      digests[lane].md[4 * i] = word >> 24;
+      digests[lane].md[4 * i + 1] = word >> 16;
+      digests[lane].md[4 * i + 2] = word >> 8;
+      digests[lane].md[4 * i + 3] = word;
+    }
+  }
+}
+
+std::vector<Sha1Batch::digest_t> Sha1Batch::digest(const std::vector<std::string>& messages) {
+  std::vector<digest_t> digests(messages.size());
+  for (size_t i = 0; i < messages.size(); i += SHA1_BATCH_LANES) {
+    size_t num_messages = std::min((size_t) SHA1_BATCH_LANES, messages.size() - i);
+    hashLanes(&messages[i], num_messages, &digests[i]);
+  }
+
+  return digests;
+}
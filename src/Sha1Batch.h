@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+
+#define SHA1_BATCH_LANES 8   // messages hashed side by side
+#define SHA1_BLOCK_SIZE 64
+
+class Sha1Batch {
+
+  public:
+    /**
+     * SHA1 hash of one message.
+     */
+    struct digest_t {
+      unsigned char md[SHA1_MDLEN];
+    };
+
+  private:
+    /**
+     * hashLanes()
+     * - Hash up to SHA1_BATCH_LANES messages at once, one message per
+     *   vector lane.
+     * @param messages : messages to hash
+     * @param num_messages : number of messages, at most SHA1_BATCH_LANES
+     * @param digests : digest of each message is written here
+     */
+    static void hashLanes(
+        const std::string* messages,
+        size_t num_messages,
+        digest_t* digests);
+
+  public:
+    /**
+     * digest()
+     * - Return the SHA1 hash of every message. Same output as SHA1(), but
+     *   hashes SHA1_BATCH_LANES messages per pass w/SIMD (AVX2 where the
+     *   cpu has it).
+     * @param messages : messages to hash
+     */
+    static std::vector<digest_t> digest(const std::vector<std::string>& messages);
+};
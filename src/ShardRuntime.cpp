@@ -0,0 +1,209 @@
+#include "ShardRuntime.h"
+
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+#include <assert.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+ShardRuntime::ShardRuntime(
+  size_t num_shards,
+  size_t num_virtual_nodes,
+  bool has_id,
+  uint8_t id,
+  const ImageStore& image_store
+) :
+  hasTarget_(false),
+  isFirstStopped_(false)
+{
+  // Run one shard per core, if not specified
+  if (!num_shards) {
+    num_shards = std::max(1u, std::thread::hardware_concurrency());
+    num_shards = std::min(num_shards, (size_t) MAX_SHARDS);
+  }
+
+  // Fail b/c shard count is out of bounds
+  assert(num_shards <= MAX_SHARDS);
+
+  for (size_t i = 0; i < num_shards; ++i) {
+    // Report that we're starting a new shard
+    std::cout << "Creating shard " << i << "..." << std::endl;
+
+    DhtNode* shard = (i == 0 && has_id)
+        ? new DhtNode(id, image_store)
+        : new DhtNode(image_store);
+
+    shard->hostVirtualNodes(num_virtual_nodes);
+
+    // Only the first shard takes commands from stdin
+    if (i) {
+      shard->disableCli();
+    }
+
+    shards_.push_back(shard);
+  }
+
+  // Shards talk to each other in-process
+  if (num_shards > 1) {
+    for (DhtNode* shard : shards_) {
+      shard->setLocalTransport(&transport_);
+    }
+  }
+
+  joined_ = std::vector<std::promise<void>>(num_shards);
+}
+
+void ShardRuntime::joinNetwork(const std::vector<seed_t>& seeds) {
+  hasTarget_ = true;
+  seeds_ = seeds;
+}
+
+void ShardRuntime::enableSnapshots(const std::string& path) {
+  for (size_t i = 0; i < shards_.size(); ++i) {
+    shards_.at(i)->enableSnapshots(i ? path + "." + std::to_string(i) : path);
+  }
+}
+
+void ShardRuntime::enableHedging(size_t delay_msec) {
+  for (DhtNode* shard : shards_) {
+    shard->enableHedging(delay_msec);
+  }
+}
+
+void ShardRuntime::enableIterativeLookups(size_t alpha) {
+  for (DhtNode* shard : shards_) {
+    shard->enableIterativeLookups(alpha);
+  }
+}
+
+void ShardRuntime::enableProximityRouting(size_t slack_ids) {
+  for (DhtNode* shard : shards_) {
+    shard->enableProximityRouting(slack_ids);
+  }
+}
+
+void ShardRuntime::delayPeers(const std::vector<peer_delay_t>& delays) {
+  for (DhtNode* shard : shards_) {
+    shard->delayPeers(delays);
+  }
+}
+
+void ShardRuntime::pinToCore(size_t core) {
+#ifdef __linux__
+  unsigned int num_cores = std::max(1u, std::thread::hardware_concurrency());
+
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(core % num_cores, &cpu_set);
+
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set)) {
+    std::cout << "\t- Failed to pin shard to core " << core % num_cores << std::endl;
+  }
+#endif
+}
+
+void ShardRuntime::startShard(size_t idx) {
+  // Fail b/c shard 0 runs on the calling thread
+  assert(idx > 0 && idx < shards_.size());
+
+  DhtNode* shard = shards_.at(idx);
+  std::promise<void>& joined = joined_.at(idx);
+  shard->setJoinedCallback([&joined] () { joined.set_value(); });
+
+  // Enter the ring through the first shard
+  const DhtNode* entry = shards_.front();
+  shard->joinNetwork(entry->getDomainName(), entry->getPort());
+
+  threads_.push_back(std::thread([shard, idx] () {
+    pinToCore(idx);
+    shard->run();
+  }));
+
+  // Wait for the join to finish before letting the next shard in
+  if (!awaitJoin(idx) && !isFirstStopped_) {
+    std::cout << "\t- Shard " << idx << " hasn't joined yet. Starting next shard anyway..."
+        << std::endl;
+  }
+}
+
+bool ShardRuntime::awaitJoin(size_t idx) {
+  std::future<void> future = joined_.at(idx).get_future();
+  auto deadline = std::chrono::steady_clock::now()
+      + std::chrono::seconds(SHARD_JOIN_TIMEOUT_SECS);
+
+  // Wake up now and then, so that a quit doesn't wait out the timeout
+  while (!isFirstStopped_ && std::chrono::steady_clock::now() < deadline) {
+    if (future.wait_for(std::chrono::milliseconds(SHARD_JOIN_POLL_MSEC))
+        == std::future_status::ready)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ShardRuntime::run() {
+  DhtNode* first = shards_.front();
+
+  if (shards_.size() == 1) {
+    // Nothing to coordinate, run on the calling thread
+    if (hasTarget_) {
+      first->joinNetwork(seeds_);
+    }
+
+    first->run();
+    return;
+  }
+
+  std::promise<void>& first_joined = joined_.front();
+  first->setJoinedCallback([&first_joined] () { first_joined.set_value(); });
+
+  if (hasTarget_) {
+    first->joinNetwork(seeds_);
+  }
+
+  // Run the first shard on its own thread until the others have joined
+  std::thread first_thread([this, first] () {
+    pinToCore(0);
+    first->run();
+    isFirstStopped_ = true;
+  });
+
+  // The others enter the ring through the first shard, so they can't start
+  // until it's in. If it never gets in, it runs alone until the user quits.
+  if (awaitJoin(0)) {
+    for (size_t i = 1; i < shards_.size() && !isFirstStopped_; ++i) {
+      startShard(i);
+    }
+  } else if (!isFirstStopped_) {
+    std::cout << "\t- Shard 0 hasn't joined the network. Not starting the other shards..."
+        << std::endl;
+  }
+
+  // Block until the first shard quits
+  first_thread.join();
+}
+
+void ShardRuntime::close() {
+  // Stop shards in reverse order, so the remaining ones keep serving.
+  // Shards past the last thread were never started.
+  for (size_t i = shards_.size() - 1; i > 0; --i) {
+    if (i <= threads_.size()) {
+      shards_.at(i)->stop();
+      threads_.at(i - 1).join();
+    }
+
+    shards_.at(i)->close();
+    delete shards_.at(i);
+  }
+
+  threads_.clear();
+
+  shards_.front()->close();
+  delete shards_.front();
+  shards_.clear();
+}
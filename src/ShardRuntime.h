@@ -0,0 +1,152 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <stdint.h>
+
+#include "DhtNode.h"
+#include "LocalTransport.h"
+
+#define MAX_SHARDS 64
+#define SHARD_JOIN_TIMEOUT_SECS 10
+#define SHARD_JOIN_POLL_MSEC 100  // how often a wait for a join checks for quit
+
+class ShardRuntime {
+
+  private:
+    /**
+     * Ring members run by this process, one per thread. The first shard
+     * reads commands from stdin and is the entry point for the others.
+     */
+    std::vector<DhtNode*> shards_;
+
+    /**
+     * Carries dht traffic between the shards, so that only other
+     * processes are reached over TCP.
+     */
+    LocalTransport transport_;
+
+    /**
+     * Threads running shards 1..n. Shard 0 runs on the calling thread.
+     */
+    std::vector<std::thread> threads_;
+
+    /**
+     * Fulfilled once the corresponding shard has joined the network.
+     */
+    std::vector<std::promise<void>> joined_;
+
+    /**
+     * Nodes to join the network through, if specified.
+     */
+    std::vector<seed_t> seeds_;
+
+    /**
+     * Indicates whether or not a target has been specified.
+     */
+    bool hasTarget_;
+
+    /**
+     * Set once the first shard stops running, e.g. b/c the user quit.
+     */
+    std::atomic<bool> isFirstStopped_;
+
+    /**
+     * pinToCore()
+     * - Restrict the calling thread to a single core.
+     * @param core : index of core (wraps around the number of cores)
+     */
+    static void pinToCore(size_t core);
+
+    /**
+     * awaitJoin()
+     * - Block until the shard has joined the network, the first shard has
+     *   stopped, or SHARD_JOIN_TIMEOUT_SECS have passed.
+     * @param idx : index of shard
+     * @return true iff the shard joined
+     */
+    bool awaitJoin(size_t idx);
+
+    /**
+     * startShard()
+     * - Join shard to the network and start running it on its own thread.
+     *   Block until the shard has joined, so that joins happen one at a time.
+     * @param idx : index of shard
+     */
+    void startShard(size_t idx);
+
+  public:
+    /**
+     * ShardRuntime()
+     * - Create shards for this process.
+     * @param num_shards : number of shards, 0 for one per core
+     * @param num_virtual_nodes : virtual nodes hosted by each shard
+     * @param has_id : true iff the first shard's id is overridden
+     * @param id : id of the first shard, if overridden
+     * @param image_store : where the images live
+     */
+    ShardRuntime(
+        size_t num_shards,
+        size_t num_virtual_nodes,
+        bool has_id,
+        uint8_t id,
+        const ImageStore& image_store);
+
+    /**
+     * joinNetwork()
+     * - Join the network through the seeds rather than starting a new one.
+     * @param seeds : nodes to join through
+     */
+    void joinNetwork(const std::vector<seed_t>& seeds);
+
+    /**
+     * enableSnapshots()
+     * - Restore each shard from its own snapshot and keep them up-to-date.
+     *   Shard i > 0 uses '<path>.<i>'.
+     * @param path : path of the first shard's snapshot
+     */
+    void enableSnapshots(const std::string& path);
+
+    /**
+     * enableHedging()
+     * - Hedge each shard's image queries after the provided delay.
+     * @param delay_msec : hedge delay in milliseconds
+     */
+    void enableHedging(size_t delay_msec);
+
+    /**
+     * enableIterativeLookups()
+     * - Resolve each shard's image queries iteratively.
+     * @param alpha : number of parallel probes per lookup
+     */
+    void enableIterativeLookups(size_t alpha);
+
+    /**
+     * enableProximityRouting()
+     * - Let each shard route through much nearer fingers.
+     * @param slack_ids : ids of progress a shard will give up
+     */
+    void enableProximityRouting(size_t slack_ids);
+
+    /**
+     * delayPeers()
+     * - Hold up each shard's connections to the provided nodes.
+     * @param delays : delay to add per node
+     */
+    void delayPeers(const std::vector<peer_delay_t>& delays);
+
+    /**
+     * run()
+     * - Start every shard and run until the first shard quits.
+     */
+    void run();
+
+    /**
+     * close()
+     * - Stop remaining shards and tear them down.
+     */
+    void close();
+};
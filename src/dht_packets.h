@@ -22,7 +22,17 @@
 #define DHTM_RPLY 0x20   // reply to image search on the DHT
 #define DHTM_MISS 0x22   // image not found on the DHT 
 
+#define DHTM_LEAVE 0x50  // leaving node hands its range to its successor
+#define DHTM_SUCC  0x60  // leaving node hands its successor to its predecessor
+#define DHTM_XFER  0x70  // accepting node hands images to the joining node
+
+#define DHTM_ISRCH 0x30  // iterative image search, answered on the same connection
+#define DHTM_NEXT  0x32  // reply to ISRCH with the next hop towards the image
+
 #define DHT_MAX_FILE_NAME 256
+#define DHTM_BFIDX_TAG_MASK 0xc0  // bloom indices are 6 bits, so the top two are free
+#define DHTM_BFIDX_VALID 0x80     // tag of an index set by the sender
+#define DHTM_BFIDX_MASK 0x3f
 
 enum DhtType {
   JOIN = 0x08,
@@ -33,7 +43,14 @@ enum DhtType {
   SRCH = 0x10,
   SRCH_ATLOC = (DHTM_ATLOC | SRCH),
   RPLY = 0x20,
-  MISS = 0x22
+  MISS = 0x22,
+  LEAVE = 0x50,
+  SUCC = 0x60,
+  XFER = 0x70,
+  ISRCH = 0x30,
+  ISRCH_ATLOC = (DHTM_ATLOC | ISRCH),
+  NEXT = 0x32,
+  NEXT_ATLOC = (DHTM_ATLOC | NEXT)
 };
 
 typedef struct {
@@ -53,6 +70,8 @@ typedef struct {
   uint16_t ttl;       // used by JOIN only
   dhtnode_t node;     // REDRT: new successor
                       // JOIN: node attempting to join DHT
+                      // NEXT: next hop towards the image, or the
+                      // sender's predecessor if ISRCH_ATLOC missed
 } dhtmsg_t;           // 12 bytes
 
 typedef struct {
@@ -63,10 +82,36 @@ typedef struct {
 typedef struct {
   uint8_t id;
   char name[DHT_MAX_FILE_NAME];
-  uint8_t rsvd[3];
+  uint8_t rsvd[3];    // bloom filter indices of the name, each tagged
+                      // w/DHTM_BFIDX_VALID so that receivers can skip sha1
 } dhtimg_t;
 
 typedef struct {            // PA2
   dhtmsg_t msg;                
   dhtimg_t img;
 } dhtsrch_t;                // used by QUERY, REPLY, and MISS
+
+typedef struct {
+  dhtmsg_t msg;         // LEAVE: predecessor of leaving node
+                        // SUCC: successor of leaving node
+  dhtnode_t leaving;    // node leaving the DHT
+  uint16_t num_imgs;    // LEAVE: number of dhthandoff_t (cached images) that follow
+  uint16_t rsvd;
+} dhtleave_t;
+
+typedef struct {
+  dhtmsg_t msg;         // XFER: node handing over the images
+  uint16_t num_imgs;    // number of dhthandoff_t that follow
+  uint16_t rsvd;
+} dhtxfer_t;
+
+typedef struct {
+  dhtimg_t img;
+  uint32_t count;       // sender's request count estimate for the image
+} dhthandoff_t;         // follows dhtxfer_t and dhtleave_t
+
+typedef struct {
+  dhtmsg_t msg;         // REID: node that detected the collision
+  dhtnode_t free;       // free id, and the node to send the next JOIN to
+                        // port is 0 if the sender knows of no free id
+} dhtreid_t;
@@ -0,0 +1,133 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <stdlib.h>        // exit()
+#include <sys/stat.h>      // stat()
+
+#include "ImageStore.h"
+
+#define ROOT_DELIMITER ','
+
+/**
+ * imgstripe places images for dhtdb's striped storage. Given the image
+ * folders in the same order as dhtdb's -D, it prints a mv command for every
+ * manifest image that sits in a folder other than the one its name hashes
+ * to. Run the commands to stripe the images, e.g.
+ *
+ *   ./imgstripe /disk0/images,/disk1/images | sh
+ *
+ * The manifest is read from the first folder, as dhtdb does.
+ */
+
+/**
+ * failWithMessage()
+ * - Fail the program due to invalid cli parameters.
+ * @param message : message to report to user
+ */
+void failWithMessage(const std::string& message) {
+  std::cerr << message << "\nCli invocation: ./imgstripe <image-dir>[,<image-dir>...]" << std::endl;
+  exit(1);
+}
+
+/**
+ * splitRoots()
+ * - Split comma-separated list of image folders.
+ * @param roots_cstr : <dir>[,<dir>...]
+ */
+std::vector<std::string> splitRoots(const char* roots_cstr) {
+  std::string roots_str(roots_cstr);
+  std::vector<std::string> roots;
+
+  size_t start_idx = 0;
+  while (true) {
+    size_t delim_idx = roots_str.find(ROOT_DELIMITER, start_idx);
+    roots.push_back(roots_str.substr(start_idx, delim_idx - start_idx));
+
+    if (delim_idx == std::string::npos) {
+      break;
+    }
+
+    start_idx = delim_idx + 1;
+  }
+
+  if (roots.size() > MAX_IMAGE_ROOTS) {
+    failWithMessage(std::string("At most ") + std::to_string(MAX_IMAGE_ROOTS)
+        + " image folders are supported.");
+  }
+
+  return roots;
+}
+
+/**
+ * isFile()
+ * - Return true iff the path names a regular file.
+ * @param path : path of file
+ */
+bool isFile(const std::string& path) {
+  struct stat file_stat;
+  return ::stat(path.c_str(), &file_stat) == 0 && S_ISREG(file_stat.st_mode);
+}
+
+/**
+ * quote()
+ * - Quote the string for the shell.
+ * @param str : string to quote
+ */
+std::string quote(const std::string& str) {
+  std::string quoted("'");
+  for (char c : str) {
+    quoted += (c == '\'') ? std::string("'\\''") : std::string(1, c);
+  }
+
+  return quoted + "'";
+}
+
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    failWithMessage("Expected the image folders.");
+  }
+
+  ImageStore store(splitRoots(argv[1]));
+
+  std::ifstream manifest(store.getManifestPath());
+  if (manifest.fail()) {
+    failWithMessage(std::string("Couldn't open manifest: ") + store.getManifestPath());
+  }
+
+  size_t num_placed = 0;
+  size_t num_moved = 0;
+  size_t num_missing = 0;
+
+  std::string file_name;
+  while (manifest >> file_name) {
+    std::string path = store.getPath(file_name);
+    if (isFile(path)) {
+      ++num_placed;
+      continue;
+    }
+
+    // Look for the image in the other folders
+    bool is_found = false;
+    for (const std::string& root : store.getRoots()) {
+      if (isFile(root + file_name)) {
+        std::cout << "mv " << quote(root + file_name) << " " << quote(path) << std::endl;
+        is_found = true;
+        break;
+      }
+    }
+
+    if (is_found) {
+      ++num_moved;
+    } else {
+      std::cerr << "Missing image: " << file_name << std::endl;
+      ++num_missing;
+    }
+  }
+
+  // Report where the images stand, away from the commands
+  std::cerr << num_placed << " image(s) in place, " << num_moved << " to move, "
+      << num_missing << " missing" << std::endl;
+
+  return 0;
+}
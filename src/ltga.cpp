@@ -32,7 +32,8 @@ THE POSSIBILITY OF SUCH DAMAGE.
 //--------------------------------------------------
 // global functions
 //--------------------------------------------------
-static int TGAReadError = 0;
+// per thread, so that images can be loaded on several threads at once
+static thread_local int TGAReadError = 0;
 
 void ReadData(std::ifstream &file, char* data, uint size)
 {
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <algorithm>
 #include <stdio.h>         // fprintf(), perror(), fflush()
 #include <stdlib.h>        // atoi()
 #include <assert.h>        // assert()
@@ -12,6 +13,7 @@
 #include <sys/types.h>     // u_short
 #include <sys/socket.h>    // socket API, setsockopt(), getsockname()
 #include <sys/ioctl.h>     // ioctl(), FIONBIO
+#include <sys/stat.h>      // stat()
 
 #include "ServiceBuilder.h"
 #include "Service.h"
@@ -20,19 +22,38 @@
 #include "ltga.h"
 #include "SocketException.h"
 #include "DhtNode.h"
+#include "ShardRuntime.h"
+#include "ImageStore.h"
 
 #define SHA1_LENGTH 20 // bytes
 #define ID_LENGTH 20
 
 // Cli constants
-#define MAX_NUM_CLI_ARGS 4
-#define MAX_NUM_FLAGS 2
+#define MAX_NUM_CLI_ARGS 20
+#define MAX_NUM_FLAGS 10
 
 #define CLI_FLAG_TOKEN '-'
 #define TARGET_DELIMITER ':'
+#define SEED_DELIMITER ','
+#define ROOT_DELIMITER ','
+#define PEER_DELIMITER ','
+#define DELAY_DELIMITER ':'
 
 #define TARGET_FLAG 'p'
 #define ID_FLAG 'I'
+#define VIRTUAL_NODES_FLAG 'V'
+#define SHARDS_FLAG 'K'
+#define SNAPSHOT_FLAG 'S'
+#define HEDGE_FLAG 'H'
+#define ALPHA_FLAG 'A'
+#define IMAGE_ROOTS_FLAG 'D'
+#define PROXIMITY_FLAG 'P'
+#define PEER_DELAY_FLAG 'L'
+
+#define MAX_HEDGE_DELAY_MSEC 60000
+#define MAX_LOOKUP_ALPHA 8
+#define MAX_PROXIMITY_SLACK_IDS (NUM_IDS / 2)
+#define MAX_PEER_DELAY_MSEC 10000
 
 
 /**
@@ -41,14 +62,21 @@
 enum NodeType {
   TARGET,
   ID_OVERRIDE,
+  VIRTUAL_NODES,
+  SHARDS,
+  SNAPSHOT,
+  HEDGE,
+  ITERATIVE,
+  IMAGE_ROOTS,
+  PROXIMITY,
+  PEER_DELAY,
 };
 
 /**
- * Configuration for target node.
+ * Configuration for target nodes.
  */
 struct cli_targ_config_t {
-  std::string fqdn;
-  uint16_t port;
+  std::vector<seed_t> seeds;
 };
 
 /**
@@ -58,12 +86,76 @@ struct cli_id_config_t {
   uint8_t id;
 };
 
+/**
+ * Configuration for virtual nodes hosted by this process.
+ */
+struct cli_vnode_config_t {
+  size_t count;
+};
+
+/**
+ * Configuration for shards run by this process.
+ */
+struct cli_shard_config_t {
+  size_t count;
+};
+
+/**
+ * Configuration for node-state snapshots.
+ */
+struct cli_snapshot_config_t {
+  std::string path;
+};
+
+/**
+ * Configuration for hedged image queries.
+ */
+struct cli_hedge_config_t {
+  size_t delay_msec;
+};
+
+/**
+ * Configuration for iterative image queries.
+ */
+struct cli_alpha_config_t {
+  size_t alpha;
+};
+
+/**
+ * Configuration for image storage.
+ */
+struct cli_roots_config_t {
+  std::vector<std::string> roots;
+};
+
+/**
+ * Configuration for proximity routing.
+ */
+struct cli_proximity_config_t {
+  size_t slack_ids;
+};
+
+/**
+ * Configuration for artificial delays to other nodes.
+ */
+struct cli_delay_config_t {
+  std::vector<peer_delay_t> delays;
+};
+
 /**
  * Configuration for node.
  */
 struct cli_config_t {
   cli_targ_config_t targ_config;
   cli_id_config_t id_config;
+  cli_vnode_config_t vnode_config;
+  cli_shard_config_t shard_config;
+  cli_snapshot_config_t snapshot_config;
+  cli_hedge_config_t hedge_config;
+  cli_alpha_config_t alpha_config;
+  cli_roots_config_t roots_config;
+  cli_proximity_config_t proximity_config;
+  cli_delay_config_t delay_config;
   NodeType types[MAX_NUM_FLAGS];
   size_t num_types;
 };
@@ -74,7 +166,7 @@ struct cli_config_t {
  * @param message : message to report to user
  */
 void failCliWithMessage(const std::string& message) {
-  std::cout << message << "\nCli invocation: ./dhtdb [-p <node>:<port> -I <ID>]" << std::endl;
+  std::cout << message << "\nCli invocation: ./dhtdb [-p <node>:<port>[,<node>:<port>...] -I <ID> -V <num-virtual-nodes> -K <num-shards> -S <snapshot-path> -H <hedge-delay-ms> -A <lookup-alpha> -D <image-dir>[,<image-dir>...] -P <proximity-slack-ids> -L <ID>:<delay-ms>[,<ID>:<delay-ms>...]]" << std::endl;
   exit(1);
 }
 
@@ -98,10 +190,9 @@ void registerCliConfigType(cli_config_t& config, NodeType type) {
 /**
  * deserializeTarget()
  * - Deserialize target fqdn and port from human-readable address.
- * @param target : <fqdn>:<port>
+ * @param targ_str : <fqdn>:<port>
  */
-const cli_targ_config_t deserializeTarget(const char* target) {
-  std::string targ_str(target);
+const seed_t deserializeTarget(const std::string& targ_str) {
   size_t delim_idx = targ_str.find(TARGET_DELIMITER);
   
   // Fail due to invalid address (missing address delimiter)
@@ -109,15 +200,46 @@ const cli_targ_config_t deserializeTarget(const char* target) {
     failCliWithMessage("Malformed target address. Missing delimiter.");
   }
 
-  cli_targ_config_t targ_config;
-  targ_config.fqdn = targ_str.substr(0, delim_idx);
+  seed_t seed;
+  seed.fqdn = targ_str.substr(0, delim_idx);
 
   try {
-    targ_config.port = (uint16_t) std::stoi(targ_str.substr(delim_idx + 1));
+    seed.port = (uint16_t) std::stoi(targ_str.substr(delim_idx + 1));
   } catch (...) {
     failCliWithMessage("Non-numeric port number.");    
   }
 
+  return seed;
+}
+
+/**
+ * deserializeTargets()
+ * - Deserialize comma-separated list of target addresses.
+ * @param targets : <fqdn>:<port>[,<fqdn>:<port>...]
+ */
+const cli_targ_config_t deserializeTargets(const char* targets) {
+  std::string targets_str(targets);
+  cli_targ_config_t targ_config;
+
+  size_t start_idx = 0;
+  while (true) {
+    size_t delim_idx = targets_str.find(SEED_DELIMITER, start_idx);
+    targ_config.seeds.push_back(
+        deserializeTarget(targets_str.substr(start_idx, delim_idx - start_idx)));
+
+    if (delim_idx == std::string::npos) {
+      break;
+    }
+
+    start_idx = delim_idx + 1;
+  }
+
+  // Fail due to too many seeds
+  if (targ_config.seeds.size() > MAX_NUM_SEEDS) {
+    failCliWithMessage(std::string("At most ") + std::to_string(MAX_NUM_SEEDS) 
+        + " targets are supported.");
+  }
+
   return targ_config;
 }
 
@@ -153,6 +275,262 @@ const cli_id_config_t deserializeId(const char* id_cstr) {
   exit(1); /* Should never hit this */
 }
 
+/**
+ * deserializeVirtualNodes()
+ * - Parse and validate number of virtual nodes from cli string.
+ * @param count_cstr : virtual node count string
+ */
+const cli_vnode_config_t deserializeVirtualNodes(const char* count_cstr) {
+  const std::string count_str(count_cstr);
+  try {
+    // Parse int from 'count_str'
+    int count = std::stoi(count_str);
+
+    // Validate count range
+    if (count < 1 || count > MAX_VIRTUAL_NODES) {
+      failCliWithMessage(std::string("Virtual node count must be in [1, ")
+          + std::to_string(MAX_VIRTUAL_NODES) + "]: " + count_str);
+    }
+
+    return cli_vnode_config_t{static_cast<size_t>(count)};
+
+  } catch (const std::invalid_argument& e) {
+    failCliWithMessage(std::string("Non-numeric virtual node count: ") + count_str);
+  } catch (const std::out_of_range& e) {
+    failCliWithMessage(std::string("Virtual node count too large: ") + count_str);
+  }
+
+  exit(1); /* Should never hit this */
+}
+
+/**
+ * deserializeShards()
+ * - Parse and validate number of shards from cli string.
+ *   0 runs one shard per core.
+ * @param count_cstr : shard count string
+ */
+const cli_shard_config_t deserializeShards(const char* count_cstr) {
+  const std::string count_str(count_cstr);
+  try {
+    // Parse int from 'count_str'
+    int count = std::stoi(count_str);
+
+    // Validate count range
+    if (count < 0 || count > MAX_SHARDS) {
+      failCliWithMessage(std::string("Shard count must be in [0, ")
+          + std::to_string(MAX_SHARDS) + "]: " + count_str);
+    }
+
+    return cli_shard_config_t{static_cast<size_t>(count)};
+
+  } catch (const std::invalid_argument& e) {
+    failCliWithMessage(std::string("Non-numeric shard count: ") + count_str);
+  } catch (const std::out_of_range& e) {
+    failCliWithMessage(std::string("Shard count too large: ") + count_str);
+  }
+
+  exit(1); /* Should never hit this */
+}
+
+/**
+ * deserializeHedgeDelay()
+ * - Parse and validate the hedge delay from cli string.
+ *   0 disables hedging.
+ * @param delay_cstr : hedge delay string (millis)
+ */
+const cli_hedge_config_t deserializeHedgeDelay(const char* delay_cstr) {
+  const std::string delay_str(delay_cstr);
+  try {
+    // Parse int from 'delay_str'
+    int delay = std::stoi(delay_str);
+
+    // Validate delay range
+    if (delay < 0 || delay > MAX_HEDGE_DELAY_MSEC) {
+      failCliWithMessage(std::string("Hedge delay must be in [0, ")
+          + std::to_string(MAX_HEDGE_DELAY_MSEC) + "] ms: " + delay_str);
+    }
+
+    return cli_hedge_config_t{static_cast<size_t>(delay)};
+
+  } catch (const std::invalid_argument& e) {
+    failCliWithMessage(std::string("Non-numeric hedge delay: ") + delay_str);
+  } catch (const std::out_of_range& e) {
+    failCliWithMessage(std::string("Hedge delay too large: ") + delay_str);
+  }
+
+  exit(1); /* Should never hit this */
+}
+
+/**
+ * deserializeAlpha()
+ * - Parse and validate the number of parallel probes per iterative
+ *   lookup from cli string. 0 selects recursive lookups.
+ * @param alpha_cstr : probe count string
+ */
+const cli_alpha_config_t deserializeAlpha(const char* alpha_cstr) {
+  const std::string alpha_str(alpha_cstr);
+  try {
+    // Parse int from 'alpha_str'
+    int alpha = std::stoi(alpha_str);
+
+    // Validate alpha range
+    if (alpha < 0 || alpha > MAX_LOOKUP_ALPHA) {
+      failCliWithMessage(std::string("Lookup alpha must be in [0, ")
+          + std::to_string(MAX_LOOKUP_ALPHA) + "]: " + alpha_str);
+    }
+
+    return cli_alpha_config_t{static_cast<size_t>(alpha)};
+
+  } catch (const std::invalid_argument& e) {
+    failCliWithMessage(std::string("Non-numeric lookup alpha: ") + alpha_str);
+  } catch (const std::out_of_range& e) {
+    failCliWithMessage(std::string("Lookup alpha too large: ") + alpha_str);
+  }
+
+  exit(1); /* Should never hit this */
+}
+
+/**
+ * deserializeProximitySlack()
+ * - Parse and validate the ids of progress that proximity routing may
+ *   give up from cli string. 0 disables proximity routing.
+ * @param slack_cstr : slack string
+ */
+const cli_proximity_config_t deserializeProximitySlack(const char* slack_cstr) {
+  const std::string slack_str(slack_cstr);
+  try {
+    // Parse int from 'slack_str'
+    int slack = std::stoi(slack_str);
+
+    // Validate slack range
+    if (slack < 0 || slack > MAX_PROXIMITY_SLACK_IDS) {
+      failCliWithMessage(std::string("Proximity slack must be in [0, ")
+          + std::to_string(MAX_PROXIMITY_SLACK_IDS) + "] ids: " + slack_str);
+    }
+
+    return cli_proximity_config_t{static_cast<size_t>(slack)};
+
+  } catch (const std::invalid_argument& e) {
+    failCliWithMessage(std::string("Non-numeric proximity slack: ") + slack_str);
+  } catch (const std::out_of_range& e) {
+    failCliWithMessage(std::string("Proximity slack too large: ") + slack_str);
+  }
+
+  exit(1); /* Should never hit this */
+}
+
+/**
+ * deserializePeerDelay()
+ * - Deserialize a node's id and the delay to add to connections to it.
+ * @param delay_str : <id>:<delay-ms>
+ */
+const peer_delay_t deserializePeerDelay(const std::string& delay_str) {
+  size_t delim_idx = delay_str.find(DELAY_DELIMITER);
+
+  // Fail due to missing delimiter
+  if (delim_idx == std::string::npos) {
+    failCliWithMessage("Malformed peer delay. Missing delimiter.");
+  }
+
+  int id = -1;
+  int delay = -1;
+  try {
+    id = std::stoi(delay_str.substr(0, delim_idx));
+    delay = std::stoi(delay_str.substr(delim_idx + 1));
+  } catch (...) {
+    failCliWithMessage(std::string("Non-numeric peer delay: ") + delay_str);
+  }
+
+  // Validate id and delay ranges
+  if (id < 0 || id >= NUM_IDS) {
+    failCliWithMessage(std::string("Peer id must be in [0, ") + std::to_string(NUM_IDS)
+        + "): " + delay_str);
+  }
+
+  if (delay < 0 || delay > MAX_PEER_DELAY_MSEC) {
+    failCliWithMessage(std::string("Peer delay must be in [0, ")
+        + std::to_string(MAX_PEER_DELAY_MSEC) + "] ms: " + delay_str);
+  }
+
+  return peer_delay_t{static_cast<uint8_t>(id), static_cast<size_t>(delay)};
+}
+
+/**
+ * deserializePeerDelays()
+ * - Deserialize comma-separated list of peer delays.
+ * @param delays_cstr : <id>:<delay-ms>[,<id>:<delay-ms>...]
+ */
+const cli_delay_config_t deserializePeerDelays(const char* delays_cstr) {
+  std::string delays_str(delays_cstr);
+  cli_delay_config_t delay_config;
+
+  size_t start_idx = 0;
+  while (true) {
+    size_t delim_idx = delays_str.find(PEER_DELIMITER, start_idx);
+    delay_config.delays.push_back(
+        deserializePeerDelay(delays_str.substr(start_idx, delim_idx - start_idx)));
+
+    if (delim_idx == std::string::npos) {
+      break;
+    }
+
+    start_idx = delim_idx + 1;
+  }
+
+  return delay_config;
+}
+
+/**
+ * deserializeImageRoots()
+ * - Parse and validate comma-separated list of image folders. Images are
+ *   striped across them, so each should be on its own disk. imgstripe moves
+ *   the images into place.
+ * @param roots_cstr : <dir>[,<dir>...]
+ */
+const cli_roots_config_t deserializeImageRoots(const char* roots_cstr) {
+  std::string roots_str(roots_cstr);
+  cli_roots_config_t roots_config;
+
+  // Device and inode of each folder, so that one folder can't be listed 
+  // twice under different paths
+  std::vector<std::pair<dev_t, ino_t>> root_ids;
+
+  size_t start_idx = 0;
+  while (true) {
+    size_t delim_idx = roots_str.find(ROOT_DELIMITER, start_idx);
+    std::string root = roots_str.substr(start_idx, delim_idx - start_idx);
+
+    // Fail due to a folder that doesn't exist
+    struct stat root_stat;
+    if (::stat(root.c_str(), &root_stat) == -1 || !S_ISDIR(root_stat.st_mode)) {
+      failCliWithMessage(std::string("Image folder doesn't exist: ") + root);
+    }
+
+    // Fail due to a folder listed twice, which would skew the striping
+    std::pair<dev_t, ino_t> root_id(root_stat.st_dev, root_stat.st_ino);
+    if (std::find(root_ids.begin(), root_ids.end(), root_id) != root_ids.end()) {
+      failCliWithMessage(std::string("Duplicate image folder: ") + root);
+    }
+
+    root_ids.push_back(root_id);
+    roots_config.roots.push_back(root);
+
+    if (delim_idx == std::string::npos) {
+      break;
+    }
+
+    start_idx = delim_idx + 1;
+  }
+
+  // Fail due to too many folders
+  if (roots_config.roots.size() > MAX_IMAGE_ROOTS) {
+    failCliWithMessage(std::string("At most ") + std::to_string(MAX_IMAGE_ROOTS) 
+        + " image folders are supported.");
+  }
+
+  return roots_config;
+}
+
 /**
  * processCliParam()
  * - Deserialize cli params.
@@ -192,7 +570,7 @@ size_t processCliParam(
 
   switch (flag) {
     case TARGET_FLAG: {
-      const cli_targ_config_t targ_config = deserializeTarget(param_str); 
+      const cli_targ_config_t targ_config = deserializeTargets(param_str); 
       registerCliConfigType(config, TARGET);
       config.targ_config = targ_config;
       num_consumed_cli_params = 1;
@@ -205,6 +583,61 @@ size_t processCliParam(
       num_consumed_cli_params = 1;
       break;
     }
+    case VIRTUAL_NODES_FLAG: {
+      const cli_vnode_config_t vnode_config = deserializeVirtualNodes(param_str);
+      registerCliConfigType(config, VIRTUAL_NODES);
+      config.vnode_config = vnode_config;
+      num_consumed_cli_params = 1;
+      break;
+    }
+    case SHARDS_FLAG: {
+      const cli_shard_config_t shard_config = deserializeShards(param_str);
+      registerCliConfigType(config, SHARDS);
+      config.shard_config = shard_config;
+      num_consumed_cli_params = 1;
+      break;
+    }
+    case SNAPSHOT_FLAG: {
+      registerCliConfigType(config, SNAPSHOT);
+      config.snapshot_config.path = param_str;
+      num_consumed_cli_params = 1;
+      break;
+    }
+    case HEDGE_FLAG: {
+      const cli_hedge_config_t hedge_config = deserializeHedgeDelay(param_str);
+      registerCliConfigType(config, HEDGE);
+      config.hedge_config = hedge_config;
+      num_consumed_cli_params = 1;
+      break;
+    }
+    case ALPHA_FLAG: {
+      const cli_alpha_config_t alpha_config = deserializeAlpha(param_str);
+      registerCliConfigType(config, ITERATIVE);
+      config.alpha_config = alpha_config;
+      num_consumed_cli_params = 1;
+      break;
+    }
+    case IMAGE_ROOTS_FLAG: {
+      const cli_roots_config_t roots_config = deserializeImageRoots(param_str);
+      registerCliConfigType(config, IMAGE_ROOTS);
+      config.roots_config = roots_config;
+      num_consumed_cli_params = 1;
+      break;
+    }
+    case PROXIMITY_FLAG: {
+      const cli_proximity_config_t proximity_config = deserializeProximitySlack(param_str);
+      registerCliConfigType(config, PROXIMITY);
+      config.proximity_config = proximity_config;
+      num_consumed_cli_params = 1;
+      break;
+    }
+    case PEER_DELAY_FLAG: {
+      const cli_delay_config_t delay_config = deserializePeerDelays(param_str);
+      registerCliConfigType(config, PEER_DELAY);
+      config.delay_config = delay_config;
+      num_consumed_cli_params = 1;
+      break;
+    }
     default:
       failCliWithMessage(std::string("Invalid flag: ") + flag);
   }
@@ -230,6 +663,9 @@ const cli_config_t processDhtdbArgs(int argc, const char * const * argv) {
   // Process cli args
   cli_config_t config;
   config.num_types = 0;
+  config.vnode_config.count = 1;
+  config.shard_config.count = 1;
+  config.roots_config.roots.push_back(IMAGE_FOLDER);
   size_t arg_idx = 0;
 
   while (arg_idx != num_args) {
@@ -245,6 +681,11 @@ int main(int argc, char** argv) {
 
   bool has_targ = false;
   bool has_id = false;
+  bool has_snapshot = false;
+  bool has_hedge = false;
+  bool has_alpha = false;
+  bool has_proximity = false;
+  bool has_delay = false;
 
   for (size_t i = 0; i < config.num_types; ++i) {
     NodeType type = config.types[i];
@@ -255,26 +696,81 @@ int main(int argc, char** argv) {
       case TARGET:
         has_targ = true;
         break;
+      case SNAPSHOT:
+        has_snapshot = true;
+        break;
+      case HEDGE:
+        has_hedge = true;
+        break;
+      case ITERATIVE:
+        has_alpha = true;
+        break;
+      case PROXIMITY:
+        has_proximity = true;
+        break;
+      case PEER_DELAY:
+        has_delay = true;
+        break;
+      case VIRTUAL_NODES:
+      case SHARDS:
+      case IMAGE_ROOTS:
+        break;
       default:
         failCliWithMessage(std::string("Invalid type: ") + std::to_string(type));
     }
   }
 
-  // Initialize node w/id, if specified
-  DhtNode node = (has_id) 
-      ? DhtNode(config.id_config.id) 
-      : DhtNode();
+  // Report where the images live, if there's more than one folder
+  const std::vector<std::string>& roots = config.roots_config.roots;
+  if (roots.size() > 1) {
+    std::cout << "Striping images across " << roots.size() << " folders; "
+        << "the manifest lives in " << roots.front() << std::endl;
+  }
+
+  // Initialize shards, each hosting the requested number of virtual
+  // nodes. The first shard gets the id, if specified.
+  ShardRuntime runtime(
+      config.shard_config.count,
+      config.vnode_config.count,
+      has_id,
+      config.id_config.id,
+      ImageStore(roots));
+  
+  // Restore from the snapshot, if specified
+  if (has_snapshot) {
+    runtime.enableSnapshots(config.snapshot_config.path);
+  }
   
+  // Hedge slow image queries, if specified
+  if (has_hedge) {
+    runtime.enableHedging(config.hedge_config.delay_msec);
+  }
+
+  // Resolve image queries iteratively, if specified
+  if (has_alpha) {
+    runtime.enableIterativeLookups(config.alpha_config.alpha);
+  }
+
+  // Route through nearer fingers, if specified
+  if (has_proximity) {
+    runtime.enableProximityRouting(config.proximity_config.slack_ids);
+  }
+
+  // Emulate far away nodes, if specified
+  if (has_delay) {
+    runtime.delayPeers(config.delay_config.delays);
+  }
+
   // Connect to target, if target is specified,
   if (has_targ) {
-    node.joinNetwork(config.targ_config.fqdn, config.targ_config.port);  
+    runtime.joinNetwork(config.targ_config.seeds);  
   }
 
   // Run node loop 
-  node.run();
+  runtime.run();
   
   // Close node resources 
-  node.close();
+  runtime.close();
 
   return 0;
 }
@@ -21,6 +21,7 @@
 #include <stdlib.h>        // atoi()
 #include <assert.h>        // assert()
 #include <limits.h>        // LONG_MAX
+#include <time.h>          // clock()
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>      // socklen_t
@@ -51,6 +52,14 @@ imsg_t imsg;
 long img_size;    
 long img_offset=0L;
 char *image;
+int img_rle=0;            /* pixels arrive as RLE packets */
+
+#define NETIMG_RLEBUF (NETIMG_NUMSEG*NETIMG_MSS)
+
+unsigned char rle_buf[NETIMG_RLEBUF];  /* RLE packets received but not yet decoded */
+long rle_len=0L;
+long rle_wire=0L;         /* bytes of RLE packets received */
+clock_t rle_clocks=0;     /* spent decoding them */
 
 void
 netimg_usage(char *progname)
@@ -177,7 +186,7 @@ netimg_sendqry(char *imagename, char vers)
   iqry_t iqry;
 
   iqry.header.vers = vers;
-  iqry.header.type = NETIMG_QRY;
+  iqry.header.type = NETIMG_QRY | NETIMG_RLE_OK;
   strcpy(iqry.iq_name, imagename);
 
   bytes = send(sd, (char *) &iqry, sizeof(iqry_t), 0);
@@ -236,6 +245,9 @@ netimg_recvimsg()
     imsg.im_width = ntohs(imsg.im_width);
     imsg.im_height = ntohs(imsg.im_height);
 
+  // Old servers leave im_rle unset, but never flag the type
+  img_rle = imsg.header.type == (NETIMG_RPY | NETIMG_RLE_OK) && imsg.im_rle == 1;
+
   if (imsg.im_found == NETIMG_FOUND) {
     img_dsize = (double) (imsg.im_height*imsg.im_width*(u_short)imsg.im_depth);
     img_size = (long) img_dsize;                 // global
@@ -244,6 +256,51 @@ netimg_recvimsg()
   return imsg.im_found; 
 }
 
+/*
+ * netimg_unrle: decode the whole RLE packets in "rle_buf" into "image" at
+ * "img_offset", and keep the last packet if it's cut short. A packet
+ * starts with a byte that holds its pixel count - 1 in the low 7 bits.
+ * If NETIMG_RLE_RUN is set, one pixel follows that repeats count times,
+ * else count raw pixels follow.
+ * Terminate process if the packets overrun the image.
+ */
+void
+netimg_unrle()
+{
+  long depth = (long) imsg.im_depth;
+  long i = 0L;
+
+  while (i < rle_len) {
+    long count = (long) (rle_buf[i] & (NETIMG_RLE_RUN - 1)) + 1;
+    int is_run = rle_buf[i] & NETIMG_RLE_RUN;
+    long packet_len = 1 + (is_run ? depth : count*depth);
+
+    if (i + packet_len > rle_len) {
+      break;  // rest of the packet is still on the wire
+    }
+
+    // Fail due to a corrupt image
+    if (img_offset + count*depth > img_size) {
+      fprintf(stderr, "RLE packets overrun the image");
+      exit(1);
+    }
+
+    if (is_run) {
+      for (long j = 0; j < count; j++) {
+        memcpy(image + img_offset + j*depth, rle_buf + i + 1, depth);
+      }
+    } else {
+      memcpy(image + img_offset, rle_buf + i + 1, count*depth);
+    }
+
+    img_offset += count*depth;
+    i += packet_len;
+  }
+
+  rle_len -= i;
+  memmove(rle_buf, rle_buf + i, rle_len);
+}
+
 /* Callback functions for GLUT */
 
 /*
@@ -279,15 +336,37 @@ netimg_recvimg(void)
      * Update img_offset by the amount of data received, in preparation for the
      * next iteration, the next time this function is called.
      */
-    int num_bytes_read = recv(sd, image + img_offset, img_size - img_offset, 0);
-    
-    // Fail due to network error
-    if (num_bytes_read == -1) {
-        fprintf(stderr, "Network error occurred in recvimg");
-        exit(1);
+    if (img_rle) {
+      int num_bytes_read = recv(sd, (char *) rle_buf + rle_len, NETIMG_RLEBUF - rle_len, 0);
+
+      // Fail due to network error
+      if (num_bytes_read == -1) {
+          fprintf(stderr, "Network error occurred in recvimg");
+          exit(1);
+      }
+
+      rle_len += num_bytes_read;
+      rle_wire += num_bytes_read;
+
+      clock_t start = clock();
+      netimg_unrle();
+      rle_clocks += clock() - start;
+
+      if (img_offset == img_size) {
+        fprintf(stderr, "Received %ld bytes for a %ld byte image, decoded in %.3f ms\n",
+                rle_wire, img_size, 1000.0*rle_clocks/CLOCKS_PER_SEC);
+      }
+    } else {
+      int num_bytes_read = recv(sd, image + img_offset, img_size - img_offset, 0);
+
+      // Fail due to network error
+      if (num_bytes_read == -1) {
+          fprintf(stderr, "Network error occurred in recvimg");
+          exit(1);
+      }
+
+      img_offset += num_bytes_read;
     }
-    
-    img_offset += num_bytes_read;
 
     /* give the updated image to OpenGL for texturing */
     glTexImage2D(GL_TEXTURE_2D, 0, (GLint) imsg.im_format,
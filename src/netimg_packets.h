@@ -4,6 +4,11 @@
 
 #define NETIMG_QRY 0x1      // DO NOT REMOVE used in PA1
 #define NETIMG_RPY 0x2      // DO NOT REMOVE used in PA1
+#define NETIMG_RLE_OK 0x80  // set in a QRY's type iff the client decodes RLE pixels,
+                            // and in a RPY's type iff its pixels are RLE
+
+#define NETIMG_RLE_RUN 0x80        // RLE packet repeats one pixel, else holds raw pixels
+#define NETIMG_RLE_MAX_PIXELS 128  // per RLE packet; the low 7 bits hold count - 1
 
 /**
  * Packet types for netimg messages.
@@ -48,6 +53,7 @@ typedef struct {
   unsigned short im_width;
   unsigned short im_height;
   unsigned char im_adepth;  // not used
-  unsigned char im_rle;     // not used
+  unsigned char im_rle;     // 1 iff the pixels are sent as TGA-style RLE packets;
+                            // old servers leave it unset, so check the type too
 } imsg_t;
 
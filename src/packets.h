@@ -13,6 +13,11 @@
 
 #define NETIMG_QRY 0x1
 #define NETIMG_RPY 0x2
+#define NETIMG_RLE_OK 0x80  // set in a QRY's type iff we decode RLE pixels,
+                            // and in a RPY's type iff its pixels are RLE
+
+#define NETIMG_RLE_RUN 0x80        // RLE packet repeats one pixel, else holds raw pixels
+#define NETIMG_RLE_MAX_PIXELS 128  // per RLE packet; the low 7 bits hold count - 1
 
 #define NETIMG_FOUND 1
 #define NETIMG_NFOUND 0
@@ -96,7 +101,8 @@ struct imsg_t {
   unsigned short im_width;
   unsigned short im_height; 
   unsigned char im_adepth;   // not used
-  unsigned char im_rle;      // not used
+  unsigned char im_rle;      // 1 iff the pixels are sent as TGA-style RLE packets;
+                             // old servers leave it unset, so check the type too
 };
 
 /**
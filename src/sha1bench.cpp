@@ -0,0 +1,197 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <stdlib.h>        // exit()
+#include <string.h>        // memcmp()
+
+#include "hash.h"
+#include "Sha1Batch.h"
+
+#define MAX_CHECK_LENGTH 300       // bytes
+#define DEFAULT_NUM_NAMES 200000
+#define NUM_TIMED_RUNS 5           // best run is reported
+
+/**
+ * sha1bench checks Sha1Batch against SHA1() and compares their throughput
+ * on manifest-style names, e.g.
+ *
+ *   ./sha1bench [<num-names>]
+ *
+ * It exits w/ 1 if any digest differs.
+ */
+
+/**
+ * failWithMessage()
+ * - Fail the program due to invalid cli parameters.
+ * @param message : message to report to user
+ */
+void failWithMessage(const std::string& message) {
+  std::cerr << message << "\nCli invocation: ./sha1bench [<num-names>]" << std::endl;
+  exit(1);
+}
+
+/**
+ * makeMessage()
+ * - Return a message of the provided length. Bytes vary w/ the seed and
+ *   include zeros, so that padding bugs show.
+ * @param length : length in bytes
+ * @param seed : varies the contents
+ */
+std::string makeMessage(size_t length, size_t seed) {
+  std::string message(length, '\0');
+  for (size_t i = 0; i < length; ++i) {
+    message[i] = static_cast<char>((i * 31 + seed * 17) % 257);
+  }
+
+  return message;
+}
+
+/**
+ * checkDigests()
+ * - Return the number of messages whose batch digest differs from SHA1().
+ * @param messages : messages to hash
+ */
+size_t checkDigests(const std::vector<std::string>& messages) {
+  std::vector<Sha1Batch::digest_t> digests = Sha1Batch::digest(messages);
+
+  size_t num_bad = 0;
+  for (size_t i = 0; i < messages.size(); ++i) {
+    unsigned char md[SHA1_MDLEN];
+    SHA1((unsigned char *) messages[i].data(), messages[i].size(), md);
+
+    if (memcmp(md, digests[i].md, SHA1_MDLEN) != 0) {
+      std::cerr << "Digest mismatch for a " << messages[i].size() << "-byte message" << std::endl;
+      ++num_bad;
+    }
+  }
+
+  return num_bad;
+}
+
+/**
+ * checkLengths()
+ * - Compare Sha1Batch to SHA1() for every length up to MAX_CHECK_LENGTH,
+ *   alone and in batches that mix lengths across the lanes.
+ * @return number of mismatches
+ */
+size_t checkLengths() {
+  size_t num_bad = 0;
+  size_t num_checked = 0;
+
+  // Same length in every lane
+  for (size_t length = 0; length <= MAX_CHECK_LENGTH; ++length) {
+    std::vector<std::string> messages;
+    for (size_t seed = 0; seed < SHA1_BATCH_LANES; ++seed) {
+      messages.push_back(makeMessage(length, seed));
+    }
+
+    num_bad += checkDigests(messages);
+    num_checked += messages.size();
+  }
+
+  // Lanes finish after different numbers of blocks, and the last pass
+  // isn't full
+  for (size_t batch_size = 1; batch_size <= 2 * SHA1_BATCH_LANES + 1; ++batch_size) {
+    for (size_t start = 0; start <= MAX_CHECK_LENGTH; start += batch_size) {
+      std::vector<std::string> messages;
+      for (size_t i = 0; i < batch_size; ++i) {
+        size_t length = (start + i * SHA1_BLOCK_SIZE / 3) % (MAX_CHECK_LENGTH + 1);
+        messages.push_back(makeMessage(length, start + i));
+      }
+
+      num_bad += checkDigests(messages);
+      num_checked += messages.size();
+    }
+  }
+
+  // Report the cross-check
+  std::cout << "Checked " << num_checked << " digests of 0.." << MAX_CHECK_LENGTH
+      << " bytes against SHA1(): " << num_bad << " mismatch(es)" << std::endl;
+
+  return num_bad;
+}
+
+/**
+ * timeBest()
+ * - Return the shortest of NUM_TIMED_RUNS runs of 'run', in seconds.
+ * @param run : work to time
+ */
+template <typename Run>
+double timeBest(Run run) {
+  double best_secs = 0;
+  for (size_t i = 0; i < NUM_TIMED_RUNS; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    best_secs = (i == 0) ? secs : std::min(best_secs, secs);
+  }
+
+  return best_secs;
+}
+
+/**
+ * compareThroughput()
+ * - Time hashing manifest-style names one at a time w/ SHA1() and in
+ *   batches w/ Sha1Batch.
+ * @param num_names : number of names to hash
+ */
+void compareThroughput(size_t num_names) {
+  std::vector<std::string> names;
+  for (size_t i = 0; i < num_names; ++i) {
+    names.push_back("image" + std::to_string(i) + ".tga");
+  }
+
+  // Keep the digests live, so the loops aren't optimized away
+  size_t checksum = 0;
+
+  double loop_secs = timeBest([&] () {
+    for (const std::string& name : names) {
+      unsigned char md[SHA1_MDLEN];
+      SHA1((unsigned char *) name.data(), name.size(), md);
+      checksum += md[0];
+    }
+  });
+
+  double batch_secs = timeBest([&] () {
+    std::vector<Sha1Batch::digest_t> digests = Sha1Batch::digest(names);
+    for (const Sha1Batch::digest_t& digest : digests) {
+      checksum += digest.md[0];
+    }
+  });
+
+  // Report names hashed per second, best of the runs
+  std::cout << "Hashed " << num_names << " names (checksum " << checksum << "):" << std::endl;
+  std::cout << "\t- per-name SHA1(): " << num_names / loop_secs / 1e6 << " M names/s" << std::endl;
+  std::cout << "\t- Sha1Batch:       " << num_names / batch_secs / 1e6 << " M names/s ("
+      << loop_secs / batch_secs << "x)" << std::endl;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 2) {
+    failWithMessage("Too many cli arguments.");
+  }
+
+  size_t num_names = DEFAULT_NUM_NAMES;
+  if (argc == 2) {
+    try {
+      int count = std::stoi(argv[1]);
+      if (count <= 0) {
+        failWithMessage(std::string("Name count must be positive: ") + argv[1]);
+      }
+
+      num_names = static_cast<size_t>(count);
+    } catch (...) {
+      failWithMessage(std::string("Non-numeric name count: ") + argv[1]);
+    }
+  }
+
+  if (checkLengths()) {
+    return 1;
+  }
+
+  compareThroughput(num_names);
+  return 0;
+}